@@ -0,0 +1,8 @@
+
+BENCH_ARGS =
+
+bench: all
+	$(PHP_EXECUTABLE) -d extension=$(top_builddir)/modules/clmandelbrot.$(SHLIB_DL_SUFFIX_NAME) \
+		-d clmandelbrot.shm_cache_size=0 $(srcdir)/bench/bench.php $(BENCH_ARGS)
+
+.PHONY: bench
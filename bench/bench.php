@@ -0,0 +1,105 @@
+<?php
+/*
+ * Render pipeline benchmark; run with "make bench", which passes
+ * BENCH_ARGS on to this script:
+ *
+ *   --sizes=256,512,1024      square image sizes in pixels
+ *   --views=overview,boundary,interior
+ *   --zooms=1                 magnifications of the views
+ *   --iterations=200,1000     iteration limits
+ *   --devices=0,cpu           OpenCL device indexes, "cpu" and "all";
+ *                             every OpenCL device and "cpu" by default
+ *   --modes=direct,subdivide
+ *   --outputs=image           "image" times clmandelbrot(), "raw"
+ *                             clmandelbrot_raw()
+ *   --warmup=2 --repeat=10    unmeasured and measured renders per case
+ *   --quick                   one small case per view and device
+ *   --json=FILE               writes the results as JSON, "-" for stdout
+ *   --baseline=FILE           compares with the JSON of an earlier run and
+ *   --threshold=10            fails when a median is that many percent slower
+ *
+ * CPU-only OpenCL platforms such as pocl work as any other device, so
+ * the suite also runs on machines without a GPU.
+ */
+
+require dirname(__FILE__) . '/bench.inc';
+
+if (!extension_loaded('clmandelbrot')) {
+    fwrite(STDERR, "the clmandelbrot extension is not loaded\n");
+    exit(2);
+}
+
+$opts = getopt('', array(
+    'sizes:', 'views:', 'zooms:', 'iterations:', 'devices:', 'modes:', 'outputs:',
+    'warmup:', 'repeat:', 'quick', 'json:', 'baseline:', 'threshold:',
+));
+$config = clm_bench_defaults();
+if (isset($opts['quick'])) {
+    $config['sizes'] = array(256);
+    $config['iterations'] = array(200);
+    $config['modes'] = array('direct');
+    $config['warmup'] = 1;
+    $config['repeat'] = 3;
+}
+foreach (array('sizes', 'views', 'zooms', 'iterations', 'devices', 'modes', 'outputs') as $key) {
+    if (isset($opts[$key])) {
+        $config[$key] = explode(',', $opts[$key]);
+    }
+}
+foreach (array('warmup', 'repeat') as $key) {
+    if (isset($opts[$key])) {
+        $config[$key] = max($key == 'repeat' ? 1 : 0, (int)$opts[$key]);
+    }
+}
+$json = isset($opts['json']) ? $opts['json'] : null;
+$out = ($json === '-') ? STDERR : STDOUT;
+
+$results = array();
+fprintf($out, "%-5s %-9s %6s %7s %-6s %-9s %-6s %-8s %10s %10s %12s\n",
+        'size', 'view', 'zoom', 'iter', 'device', 'mode', 'output', 'backend',
+        'median ms', 'p95 ms', 'Mpix*iter/s');
+foreach (clm_bench_cases($config) as $case) {
+    $result = clm_bench_run($case, $config['warmup'], $config['repeat']);
+    if ($result === false) {
+        fprintf($out, "%-5d %-9s %6g %7d %-6s %-9s %-6s failed\n", $case['size'], $case['view'],
+                $case['zoom'], $case['iterations'], $case['device'], $case['mode'], $case['output']);
+        continue;
+    }
+    if ($result['backend'] == 'cache') {
+        fwrite(STDERR, "renders come from the shared cache; set clmandelbrot.shm_cache_size=0\n");
+        exit(2);
+    }
+    fprintf($out, "%-5d %-9s %6g %7d %-6s %-9s %-6s %-8s %10.3f %10.3f %12.1f\n",
+            $result['size'], $result['view'], $result['zoom'], $result['iterations'],
+            $result['device'], $result['mode'], $result['output'], $result['backend'],
+            $result['time']['median'] * 1e3, $result['time']['p95'] * 1e3,
+            $result['mpixel_iter_per_s']);
+    $results[] = $result;
+}
+
+$report = array(
+    'environment' => clm_bench_environment(),
+    'config'      => $config,
+    'results'     => $results,
+);
+if ($json === '-') {
+    echo json_encode($report), "\n";
+} elseif ($json !== null) {
+    file_put_contents($json, json_encode($report) . "\n");
+}
+
+if (isset($opts['baseline'])) {
+    $baseline = json_decode(file_get_contents($opts['baseline']), true);
+    $threshold = isset($opts['threshold']) ? (float)$opts['threshold'] : 10.0;
+    if (!is_array($baseline) || !isset($baseline['results'])) {
+        fwrite(STDERR, "cannot read the baseline {$opts['baseline']}\n");
+        exit(2);
+    }
+    $regressions = clm_bench_regressions($results, $baseline, $threshold);
+    foreach ($regressions as $id => $change) {
+        fprintf(STDERR, "regression: %s is %.1f%% slower\n", $id, $change);
+    }
+    if ($regressions) {
+        exit(1);
+    }
+}
@@ -0,0 +1,350 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ext/standard/md5.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* format of the lines of a device profile; lines of other versions are
+   ignored */
+#define CLM_TUNE_VERSION 1
+/* probe launches per candidate, of which the fastest counts */
+#define CLM_TUNE_RUNS 2
+
+/* candidate work group shapes, 64 to 256 work items */
+static const size_t clm_tune_shapes[][2] = {
+	{ 64, 1 }, { 32, 2 }, { 16, 4 }, { 8, 8 },
+	{ 128, 1 }, { 32, 4 }, { 16, 8 }, { 8, 16 },
+	{ 256, 1 }, { 32, 8 }, { 16, 16 }
+};
+
+/* {{{ function prototypes */
+
+static int clm_tune_path(char *path, size_t size, cl_device_id device TSRMLS_DC);
+static void clm_tune_key(const clm_variant_t *variant, char *key);
+static void clm_tune_default(clm_tuning_t *tuning, size_t max_group, int dims);
+static void clm_tune_save(const clm_variant_t *variant, const clm_tuning_t *tuning,
+                          cl_device_id device TSRMLS_DC);
+static double clm_tune_probe(clmandelbrot_t *probe, cl_mem buffer,
+                             const clm_tuning_t *tuning TSRMLS_DC);
+
+/* }}} */
+
+/* {{{ clm_tune_dims()
+   only MandelbrotRGB, its vector form and MandelbrotAdaptiveRGB run on a
+   2D range; the other kernels are 1D */
+int clm_tune_dims(const clm_variant_t *variant)
+{
+	return (strcmp(variant->kernelName, "MandelbrotRGB") == 0
+	        || strcmp(variant->kernelName, "MandelbrotRGBVec") == 0
+	        || strcmp(variant->kernelName, "MandelbrotAdaptiveRGB") == 0) ? 2 : 1;
+}
+/* }}} */
+
+/* {{{ clm_tune_load()
+   sets the launch shape of a freshly built kernel: the one stored in the
+   profile of the device if there is one, a default shape otherwise */
+void clm_tune_load(clm_variant_t *variant, cl_uint index, cl_device_id device TSRMLS_DC)
+{
+	clm_tuning_t *tuning = &variant->tuning[index];
+	size_t max_group = variant->workGroupSize[index];
+	char path[MAXPATHLEN], key[33], line[128];
+	FILE *fp;
+
+	clm_tune_default(tuning, max_group, clm_tune_dims(variant));
+	if (clm_tune_dims(variant) != 2
+		|| clm_tune_path(path, sizeof(path), device TSRMLS_CC) == FAILURE
+		|| (fp = fopen(path, "r")) == NULL
+	) {
+		return;
+	}
+
+	/* the profile is only ever appended to, so the last line wins */
+	clm_tune_key(variant, key);
+	while (fgets(line, sizeof(line), fp)) {
+		char entry[33];
+		unsigned long lx, ly;
+		int version, pixels;
+		double time;
+
+		if (sscanf(line, "%d %32s %lu %lu %d %lf",
+		           &version, entry, &lx, &ly, &pixels, &time) == 6
+			&& version == CLM_TUNE_VERSION && strcmp(entry, key) == 0
+			&& lx > 0 && ly > 0 && lx * ly <= max_group
+			&& pixels > 0 && pixels <= CLM_TUNE_MAX_PIXELS
+		) {
+			tuning->local[0] = lx;
+			tuning->local[1] = ly;
+			tuning->pixels = pixels;
+			tuning->time = time;
+			tuning->tuned = 1;
+		}
+	}
+	fclose(fp);
+}
+/* }}} */
+
+/* {{{ clm_autotune()
+   times every candidate shape and number of pixels per work item with a
+   small render of the same view in the variant of ctx, keeps the fastest
+   for the device and adds it to the profile of the device */
+int clm_autotune(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_variant_t *variant = ctx->variant;
+	size_t max_group = variant->workGroupSize[0];
+	size_t sizes[3] = { 0, 0, 0 };
+	clm_tuning_t best, candidate;
+	clmandelbrot_t probe;
+	cl_mem buffer;
+	int side = CLM_TUNE_PROBE_SIZE;
+	int result = FAILURE;
+	size_t i;
+
+	if (clm_tune_dims(variant) != 2) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "only the direct kernel can be tuned");
+		return FAILURE;
+	}
+	if (clGetDeviceInfo(ctx->device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+	                    sizeof(sizes), sizes, NULL) != CL_SUCCESS) {
+		sizes[0] = sizes[1] = max_group;
+	}
+
+	/* the probe covers the view of ctx at a lower resolution */
+	while (side > CLM_TUNE_MIN_PROBE && (double)side * side * ctx->iterations > CLM_TUNE_BUDGET) {
+		side /= 2;
+	}
+	probe = *ctx;
+	probe.width = MIN(ctx->width, side);
+	probe.height = MIN(ctx->height, side);
+	probe.unit = ctx->unit * MAX((double)ctx->width / probe.width,
+	                             (double)ctx->height / probe.height);
+
+	buffer = clCreateBuffer(ctx->dev->context, CL_MEM_WRITE_ONLY,
+	                        sizeof(cl_int) * probe.width * probe.height, NULL, NULL);
+	if (!buffer) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		return FAILURE;
+	}
+
+	/* the first launch also pays for lazy initialization in the runtime */
+	clm_tune_default(&best, max_group, 2);
+	if (clm_tune_probe(&probe, buffer, &best TSRMLS_CC) < 0.0
+		|| (best.time = clm_tune_probe(&probe, buffer, &best TSRMLS_CC)) < 0.0
+	) {
+		goto cleanup;
+	}
+
+	for (i = 0; i < sizeof(clm_tune_shapes) / sizeof(clm_tune_shapes[0]); i++) {
+		size_t lx = clm_tune_shapes[i][0], ly = clm_tune_shapes[i][1];
+
+		if (lx * ly > max_group || lx > sizes[0] || ly > sizes[1]) {
+			continue;
+		}
+		memset(&candidate, 0, sizeof(candidate));
+		candidate.local[0] = lx;
+		candidate.local[1] = ly;
+		for (candidate.pixels = 1; candidate.pixels <= CLM_TUNE_MAX_PIXELS; candidate.pixels *= 2) {
+			int run;
+
+			candidate.time = -1.0;
+			for (run = 0; run < CLM_TUNE_RUNS; run++) {
+				double time = clm_tune_probe(&probe, buffer, &candidate TSRMLS_CC);
+				if (time < 0.0) {
+					goto cleanup;
+				}
+				if (candidate.time < 0.0 || time < candidate.time) {
+					candidate.time = time;
+				}
+			}
+			if (candidate.time < best.time) {
+				best = candidate;
+			}
+		}
+	}
+
+	best.tuned = 1;
+	variant->tuning[0] = best;
+	clm_tune_save(variant, &best, ctx->device TSRMLS_CC);
+	result = SUCCESS;
+
+cleanup:
+	clReleaseMemObject(buffer);
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_tune_default()
+   the whole work group for 1D kernels; for 2D ones, a square of up to
+   16 x 16 work items, which keeps neighbouring pixels, whose iteration
+   counts are alike, in the same group */
+static void clm_tune_default(clm_tuning_t *tuning, size_t max_group, int dims)
+{
+	memset(tuning, 0, sizeof(clm_tuning_t));
+	tuning->pixels = 1;
+	if (dims == 1) {
+		tuning->local[0] = max_group;
+		tuning->local[1] = 1;
+		return;
+	}
+	tuning->local[0] = MIN(16, max_group);
+	tuning->local[1] = MIN(16, max_group / tuning->local[0]);
+}
+/* }}} */
+
+/* {{{ clm_tune_probe()
+   returns the kernel time of one probe render from the event timestamps,
+   or from the host clock without them; negative on failure */
+static double clm_tune_probe(clmandelbrot_t *probe, cl_mem buffer,
+                             const clm_tuning_t *tuning TSRMLS_DC)
+{
+	cl_event event = NULL;
+	cl_ulong begin = 0, end = 0;
+	double start = clm_now(), time;
+
+	if (clm_enqueue_rows(probe, probe->dev->queue, probe->variant->kernels[0], tuning, buffer,
+	                     0, probe->height, 0, NULL, &event TSRMLS_CC) == FAILURE) {
+		return -1.0;
+	}
+	if (clWaitForEvents(1, &event) != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot run the probe render");
+		clReleaseEvent(event);
+		return -1.0;
+	}
+	time = clm_now() - start;
+
+	if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+	                            sizeof(begin), &begin, NULL) == CL_SUCCESS
+		&& clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+		                           sizeof(end), &end, NULL) == CL_SUCCESS
+		&& end > begin
+	) {
+		time = (double)(end - begin) / 1e9;
+	}
+	clReleaseEvent(event);
+
+	return time;
+}
+/* }}} */
+
+/* {{{ clm_tune_path()
+   builds "<cache_dir>/<md5>.tune" where md5 covers the device name and the
+   driver version; without a cache directory, tuning is not persisted */
+static int clm_tune_path(char *path, size_t size, cl_device_id device TSRMLS_DC)
+{
+	const char *dir = CLMANDELBROT_G(cacheDir);
+	PHP_MD5_CTX md5;
+	unsigned char digest[16];
+	char md5str[33];
+	char buf[1024];
+	size_t len = 0;
+
+	if (!dir || !*dir) {
+		return FAILURE;
+	}
+
+	PHP_MD5Init(&md5);
+	if (clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(buf), buf, &len) != CL_SUCCESS) {
+		return FAILURE;
+	}
+	PHP_MD5Update(&md5, (const unsigned char *)buf, len);
+	if (clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(buf), buf, &len) != CL_SUCCESS) {
+		return FAILURE;
+	}
+	PHP_MD5Update(&md5, (const unsigned char *)buf, len);
+	PHP_MD5Final(digest, &md5);
+	make_digest(md5str, digest);
+
+	if ((size_t)snprintf(path, size, "%s/%s.tune", dir, md5str) >= size) {
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_tune_key()
+   names the variant in the profile: md5 of the kernel and build options */
+static void clm_tune_key(const clm_variant_t *variant, char *key)
+{
+	PHP_MD5_CTX md5;
+	unsigned char digest[16];
+
+	PHP_MD5Init(&md5);
+	PHP_MD5Update(&md5, (const unsigned char *)variant->kernelName,
+	              strlen(variant->kernelName) + 1);
+	PHP_MD5Update(&md5, (const unsigned char *)variant->options, strlen(variant->options));
+	PHP_MD5Final(digest, &md5);
+	make_digest(key, digest);
+}
+/* }}} */
+
+/* {{{ clm_tune_save()
+   appends one line in a single write, which concurrent workers cannot
+   interleave */
+static void clm_tune_save(const clm_variant_t *variant, const clm_tuning_t *tuning,
+                          cl_device_id device TSRMLS_DC)
+{
+	char path[MAXPATHLEN], key[33], line[128];
+	int fd, len;
+
+	if (clm_tune_path(path, sizeof(path), device TSRMLS_CC) == FAILURE) {
+		return;
+	}
+
+	clm_tune_key(variant, key);
+	len = snprintf(line, sizeof(line), "%d %s %lu %lu %d %.9f\n", CLM_TUNE_VERSION, key,
+	               (unsigned long)tuning->local[0], (unsigned long)tuning->local[1],
+	               tuning->pixels, tuning->time);
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd == -1) {
+		return;
+	}
+	if (write(fd, line, len) != len) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "cannot write the tuning profile %s", path);
+	}
+	close(fd);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,252 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ext/standard/md5.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CLM_BINARY_MAGIC "CLMB"
+#define CLM_BINARY_VERSION 1
+
+/* {{{ type definitions */
+
+typedef struct {
+	char magic[4];
+	unsigned int version;
+	unsigned int length;
+} clm_binary_header_t;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static int clm_binary_path(char *path, size_t size, cl_device_id device,
+                           const char *source, const char *options TSRMLS_DC);
+
+/* }}} */
+
+/* {{{ clm_binary_path()
+   builds "<cache_dir>/<md5>.clbin" where md5 covers the kernel source, the
+   build options, the device name and the driver version */
+static int clm_binary_path(char *path, size_t size, cl_device_id device,
+                           const char *source, const char *options TSRMLS_DC)
+{
+	const char *dir = CLMANDELBROT_G(cacheDir);
+	PHP_MD5_CTX md5;
+	unsigned char digest[16];
+	char md5str[33];
+	char buf[1024];
+	size_t len = 0;
+
+	if (!dir || !*dir) {
+		return FAILURE;
+	}
+
+	PHP_MD5Init(&md5);
+	PHP_MD5Update(&md5, (const unsigned char *)source, strlen(source) + 1);
+	if (options) {
+		PHP_MD5Update(&md5, (const unsigned char *)options, strlen(options));
+	}
+	PHP_MD5Update(&md5, (const unsigned char *)"", 1);
+
+	if (clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(buf), buf, &len) != CL_SUCCESS) {
+		return FAILURE;
+	}
+	PHP_MD5Update(&md5, (const unsigned char *)buf, len);
+
+	if (clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(buf), buf, &len) != CL_SUCCESS) {
+		return FAILURE;
+	}
+	PHP_MD5Update(&md5, (const unsigned char *)buf, len);
+
+	PHP_MD5Final(digest, &md5);
+	make_digest(md5str, digest);
+
+	if ((size_t)snprintf(path, size, "%s/%s.clbin", dir, md5str) >= size) {
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_load_program_binary()
+   returns a built program from the on-disk cache, or NULL on any miss */
+cl_program clm_load_program_binary(cl_context context, cl_device_id device,
+                                   const char *source, const char *options TSRMLS_DC)
+{
+	char path[MAXPATHLEN];
+	clm_binary_header_t header;
+	unsigned char *binary = NULL;
+	cl_program program = NULL;
+	cl_int err = CL_SUCCESS, status = CL_SUCCESS;
+	size_t len = 0;
+	struct stat st;
+	int fd;
+
+	if (clm_binary_path(path, sizeof(path), device, source, options TSRMLS_CC) == FAILURE) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	/* the length must match the file, so that a corrupt entry cannot
+	   request an arbitrary allocation */
+	if (fstat(fd, &st) != 0
+		|| st.st_size < (off_t)sizeof(header)
+		|| read(fd, &header, sizeof(header)) != sizeof(header)
+		|| memcmp(header.magic, CLM_BINARY_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != CLM_BINARY_VERSION
+		|| header.length == 0
+		|| (off_t)header.length != st.st_size - (off_t)sizeof(header)
+	) {
+		close(fd);
+		return NULL;
+	}
+
+	len = header.length;
+	binary = emalloc(len);
+	if (read(fd, binary, len) != (ssize_t)len) {
+		efree(binary);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	program = clCreateProgramWithBinary(context, 1, &device, &len,
+	                                    (const unsigned char **)&binary, &status, &err);
+	efree(binary);
+	if (!program || err != CL_SUCCESS || status != CL_SUCCESS) {
+		if (program) {
+			clReleaseProgram(program);
+		}
+		return NULL;
+	}
+
+	/* a binary still has to be "built", but this only links it */
+	err = clBuildProgram(program, 1, &device, options, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		clReleaseProgram(program);
+		return NULL;
+	}
+
+	CLMANDELBROT_G(binaryHits)++;
+	return program;
+}
+/* }}} */
+
+/* {{{ clm_save_program_binary()
+   writes to a temporary file and renames it into place, so that concurrent
+   workers never see a partially written entry */
+int clm_save_program_binary(cl_program program, cl_device_id device,
+                            const char *source, const char *options TSRMLS_DC)
+{
+	char path[MAXPATHLEN], tmp[MAXPATHLEN];
+	clm_binary_header_t header;
+	unsigned char *binary = NULL;
+	size_t len = 0;
+	cl_uint num_devices = 0;
+	cl_int err = CL_SUCCESS;
+	int fd, ok;
+
+	if (clm_binary_path(path, sizeof(path), device, source, options TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+
+	/* the program is always created for exactly one device */
+	err = clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES,
+	                       sizeof(num_devices), &num_devices, NULL);
+	if (err != CL_SUCCESS || num_devices != 1) {
+		return FAILURE;
+	}
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(len), &len, NULL);
+	if (err != CL_SUCCESS || len == 0 || (size_t)(unsigned int)len != len) {
+		return FAILURE;
+	}
+
+	binary = emalloc(len);
+	err = clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL);
+	if (err != CL_SUCCESS) {
+		efree(binary);
+		return FAILURE;
+	}
+
+	/* a unique name per attempt, so neither a file left by a crash nor
+	   another thread of the same process can block the save */
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) {
+		efree(binary);
+		return FAILURE;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		php_error_docref(NULL TSRMLS_CC, E_NOTICE, "cannot write program binary to %s", path);
+		efree(binary);
+		return FAILURE;
+	}
+	fchmod(fd, 0644);
+
+	memcpy(header.magic, CLM_BINARY_MAGIC, sizeof(header.magic));
+	header.version = CLM_BINARY_VERSION;
+	header.length = (unsigned int)len;
+
+	ok = (write(fd, &header, sizeof(header)) == sizeof(header)
+	      && write(fd, binary, len) == (ssize_t)len);
+	ok = (close(fd) == 0) && ok;
+	efree(binary);
+
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return FAILURE;
+	}
+
+	CLMANDELBROT_G(binaryWrites)++;
+	return SUCCESS;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,988 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/* the CPU renderer has to produce the same pixels as the Mandelbrot kernel,
+   so multiplies and adds must not be fused */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#else
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+	&& (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define CLM_CPU_X86 1
+#include <immintrin.h>
+#define CLM_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* number of rows a thread takes from the job at once */
+#define CLM_CPU_BAND 4
+
+/* first interval of the periodicity check; it doubles after every check */
+#define CLM_CPU_PERIOD 16
+
+/* {{{ type definitions */
+
+typedef struct _clm_cpu_job clm_cpu_job_t;
+
+typedef void (*clm_cpu_row_func_t)(const clm_cpu_job_t *job, int oy);
+
+struct _clm_cpu_job {
+	const clmandelbrot_t *ctx;
+	clm_cpu_row_func_t   row;
+	int                  iterations;
+	float                bailout;
+	float                unit;
+	float                centerX;
+	float                centerY;
+	int                  interiorCheck;
+	int                  periodicity;
+	int                  samples;
+	const int            *shades;  /* plain colours for adaptive antialiasing */
+	volatile int         nextRow;
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  wake;
+	pthread_cond_t  done;
+	pthread_t       *threads;
+	int             numThreads;
+	pid_t           pid;
+	unsigned long   generation;
+	int             pending;
+	int             shutdown;
+	clm_cpu_job_t   *job;
+} clm_cpu_pool_t;
+
+/* }}} */
+
+/* {{{ globals */
+
+static clm_cpu_pool_t clm_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                                   PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0, 0, NULL };
+static pthread_mutex_t clm_pool_submit = PTHREAD_MUTEX_INITIALIZER;
+
+static clm_cpu_row_func_t clm_cpu_row = NULL;
+static const char *clm_cpu_isa_name = NULL;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static void clm_cpu_select(void);
+static void clm_cpu_pool_start(int numThreads);
+static void *clm_cpu_worker(void *arg);
+static void clm_cpu_work(clm_cpu_job_t *job);
+static void clm_cpu_run(clm_cpu_job_t *job, long threads);
+
+static inline int clm_cpu_interior(float fx, float fy);
+static inline int clm_cpu_interior_double(double fx, double fy);
+static inline int clm_cpu_escape(const clm_cpu_job_t *job, float fx, float fy, float *mag);
+static inline int clm_cpu_escape_double(const clm_cpu_job_t *job, double fx, double fy, double *mag);
+static inline unsigned char clm_cpu_shade(int n, int m);
+static inline int clm_cpu_color(const clm_cpu_job_t *job, int n, double mag);
+static inline void clm_cpu_put(unsigned char *out8, int *out32, int ox, unsigned char c);
+static int clm_cpu_sample(const clm_cpu_job_t *job, int ox, int oy);
+static void clm_cpu_row_scalar(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_double(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_perturb(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_sample(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_refine(const clm_cpu_job_t *job, int oy);
+#ifdef CLM_CPU_X86
+static void clm_cpu_row_sse2(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_avx2(const clm_cpu_job_t *job, int oy);
+static void clm_cpu_row_avx512(const clm_cpu_job_t *job, int oy);
+#endif
+
+/* }}} */
+
+/* {{{ clm_cpu_render() */
+int clm_cpu_render(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_cpu_job_t job;
+	long threads = CLMANDELBROT_G(cpuThreads);
+
+	if (!clm_cpu_row) {
+		clm_cpu_select();
+	}
+
+	job.ctx = ctx;
+	job.iterations = ctx->iterations;
+	job.bailout = ctx->bailout;
+	job.unit = (float)ctx->unit;
+	job.centerX = (float)ctx->centerX;
+	job.centerY = (float)ctx->centerY;
+	job.interiorCheck = ctx->interiorCheck;
+	job.periodicity = ctx->periodicity;
+	job.samples = (ctx->precision == CLM_PRECISION_PERTURB) ? 1 : MAX(ctx->samples, 1);
+	job.shades = NULL;
+
+	/* only gray single precision is vectorized */
+	switch (ctx->precision) {
+		case CLM_PRECISION_DOUBLE:
+			job.row = clm_cpu_row_double;
+			break;
+		case CLM_PRECISION_PERTURB:
+			job.row = clm_cpu_row_perturb;
+			break;
+		default:
+			job.row = (ctx->palette.count || ctx->equalize) ? clm_cpu_row_scalar : clm_cpu_row;
+			break;
+	}
+
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if (job.samples > 1 && ctx->adaptive) {
+		/* MandelbrotAdaptiveRGB in two passes: the plain colours of the whole
+		   image, then the pixels next to another colour are resampled */
+		clmandelbrot_t plain = *ctx;
+		int *shades = safe_emalloc(ctx->width, ctx->height * sizeof(int), 0);
+		int **rows = safe_emalloc(ctx->height, sizeof(int *), 0);
+		int y;
+
+		for (y = 0; y < ctx->height; y++) {
+			rows[y] = shades + (size_t)y * ctx->width;
+		}
+		plain.pixels = rows;
+		job.ctx = &plain;
+		clm_cpu_run(&job, threads);
+
+		job.ctx = ctx;
+		job.row = clm_cpu_row_refine;
+		job.shades = shades;
+		clm_cpu_run(&job, threads);
+		efree(rows);
+		efree(shades);
+		return SUCCESS;
+	}
+	if (job.samples > 1) {
+		job.row = clm_cpu_row_sample;
+	}
+
+	clm_cpu_run(&job, threads);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_cpu_run()
+   works through the rows of a job on the pool and the calling thread */
+static void clm_cpu_run(clm_cpu_job_t *job, long threads)
+{
+	job->nextRow = 0;
+
+	pthread_mutex_lock(&clm_pool_submit);
+
+	/* the calling thread works too, so the pool needs one thread less */
+	if (clm_pool.pid != getpid() || clm_pool.numThreads != threads - 1) {
+		clm_cpu_shutdown();
+		clm_cpu_pool_start((int)threads - 1);
+	}
+
+	if (clm_pool.numThreads > 0) {
+		pthread_mutex_lock(&clm_pool.lock);
+		clm_pool.job = job;
+		clm_pool.pending = clm_pool.numThreads;
+		clm_pool.generation++;
+		pthread_cond_broadcast(&clm_pool.wake);
+		pthread_mutex_unlock(&clm_pool.lock);
+	}
+
+	clm_cpu_work(job);
+
+	if (clm_pool.numThreads > 0) {
+		pthread_mutex_lock(&clm_pool.lock);
+		while (clm_pool.pending > 0) {
+			pthread_cond_wait(&clm_pool.done, &clm_pool.lock);
+		}
+		clm_pool.job = NULL;
+		pthread_mutex_unlock(&clm_pool.lock);
+	}
+
+	pthread_mutex_unlock(&clm_pool_submit);
+}
+/* }}} */
+
+/* {{{ clm_cpu_isa() */
+const char *clm_cpu_isa(void)
+{
+	if (!clm_cpu_row) {
+		clm_cpu_select();
+	}
+	return clm_cpu_isa_name;
+}
+/* }}} */
+
+/* {{{ clm_cpu_shutdown()
+   joins the pool threads; threads inherited through fork() are gone, so
+   in a child process the pool is only forgotten */
+void clm_cpu_shutdown(void)
+{
+	int i;
+
+	if (clm_pool.pid == getpid() && clm_pool.numThreads > 0) {
+		pthread_mutex_lock(&clm_pool.lock);
+		clm_pool.shutdown = 1;
+		pthread_cond_broadcast(&clm_pool.wake);
+		pthread_mutex_unlock(&clm_pool.lock);
+
+		for (i = 0; i < clm_pool.numThreads; i++) {
+			pthread_join(clm_pool.threads[i], NULL);
+		}
+	}
+
+	if (clm_pool.threads) {
+		free(clm_pool.threads);
+	}
+	clm_pool.threads = NULL;
+	clm_pool.numThreads = 0;
+	clm_pool.pid = 0;
+	clm_pool.shutdown = 0;
+}
+/* }}} */
+
+/* {{{ clm_cpu_select() */
+static void clm_cpu_select(void)
+{
+#ifdef CLM_CPU_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		clm_cpu_isa_name = "avx512f";
+		clm_cpu_row = clm_cpu_row_avx512;
+		return;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		clm_cpu_isa_name = "avx2";
+		clm_cpu_row = clm_cpu_row_avx2;
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		clm_cpu_isa_name = "sse2";
+		clm_cpu_row = clm_cpu_row_sse2;
+		return;
+	}
+#endif
+	clm_cpu_isa_name = "scalar";
+	clm_cpu_row = clm_cpu_row_scalar;
+}
+/* }}} */
+
+/* {{{ clm_cpu_pool_start() */
+static void clm_cpu_pool_start(int numThreads)
+{
+	int i;
+
+	pthread_mutex_init(&clm_pool.lock, NULL);
+	pthread_cond_init(&clm_pool.wake, NULL);
+	pthread_cond_init(&clm_pool.done, NULL);
+	clm_pool.pid = getpid();
+	clm_pool.generation = 0;
+	clm_pool.pending = 0;
+	clm_pool.shutdown = 0;
+	clm_pool.job = NULL;
+	clm_pool.numThreads = 0;
+
+	if (numThreads <= 0) {
+		return;
+	}
+
+	clm_pool.threads = calloc(numThreads, sizeof(pthread_t));
+	if (!clm_pool.threads) {
+		return;
+	}
+	for (i = 0; i < numThreads; i++) {
+		if (pthread_create(&clm_pool.threads[i], NULL, clm_cpu_worker, NULL) != 0) {
+			break;
+		}
+		clm_pool.numThreads++;
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_worker() */
+static void *clm_cpu_worker(void *arg)
+{
+	/* every worker is started before the first job is posted */
+	unsigned long seen = 0;
+	clm_cpu_job_t *job;
+
+	pthread_mutex_lock(&clm_pool.lock);
+	for (;;) {
+		while (!clm_pool.shutdown && clm_pool.generation == seen) {
+			pthread_cond_wait(&clm_pool.wake, &clm_pool.lock);
+		}
+		if (clm_pool.shutdown) {
+			break;
+		}
+		seen = clm_pool.generation;
+		job = clm_pool.job;
+		pthread_mutex_unlock(&clm_pool.lock);
+
+		clm_cpu_work(job);
+
+		pthread_mutex_lock(&clm_pool.lock);
+		if (--clm_pool.pending == 0) {
+			pthread_cond_signal(&clm_pool.done);
+		}
+	}
+	pthread_mutex_unlock(&clm_pool.lock);
+
+	return NULL;
+}
+/* }}} */
+
+/* {{{ clm_cpu_work()
+   rows are handed out in small bands, so threads that draw cheap exterior
+   regions keep taking work from the expensive ones */
+static void clm_cpu_work(clm_cpu_job_t *job)
+{
+	int height = job->ctx->height;
+	int y, end;
+
+	while ((y = __sync_fetch_and_add(&job->nextRow, CLM_CPU_BAND)) < height) {
+		end = y + CLM_CPU_BAND;
+		if (end > height) {
+			end = height;
+		}
+		for (; y < end; y++) {
+			job->row(job, y);
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_interior()
+   the main cardioid and period-2 bulb test of the kernel */
+static inline int clm_cpu_interior(float fx, float fy)
+{
+	float xq = fx - 0.25f;
+	float q = xq * xq + fy * fy;
+	float xb = fx + 1;
+
+	return (q * (q + xq) <= 0.25f * fy * fy) || (xb * xb + fy * fy <= 0.0625f);
+}
+/* }}} */
+
+/* {{{ clm_cpu_interior_double() */
+static inline int clm_cpu_interior_double(double fx, double fy)
+{
+	double xq = fx - 0.25;
+	double q = xq * xq + fy * fy;
+	double xb = fx + 1;
+
+	return (q * (q + xq) <= 0.25 * fy * fy) || (xb * xb + fy * fy <= 0.0625);
+}
+/* }}} */
+
+/* {{{ clm_cpu_escape()
+   the loop body of the Mandelbrot kernel, operation for operation */
+static inline int clm_cpu_escape(const clm_cpu_job_t *job, float fx, float fy, float *mag)
+{
+	const int m = job->iterations;
+	float r = fx;
+	float i = fy;
+	float sr = r, si = i;
+	int step = 0, period = CLM_CPU_PERIOD;
+	int n;
+
+	*mag = 0;
+	if (job->interiorCheck && clm_cpu_interior(fx, fy)) {
+		return m;
+	}
+
+	for (n = 0; n < m; n++) {
+		float rr = r * r;
+		float ii = i * i;
+		float ri = r * i;
+		r = fx + rr - ii;
+		i = fy + 2 * ri;
+		if (rr + ii > job->bailout) { *mag = rr + ii; break; }
+		if (job->periodicity) {
+			if (r == sr && i == si) { return m; }
+			if (++step == period) {
+				step = 0;
+				period *= 2;
+				sr = r;
+				si = i;
+			}
+		}
+	}
+	return n;
+}
+/* }}} */
+
+/* {{{ clm_cpu_escape_double() */
+static inline int clm_cpu_escape_double(const clm_cpu_job_t *job, double fx, double fy, double *mag)
+{
+	const int m = job->iterations;
+	double r = fx;
+	double i = fy;
+	double sr = r, si = i;
+	int step = 0, period = CLM_CPU_PERIOD;
+	int n;
+
+	*mag = 0;
+	if (job->interiorCheck && clm_cpu_interior_double(fx, fy)) {
+		return m;
+	}
+
+	for (n = 0; n < m; n++) {
+		double rr = r * r;
+		double ii = i * i;
+		double ri = r * i;
+		r = fx + rr - ii;
+		i = fy + 2 * ri;
+		if (rr + ii > job->bailout) { *mag = rr + ii; break; }
+		if (job->periodicity) {
+			if (r == sr && i == si) { return m; }
+			if (++step == period) {
+				step = 0;
+				period *= 2;
+				sr = r;
+				si = i;
+			}
+		}
+	}
+	return n;
+}
+/* }}} */
+
+/* {{{ clm_cpu_shade() */
+static inline unsigned char clm_cpu_shade(int n, int m)
+{
+	float fval = (float)n / (float)m;
+	int ival = 256 * fval;
+	if (ival < 0) { ival = 0; }
+	if (ival > 255) { ival = 255; }
+	return (unsigned char)ival;
+}
+/* }}} */
+
+/* {{{ clm_cpu_color()
+   MandelbrotRGBOf: the packed gray shade or palette colour, or the escape
+   count itself for clm_equalize_pixels() */
+static inline int clm_cpu_color(const clm_cpu_job_t *job, int n, double mag)
+{
+	unsigned char c;
+
+	if (job->ctx->equalize) {
+		return n;
+	}
+	if (job->ctx->palette.count) {
+		return clm_palette_color(&job->ctx->palette, n, job->iterations, mag);
+	}
+	c = clm_cpu_shade(n, job->iterations);
+	return (c << 16) | (c << 8) | c;
+}
+/* }}} */
+
+/* {{{ clm_cpu_put()
+   stores a pixel either as 8-bit gray or as a gd truecolor value */
+static inline void clm_cpu_put(unsigned char *out8, int *out32, int ox, unsigned char c)
+{
+	if (out32) {
+		out32[ox] = (c << 16) | (c << 8) | c;
+	} else {
+		out8[ox] = c;
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_sample()
+   MandelbrotSupersampleRGB: the rounded mean colour, channel by channel, of
+   samples squared points spread evenly over the pixel */
+static int clm_cpu_sample(const clm_cpu_job_t *job, int ox, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, s = job->samples, count = s * s;
+	const int iy = h - 1 - oy;
+	int sx, sy, c, r = 0, g = 0, b = 0;
+
+	if (ctx->precision == CLM_PRECISION_DOUBLE) {
+		const double step = 1.0 / (2 * s);
+
+		for (sy = 0; sy < s; sy++) {
+			double fy = ((double)(iy - h / 2) + (double)(2 * sy + 1 - s) * step) * ctx->unit + ctx->centerY;
+			for (sx = 0; sx < s; sx++) {
+				double fx = ((double)(ox - w / 2) + (double)(2 * sx + 1 - s) * step) * ctx->unit + ctx->centerX;
+				double mag;
+				c = clm_cpu_escape_double(job, fx, fy, &mag);
+				c = clm_cpu_color(job, c, mag);
+				r += (c >> 16) & 0xff;
+				g += (c >> 8) & 0xff;
+				b += c & 0xff;
+			}
+		}
+	} else {
+		const float step = 1.0f / (2 * s);
+
+		for (sy = 0; sy < s; sy++) {
+			float fy = ((float)(iy - h / 2) + (float)(2 * sy + 1 - s) * step) * job->unit + job->centerY;
+			for (sx = 0; sx < s; sx++) {
+				float fx = ((float)(ox - w / 2) + (float)(2 * sx + 1 - s) * step) * job->unit + job->centerX;
+				float mag;
+				c = clm_cpu_escape(job, fx, fy, &mag);
+				c = clm_cpu_color(job, c, mag);
+				r += (c >> 16) & 0xff;
+				g += (c >> 8) & 0xff;
+				b += c & 0xff;
+			}
+		}
+	}
+	r = (r + count / 2) / count;
+	g = (g + count / 2) / count;
+	b = (b + count / 2) / count;
+	return (r << 16) | (g << 8) | b;
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_scalar() */
+static void clm_cpu_row_scalar(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const float fy = (float)(iy - h / 2) * job->unit + job->centerY;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	int ox;
+
+	for (ox = 0; ox < w; ox++) {
+		float fx = (float)(ox - w / 2) * job->unit + job->centerX;
+		float mag;
+		int n = clm_cpu_escape(job, fx, fy, &mag);
+		if (ctx->palette.count || ctx->equalize) {
+			out32[ox] = clm_cpu_color(job, n, mag);
+		} else {
+			clm_cpu_put(out8, out32, ox, clm_cpu_shade(n, m));
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_double() */
+static void clm_cpu_row_double(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const double fy = (double)(iy - h / 2) * ctx->unit + ctx->centerY;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	int ox;
+
+	for (ox = 0; ox < w; ox++) {
+		double fx = (double)(ox - w / 2) * ctx->unit + ctx->centerX;
+		double mag;
+		int n = clm_cpu_escape_double(job, fx, fy, &mag);
+		if (ctx->palette.count || ctx->equalize) {
+			out32[ox] = clm_cpu_color(job, n, mag);
+		} else {
+			clm_cpu_put(out8, out32, ox, clm_cpu_shade(n, m));
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_perturb()
+   the MandelbrotPerturbRGB kernel in double precision */
+static void clm_cpu_row_perturb(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const clm_perturb_t *perturb = &ctx->perturb;
+	const double *orbit = perturb->orbit, *coeffs = perturb->coeffs;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const double dci = (double)(iy - h / 2) * ctx->unit;
+	const double ui = (double)(iy - h / 2) * perturb->scale;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	int ox, n, k;
+
+	for (ox = 0; ox < w; ox++) {
+		double dcr = (double)(ox - w / 2) * ctx->unit;
+		double ur = (double)(ox - w / 2) * perturb->scale;
+		double u2r = ur * ur - ui * ui;
+		double u2i = 2 * ur * ui;
+		double u3r = u2r * ur - u2i * ui;
+		double u3i = u2r * ui + u2i * ur;
+		double dr = coeffs[0] * ur - coeffs[1] * ui + coeffs[2] * u2r - coeffs[3] * u2i
+		          + coeffs[4] * u3r - coeffs[5] * u3i;
+		double di = coeffs[0] * ui + coeffs[1] * ur + coeffs[2] * u2i + coeffs[3] * u2r
+		          + coeffs[4] * u3i + coeffs[5] * u3r;
+
+		double mag = 0;
+
+		k = perturb->skip + 1;
+		for (n = perturb->skip; n < m; n++) {
+			double zr = orbit[2 * k] + dr;
+			double zi = orbit[2 * k + 1] + di;
+			double zz = zr * zr + zi * zi;
+			double tr, ti, nr;
+
+			if (zz > job->bailout) { mag = zz; break; }
+			if (k + 1 >= perturb->length || zz < dr * dr + di * di) {
+				dr = zr;
+				di = zi;
+				k = 0;
+			}
+			tr = 2 * orbit[2 * k] + dr;
+			ti = 2 * orbit[2 * k + 1] + di;
+			nr = tr * dr - ti * di + dcr;
+			di = tr * di + ti * dr + dci;
+			dr = nr;
+			k++;
+		}
+		if (ctx->palette.count || ctx->equalize) {
+			out32[ox] = clm_cpu_color(job, n, mag);
+		} else {
+			clm_cpu_put(out8, out32, ox, clm_cpu_shade(n, m));
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_sample() */
+static void clm_cpu_row_sample(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	int ox;
+
+	for (ox = 0; ox < w; ox++) {
+		int c = clm_cpu_sample(job, ox, oy);
+		if (out32) {
+			out32[ox] = c;
+		} else {
+			out8[ox] = (unsigned char)c;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_refine()
+   the second pass of adaptive antialiasing: pixels with a neighbour of
+   another plain colour are resampled, the others keep their colour */
+static void clm_cpu_row_refine(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height;
+	const int *row = job->shades + (size_t)oy * w;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	int ox;
+
+	for (ox = 0; ox < w; ox++) {
+		int c = row[ox];
+
+		if ((ox > 0 && row[ox - 1] != c) || (ox + 1 < w && row[ox + 1] != c)
+			|| (oy > 0 && row[ox - w] != c) || (oy + 1 < h && row[ox + w] != c)
+		) {
+			c = clm_cpu_sample(job, ox, oy);
+		}
+		if (out32) {
+			out32[ox] = c;
+		} else {
+			out8[ox] = (unsigned char)c;
+		}
+	}
+}
+/* }}} */
+
+#ifdef CLM_CPU_X86
+
+/* {{{ clm_cpu_row_sse2() */
+CLM_TARGET("sse2")
+static void clm_cpu_row_sse2(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const float fy = (float)(iy - h / 2) * job->unit + job->centerY;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	const __m128 unit = _mm_set1_ps(job->unit);
+	const __m128 cx = _mm_set1_ps(job->centerX);
+	const __m128 cy = _mm_set1_ps(fy);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 bailout = _mm_set1_ps(job->bailout);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	const __m128 sixteenth = _mm_set1_ps(0.0625f);
+	const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+	int counts[4];
+	int ox, n, k;
+
+	for (ox = 0; ox + 4 <= w; ox += 4) {
+		__m128i ix = _mm_add_epi32(_mm_set1_epi32(ox - w / 2), lane);
+		__m128 fx = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(ix), unit), cx);
+		__m128 r = fx;
+		__m128 i = cy;
+		__m128 sr = r, si = i;
+		__m128i count = _mm_set1_epi32(m);
+		__m128i live = _mm_set1_epi32(-1);
+		int step = 0, period = CLM_CPU_PERIOD;
+
+		if (job->interiorCheck) {
+			__m128 xq = _mm_sub_ps(fx, quarter);
+			__m128 q = _mm_add_ps(_mm_mul_ps(xq, xq), _mm_mul_ps(cy, cy));
+			__m128 xb = _mm_add_ps(fx, one);
+			__m128 cardioid = _mm_cmple_ps(_mm_mul_ps(q, _mm_add_ps(q, xq)),
+			                               _mm_mul_ps(_mm_mul_ps(quarter, cy), cy));
+			__m128 bulb = _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(xb, xb), _mm_mul_ps(cy, cy)), sixteenth);
+			live = _mm_andnot_si128(_mm_castps_si128(_mm_or_ps(cardioid, bulb)), live);
+		}
+
+		for (n = 0; n < m && _mm_movemask_epi8(live) != 0; n++) {
+			__m128 rr = _mm_mul_ps(r, r);
+			__m128 ii = _mm_mul_ps(i, i);
+			__m128 ri = _mm_mul_ps(r, i);
+			__m128i escaped = _mm_and_si128(live,
+				_mm_castps_si128(_mm_cmpgt_ps(_mm_add_ps(rr, ii), bailout)));
+			count = _mm_or_si128(_mm_andnot_si128(escaped, count),
+			                     _mm_and_si128(escaped, _mm_set1_epi32(n)));
+			live = _mm_andnot_si128(escaped, live);
+			if (_mm_movemask_epi8(live) == 0) {
+				break;
+			}
+			r = _mm_sub_ps(_mm_add_ps(fx, rr), ii);
+			i = _mm_add_ps(cy, _mm_mul_ps(two, ri));
+			if (job->periodicity) {
+				__m128 cycled = _mm_and_ps(_mm_cmpeq_ps(r, sr), _mm_cmpeq_ps(i, si));
+				live = _mm_andnot_si128(_mm_castps_si128(cycled), live);
+				if (++step == period) {
+					step = 0;
+					period *= 2;
+					sr = r;
+					si = i;
+				}
+			}
+		}
+
+		_mm_storeu_si128((__m128i *)counts, count);
+		for (k = 0; k < 4; k++) {
+			clm_cpu_put(out8, out32, ox + k, clm_cpu_shade(counts[k], m));
+		}
+	}
+
+	for (; ox < w; ox++) {
+		float fx = (float)(ox - w / 2) * job->unit + job->centerX;
+		float mag;
+		clm_cpu_put(out8, out32, ox, clm_cpu_shade(clm_cpu_escape(job, fx, fy, &mag), m));
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_avx2() */
+CLM_TARGET("avx2")
+static void clm_cpu_row_avx2(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const float fy = (float)(iy - h / 2) * job->unit + job->centerY;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	const __m256 unit = _mm256_set1_ps(job->unit);
+	const __m256 cx = _mm256_set1_ps(job->centerX);
+	const __m256 cy = _mm256_set1_ps(fy);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 bailout = _mm256_set1_ps(job->bailout);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	const __m256 sixteenth = _mm256_set1_ps(0.0625f);
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	int counts[8];
+	int ox, n, k;
+
+	for (ox = 0; ox + 8 <= w; ox += 8) {
+		__m256i ix = _mm256_add_epi32(_mm256_set1_epi32(ox - w / 2), lane);
+		__m256 fx = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(ix), unit), cx);
+		__m256 r = fx;
+		__m256 i = cy;
+		__m256 sr = r, si = i;
+		__m256i count = _mm256_set1_epi32(m);
+		__m256i live = _mm256_set1_epi32(-1);
+		int step = 0, period = CLM_CPU_PERIOD;
+
+		if (job->interiorCheck) {
+			__m256 xq = _mm256_sub_ps(fx, quarter);
+			__m256 q = _mm256_add_ps(_mm256_mul_ps(xq, xq), _mm256_mul_ps(cy, cy));
+			__m256 xb = _mm256_add_ps(fx, one);
+			__m256 cardioid = _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xq)),
+			                                _mm256_mul_ps(_mm256_mul_ps(quarter, cy), cy), _CMP_LE_OQ);
+			__m256 bulb = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(xb, xb), _mm256_mul_ps(cy, cy)),
+			                            sixteenth, _CMP_LE_OQ);
+			live = _mm256_andnot_si256(_mm256_castps_si256(_mm256_or_ps(cardioid, bulb)), live);
+		}
+
+		for (n = 0; n < m && !_mm256_testz_si256(live, live); n++) {
+			__m256 rr = _mm256_mul_ps(r, r);
+			__m256 ii = _mm256_mul_ps(i, i);
+			__m256 ri = _mm256_mul_ps(r, i);
+			__m256i escaped = _mm256_and_si256(live,
+				_mm256_castps_si256(_mm256_cmp_ps(_mm256_add_ps(rr, ii), bailout, _CMP_GT_OQ)));
+			count = _mm256_blendv_epi8(count, _mm256_set1_epi32(n), escaped);
+			live = _mm256_andnot_si256(escaped, live);
+			if (_mm256_testz_si256(live, live)) {
+				break;
+			}
+			r = _mm256_sub_ps(_mm256_add_ps(fx, rr), ii);
+			i = _mm256_add_ps(cy, _mm256_mul_ps(two, ri));
+			if (job->periodicity) {
+				__m256 cycled = _mm256_and_ps(_mm256_cmp_ps(r, sr, _CMP_EQ_OQ),
+				                              _mm256_cmp_ps(i, si, _CMP_EQ_OQ));
+				live = _mm256_andnot_si256(_mm256_castps_si256(cycled), live);
+				if (++step == period) {
+					step = 0;
+					period *= 2;
+					sr = r;
+					si = i;
+				}
+			}
+		}
+
+		_mm256_storeu_si256((__m256i *)counts, count);
+		for (k = 0; k < 8; k++) {
+			clm_cpu_put(out8, out32, ox + k, clm_cpu_shade(counts[k], m));
+		}
+	}
+
+	for (; ox < w; ox++) {
+		float fx = (float)(ox - w / 2) * job->unit + job->centerX;
+		float mag;
+		clm_cpu_put(out8, out32, ox, clm_cpu_shade(clm_cpu_escape(job, fx, fy, &mag), m));
+	}
+}
+/* }}} */
+
+/* {{{ clm_cpu_row_avx512() */
+CLM_TARGET("avx512f")
+static void clm_cpu_row_avx512(const clm_cpu_job_t *job, int oy)
+{
+	const clmandelbrot_t *ctx = job->ctx;
+	const int w = ctx->width, h = ctx->height, m = job->iterations;
+	const int iy = h - 1 - oy;
+	const float fy = (float)(iy - h / 2) * job->unit + job->centerY;
+	unsigned char *out8 = ctx->pixels ? NULL : ctx->bitmap + (size_t)oy * w;
+	int *out32 = ctx->pixels ? ctx->pixels[oy] : NULL;
+	const __m512 unit = _mm512_set1_ps(job->unit);
+	const __m512 cx = _mm512_set1_ps(job->centerX);
+	const __m512 cy = _mm512_set1_ps(fy);
+	const __m512 two = _mm512_set1_ps(2.0f);
+	const __m512 bailout = _mm512_set1_ps(job->bailout);
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 quarter = _mm512_set1_ps(0.25f);
+	const __m512 sixteenth = _mm512_set1_ps(0.0625f);
+	const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+	                                       8, 9, 10, 11, 12, 13, 14, 15);
+	int counts[16];
+	int ox, n, k;
+
+	for (ox = 0; ox < w; ox += 16) {
+		/* the last, partial vector simply starts with fewer live lanes */
+		__mmask16 live = (w - ox >= 16) ? 0xFFFF : (__mmask16)((1 << (w - ox)) - 1);
+		__mmask16 valid = live;
+		__m512i ix = _mm512_add_epi32(_mm512_set1_epi32(ox - w / 2), lane);
+		__m512 fx = _mm512_add_ps(_mm512_mul_ps(_mm512_cvtepi32_ps(ix), unit), cx);
+		__m512 r = fx;
+		__m512 i = cy;
+		__m512 sr = r, si = i;
+		__m512i count = _mm512_set1_epi32(m);
+		int step = 0, period = CLM_CPU_PERIOD;
+
+		if (job->interiorCheck) {
+			__m512 xq = _mm512_sub_ps(fx, quarter);
+			__m512 q = _mm512_add_ps(_mm512_mul_ps(xq, xq), _mm512_mul_ps(cy, cy));
+			__m512 xb = _mm512_add_ps(fx, one);
+			live &= ~_mm512_cmp_ps_mask(_mm512_mul_ps(q, _mm512_add_ps(q, xq)),
+			                            _mm512_mul_ps(_mm512_mul_ps(quarter, cy), cy), _CMP_LE_OQ);
+			live &= ~_mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(xb, xb), _mm512_mul_ps(cy, cy)),
+			                            sixteenth, _CMP_LE_OQ);
+		}
+
+		for (n = 0; n < m && live; n++) {
+			__m512 rr = _mm512_mul_ps(r, r);
+			__m512 ii = _mm512_mul_ps(i, i);
+			__m512 ri = _mm512_mul_ps(r, i);
+			__mmask16 escaped = _mm512_mask_cmp_ps_mask(live, _mm512_add_ps(rr, ii),
+			                                            bailout, _CMP_GT_OQ);
+			count = _mm512_mask_mov_epi32(count, escaped, _mm512_set1_epi32(n));
+			live &= ~escaped;
+			if (!live) {
+				break;
+			}
+			r = _mm512_sub_ps(_mm512_add_ps(fx, rr), ii);
+			i = _mm512_add_ps(cy, _mm512_mul_ps(two, ri));
+			if (job->periodicity) {
+				live &= ~(_mm512_cmp_ps_mask(r, sr, _CMP_EQ_OQ) & _mm512_cmp_ps_mask(i, si, _CMP_EQ_OQ));
+				if (++step == period) {
+					step = 0;
+					period *= 2;
+					sr = r;
+					si = i;
+				}
+			}
+		}
+
+		_mm512_storeu_si512((void *)counts, count);
+		for (k = 0; k < 16; k++) {
+			if (valid & (1 << k)) {
+				clm_cpu_put(out8, out32, ox + k, clm_cpu_shade(counts[k], m));
+			}
+		}
+	}
+}
+/* }}} */
+
+#endif /* CLM_CPU_X86 */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,276 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ext/standard/php_smart_str.h>
+#include <zlib.h>
+
+/* deflate output is written in IDAT chunks of up to this size */
+#define CLM_PNG_CHUNK (64 * 1024)
+
+/* {{{ type definitions */
+
+/* bytes go either to a stream or to a string */
+typedef struct {
+	php_stream *stream;
+	smart_str  *out;
+	long       written;
+	int        failed;
+} clm_writer_t;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static void clm_write(clm_writer_t *writer, const void *data, size_t len);
+static void clm_write_chunk(clm_writer_t *writer, const char *type,
+                            const unsigned char *data, size_t len);
+static void clm_put_uint32(unsigned char *p, unsigned long v);
+static void clm_encode_png(clm_writer_t *writer, const unsigned char *bitmap,
+                           int width, int height, int level);
+static void clm_encode_pnm(clm_writer_t *writer, const unsigned char *bitmap,
+                           int width, int height, int channels);
+
+/* }}} */
+
+/* {{{ clm_encode_format() */
+int clm_encode_format(const char *name)
+{
+	if (strcasecmp(name, "png") == 0) {
+		return CLM_FORMAT_PNG;
+	}
+	if (strcasecmp(name, "pgm") == 0) {
+		return CLM_FORMAT_PGM;
+	}
+	if (strcasecmp(name, "ppm") == 0) {
+		return CLM_FORMAT_PPM;
+	}
+	return -1;
+}
+/* }}} */
+
+/* {{{ clm_encode()
+   encodes a bitmap of one shade per pixel to stream, or to out when
+   stream is NULL; returns the number of bytes written, or -1 */
+long clm_encode(int format, int level, const unsigned char *bitmap, int width, int height,
+                php_stream *stream, smart_str *out TSRMLS_DC)
+{
+	clm_writer_t writer = { stream, out, 0, 0 };
+
+	switch (format) {
+		case CLM_FORMAT_PNG:
+			clm_encode_png(&writer, bitmap, width, height, level);
+			break;
+		case CLM_FORMAT_PGM:
+			clm_encode_pnm(&writer, bitmap, width, height, 1);
+			break;
+		case CLM_FORMAT_PPM:
+			clm_encode_pnm(&writer, bitmap, width, height, 3);
+			break;
+	}
+
+	if (writer.failed) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot write the encoded image");
+		return -1;
+	}
+	return writer.written;
+}
+/* }}} */
+
+/* {{{ clm_write() */
+static void clm_write(clm_writer_t *writer, const void *data, size_t len)
+{
+	if (writer->failed || len == 0) {
+		return;
+	}
+	if (writer->stream) {
+		if (php_stream_write(writer->stream, (const char *)data, len) != len) {
+			writer->failed = 1;
+			return;
+		}
+	} else {
+		smart_str_appendl(writer->out, (const char *)data, len);
+	}
+	writer->written += (long)len;
+}
+/* }}} */
+
+/* {{{ clm_put_uint32() */
+static void clm_put_uint32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+/* }}} */
+
+/* {{{ clm_write_chunk()
+   length, type, data and the CRC of type and data */
+static void clm_write_chunk(clm_writer_t *writer, const char *type,
+                            const unsigned char *data, size_t len)
+{
+	unsigned char buf[4];
+	uLong crc;
+
+	crc = crc32(0L, (const Bytef *)type, 4);
+	if (len) {
+		crc = crc32(crc, data, (uInt)len);
+	}
+
+	clm_put_uint32(buf, len);
+	clm_write(writer, buf, 4);
+	clm_write(writer, type, 4);
+	clm_write(writer, data, len);
+	clm_put_uint32(buf, crc);
+	clm_write(writer, buf, 4);
+}
+/* }}} */
+
+/* {{{ clm_encode_png()
+   8-bit grayscale PNG. Level 0 writes stored deflate blocks behind
+   unfiltered rows, the cheapest valid PNG; other levels compress rows
+   under the Sub filter, which turns the flat bands of the escape time
+   image into runs of zeros */
+static void clm_encode_png(clm_writer_t *writer, const unsigned char *bitmap,
+                           int width, int height, int level)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	unsigned char header[13];
+	unsigned char *row, *chunk;
+	z_stream zs;
+	int x, y, err = Z_OK;
+
+	clm_write(writer, signature, sizeof(signature));
+
+	clm_put_uint32(header, width);
+	clm_put_uint32(header + 4, height);
+	header[8] = 8;   /* bit depth */
+	header[9] = 0;   /* grayscale */
+	header[10] = 0;  /* deflate */
+	header[11] = 0;  /* adaptive filtering */
+	header[12] = 0;  /* no interlace */
+	clm_write_chunk(writer, "IHDR", header, sizeof(header));
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level, Z_DEFLATED, 15, 8,
+	                 level == 1 ? Z_RLE : Z_DEFAULT_STRATEGY) != Z_OK) {
+		writer->failed = 1;
+		return;
+	}
+
+	row = emalloc((size_t)width + 1);
+	chunk = emalloc(CLM_PNG_CHUNK);
+	zs.next_out = chunk;
+	zs.avail_out = CLM_PNG_CHUNK;
+
+	for (y = 0; y <= height && err != Z_STREAM_END && !writer->failed; y++) {
+		int flush = (y == height) ? Z_FINISH : Z_NO_FLUSH;
+
+		if (y < height) {
+			const unsigned char *src = bitmap + (size_t)y * width;
+			if (level == 0) {
+				row[0] = 0;
+				memcpy(row + 1, src, width);
+			} else {
+				row[0] = 1;
+				row[1] = src[0];
+				for (x = 1; x < width; x++) {
+					row[x + 1] = (unsigned char)(src[x] - src[x - 1]);
+				}
+			}
+			zs.next_in = row;
+			zs.avail_in = (uInt)width + 1;
+		}
+
+		do {
+			err = deflate(&zs, flush);
+			if (zs.avail_out == 0 || (err == Z_STREAM_END && zs.avail_out < CLM_PNG_CHUNK)) {
+				clm_write_chunk(writer, "IDAT", chunk, CLM_PNG_CHUNK - zs.avail_out);
+				zs.next_out = chunk;
+				zs.avail_out = CLM_PNG_CHUNK;
+			}
+		} while ((zs.avail_in > 0 || (flush == Z_FINISH && err == Z_OK)) && !writer->failed);
+	}
+	if (err != Z_STREAM_END) {
+		writer->failed = 1;
+	}
+
+	deflateEnd(&zs);
+	efree(chunk);
+	efree(row);
+
+	clm_write_chunk(writer, "IEND", NULL, 0);
+}
+/* }}} */
+
+/* {{{ clm_encode_pnm()
+   binary PGM, or PPM with the shade repeated in each channel */
+static void clm_encode_pnm(clm_writer_t *writer, const unsigned char *bitmap,
+                           int width, int height, int channels)
+{
+	char header[64];
+	unsigned char *row;
+	int len, x, y;
+
+	len = snprintf(header, sizeof(header), "P%c\n%d %d\n255\n",
+	               channels == 1 ? '5' : '6', width, height);
+	clm_write(writer, header, len);
+
+	if (channels == 1) {
+		clm_write(writer, bitmap, (size_t)width * height);
+		return;
+	}
+
+	row = safe_emalloc(width, 3, 0);
+	for (y = 0; y < height && !writer->failed; y++) {
+		const unsigned char *src = bitmap + (size_t)y * width;
+		for (x = 0; x < width; x++) {
+			row[3 * x] = row[3 * x + 1] = row[3 * x + 2] = src[x];
+		}
+		clm_write(writer, row, (size_t)width * 3);
+	}
+	efree(row);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
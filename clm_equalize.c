@@ -0,0 +1,347 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+/* work groups of the histogram kernel; each one strides over the image,
+   so more groups only mean more merges into the global bins */
+#define CLM_EQUALIZE_GROUPS 64
+#define CLM_EQUALIZE_LOCAL  256
+
+/* {{{ type definitions */
+
+enum {
+	CLM_EQ_CLEAR,
+	CLM_EQ_HISTOGRAM,
+	CLM_EQ_CDF,
+	CLM_EQ_REMAP,
+	CLM_EQ_KERNELS
+};
+
+/* }}} */
+
+/* {{{ globals */
+
+static const char *clm_equalize_names[CLM_EQ_KERNELS] = {
+	"MandelbrotClear",
+	"MandelbrotHistogram",
+	"MandelbrotCdf",
+	"MandelbrotEqualize"
+};
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static cl_uint *clm_equalize_bins(int count TSRMLS_DC);
+static void clm_equalize_stats(int count TSRMLS_DC);
+static int clm_equalize_rank(const clm_palette_t *palette, int n, int m,
+                             cl_uint rank, cl_uint total);
+static size_t clm_equalize_local(cl_kernel kernel, cl_device_id device);
+
+/* }}} */
+
+/* {{{ clm_equalize_select()
+   equalization ranks the pixels of one image by escape count, so it needs
+   an image, and every pixel must have a count of its own: the render runs
+   direct with one sample per pixel */
+void clm_equalize_select(clmandelbrot_t *ctx)
+{
+	if (!ctx->pixels) {
+		ctx->equalize = 0;
+	}
+	if (ctx->equalize) {
+		ctx->mode = CLM_MODE_DIRECT;
+		ctx->samples = 1;
+		ctx->adaptive = 0;
+	}
+}
+/* }}} */
+
+/* {{{ clm_equalize()
+   turns the escape counts a CLM_EQUALIZE variant left in output into
+   colours on the device: the counts are binned with local atomics, the
+   bins are accumulated and each count is replaced by the colour of its
+   rank. Only the histogram is read back */
+int clm_equalize(clmandelbrot_t *ctx, cl_mem output TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	cl_command_queue queue = dev->queue;
+	cl_kernel kernels[CLM_EQ_KERNELS] = { NULL };
+	cl_mem histogram = NULL, cdf = NULL;
+	cl_int len = ctx->width * ctx->height;
+	cl_int count = ctx->iterations + 1;
+	cl_int use_local;
+	size_t bins_size = sizeof(cl_uint) * count;
+	size_t local, global;
+	cl_uint *bins;
+	cl_int err = CL_SUCCESS;
+	int result = FAILURE;
+	int i;
+
+	bins = clm_equalize_bins(count TSRMLS_CC);
+	for (i = 0; i < CLM_EQ_KERNELS; i++) {
+		kernels[i] = clCreateKernel(ctx->variant->program, clm_equalize_names[i], &err);
+		if (!kernels[i] || err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+			goto cleanup;
+		}
+	}
+	histogram = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, bins_size, NULL, NULL);
+	cdf = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, bins_size, NULL, NULL);
+	if (!histogram || !cdf) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		goto cleanup;
+	}
+
+	/* the bins of a work group go to local memory when they fit in half
+	   of it; the kernel still needs a local argument when they do not */
+	use_local = (bins_size <= dev->localMem / 2);
+
+	err |= clSetKernelArg(kernels[CLM_EQ_CLEAR], 0, sizeof(cl_mem), &histogram);
+	err |= clSetKernelArg(kernels[CLM_EQ_CLEAR], 1, sizeof(count), &count);
+	err |= clSetKernelArg(kernels[CLM_EQ_HISTOGRAM], 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernels[CLM_EQ_HISTOGRAM], 1, sizeof(len), &len);
+	err |= clSetKernelArg(kernels[CLM_EQ_HISTOGRAM], 2, sizeof(cl_mem), &histogram);
+	err |= clSetKernelArg(kernels[CLM_EQ_HISTOGRAM], 3, use_local ? bins_size : sizeof(cl_uint), NULL);
+	err |= clSetKernelArg(kernels[CLM_EQ_HISTOGRAM], 4, sizeof(use_local), &use_local);
+	err |= clSetKernelArg(kernels[CLM_EQ_CDF], 0, sizeof(cl_mem), &histogram);
+	err |= clSetKernelArg(kernels[CLM_EQ_CDF], 1, sizeof(cl_mem), &cdf);
+	err |= clSetKernelArg(kernels[CLM_EQ_REMAP], 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernels[CLM_EQ_REMAP], 1, sizeof(len), &len);
+	err |= clSetKernelArg(kernels[CLM_EQ_REMAP], 2, sizeof(cl_mem), &cdf);
+	err |= clm_palette_args(ctx, kernels[CLM_EQ_REMAP], 3);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+		goto cleanup;
+	}
+
+	local = clm_equalize_local(kernels[CLM_EQ_CLEAR], ctx->device);
+	err = clm_enqueue_1d(queue, kernels[CLM_EQ_CLEAR], count, local, 0, NULL, NULL);
+	if (err == CL_SUCCESS) {
+		local = clm_equalize_local(kernels[CLM_EQ_HISTOGRAM], ctx->device);
+		global = MIN(((size_t)len + local - 1) / local, CLM_EQUALIZE_GROUPS) * local;
+		err = clEnqueueNDRangeKernel(queue, kernels[CLM_EQ_HISTOGRAM], 1, NULL, &global, &local,
+		                             0, NULL, NULL);
+	}
+	if (err == CL_SUCCESS) {
+		local = clm_equalize_local(kernels[CLM_EQ_CDF], ctx->device);
+		err = clSetKernelArg(kernels[CLM_EQ_CDF], 2, sizeof(cl_uint) * local, NULL);
+	}
+	if (err == CL_SUCCESS) {
+		err = clEnqueueNDRangeKernel(queue, kernels[CLM_EQ_CDF], 1, NULL, &local, &local,
+		                             0, NULL, NULL);
+	}
+	if (err == CL_SUCCESS) {
+		local = clm_equalize_local(kernels[CLM_EQ_REMAP], ctx->device);
+		err = clm_enqueue_1d(queue, kernels[CLM_EQ_REMAP], len, local, 0, NULL, NULL);
+	}
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
+		goto cleanup;
+	}
+
+	err = clEnqueueReadBuffer(queue, histogram, CL_TRUE, 0, bins_size, bins, 0, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot read histogram buffer");
+		goto cleanup;
+	}
+	clm_equalize_stats(count TSRMLS_CC);
+	result = SUCCESS;
+
+cleanup:
+	if (histogram) {
+		clReleaseMemObject(histogram);
+	}
+	if (cdf) {
+		clReleaseMemObject(cdf);
+	}
+	for (i = 0; i < CLM_EQ_KERNELS; i++) {
+		if (kernels[i]) {
+			clReleaseKernel(kernels[i]);
+		}
+	}
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_equalize_pixels()
+   the same on the host, for the escape counts the CPU, multi-device and
+   tiled renderers leave in the image */
+int clm_equalize_pixels(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	const int m = ctx->iterations;
+	cl_uint *bins = clm_equalize_bins(m + 1 TSRMLS_CC);
+	cl_uint *cdf = safe_emalloc(m + 1, sizeof(cl_uint), 0);
+	cl_uint sum = 0;
+	int x, y, n;
+
+	memset(bins, 0, sizeof(cl_uint) * (m + 1));
+	for (y = 0; y < ctx->height; y++) {
+		const int *row = ctx->pixels[y];
+		for (x = 0; x < ctx->width; x++) {
+			bins[MAX(0, MIN(row[x], m))]++;
+		}
+	}
+	for (n = 0; n < m; n++) {
+		sum += bins[n];
+		cdf[n] = sum;
+	}
+	cdf[m] = sum;
+
+	for (y = 0; y < ctx->height; y++) {
+		int *row = ctx->pixels[y];
+		for (x = 0; x < ctx->width; x++) {
+			n = MAX(0, MIN(row[x], m));
+			row[x] = clm_equalize_rank(&ctx->palette, n, m, cdf[n], sum);
+		}
+	}
+
+	efree(cdf);
+	clm_equalize_stats(m + 1 TSRMLS_CC);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_equalize_shutdown() */
+void clm_equalize_shutdown(TSRMLS_D)
+{
+	clm_histogram_t *hist = &CLMANDELBROT_G(histogram);
+
+	if (hist->bins) {
+		pefree(hist->bins, 1);
+	}
+	memset(hist, 0, sizeof(clm_histogram_t));
+}
+/* }}} */
+
+/* {{{ clm_equalize_bins()
+   the histogram storage, grown to count bins */
+static cl_uint *clm_equalize_bins(int count TSRMLS_DC)
+{
+	clm_histogram_t *hist = &CLMANDELBROT_G(histogram);
+
+	if (hist->capacity < count) {
+		hist->bins = perealloc(hist->bins, sizeof(cl_uint) * count, 1);
+		hist->capacity = count;
+	}
+	hist->count = 0;
+	return hist->bins;
+}
+/* }}} */
+
+/* {{{ clm_equalize_stats()
+   escaping points and the least, greatest and mean escape count among
+   them, for clmandelbrot_last_histogram() */
+static void clm_equalize_stats(int count TSRMLS_DC)
+{
+	clm_histogram_t *hist = &CLMANDELBROT_G(histogram);
+	double total = 0.0;
+	int n;
+
+	hist->count = count;
+	hist->escaped = 0;
+	hist->min = hist->max = -1;
+	for (n = 0; n < count - 1; n++) {
+		if (hist->bins[n]) {
+			if (hist->min < 0) {
+				hist->min = n;
+			}
+			hist->max = n;
+			hist->escaped += hist->bins[n];
+			total += (double)n * hist->bins[n];
+		}
+	}
+	hist->mean = hist->escaped ? total / hist->escaped : 0.0;
+	CLMANDELBROT_G(last).equalized = 1;
+}
+/* }}} */
+
+/* {{{ clm_equalize_rank()
+   MandelbrotRank: the colour of an escaping point with rank points at or
+   below its count out of total */
+static int clm_equalize_rank(const clm_palette_t *palette, int n, int m,
+                             cl_uint rank, cl_uint total)
+{
+	int c, s, rgb = 0;
+
+	if (palette->count) {
+		const int *colors = palette->colors;
+		cl_ulong q;
+		int k, f;
+
+		if (n >= m || total == 0) {
+			return colors[palette->count - 1];
+		}
+		q = (cl_ulong)rank * (cl_ulong)(palette->count - 1) * 256 / total;
+		k = MIN((int)(q >> 8), palette->count - 2);
+		f = (int)q - (k << 8);
+		for (s = 0; s <= 16; s += 8) {
+			rgb |= ((((colors[k] >> s) & 0xff) * (256 - f)
+			        + ((colors[k + 1] >> s) & 0xff) * f + 128) >> 8) << s;
+		}
+		return rgb;
+	}
+
+	if (n >= m || total == 0) {
+		return 0xffffff;
+	}
+	c = (int)(((cl_ulong)rank * 255 + total / 2) / total);
+	return (c << 16) | (c << 8) | c;
+}
+/* }}} */
+
+/* {{{ clm_equalize_local()
+   a work group size the kernel can run with on the device */
+static size_t clm_equalize_local(cl_kernel kernel, cl_device_id device)
+{
+	size_t size = 0;
+
+	if (clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+	                             sizeof(size), &size, NULL) != CL_SUCCESS || size == 0) {
+		return 1;
+	}
+	return MIN(size, CLM_EQUALIZE_LOCAL);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
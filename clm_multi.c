@@ -0,0 +1,494 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+/* chunk sizes in pixels; the first chunk of each device is a small probe
+   that measures its throughput */
+#define CLM_MULTI_MIN_CHUNK (64 * 1024)
+#define CLM_MULTI_MAX_CHUNK CLM_DEFAULT_TILE_SIZE
+
+/* each device has two chunks in flight, so it never waits for the host */
+#define CLM_MULTI_SLOTS 2
+
+/* {{{ type definitions */
+
+typedef struct {
+	zend_bool busy;
+	int       y0;
+	int       rows;
+	cl_event  kernel;
+	cl_event  event;
+	double    started;
+	int       *host;
+} clm_chunk_t;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static int clm_multi_setup(TSRMLS_D);
+static void clm_multi_release_orbits(clmandelbrot_t *ctx, cl_mem *orbits, cl_uint count);
+static int clm_multi_setup_buffers(clm_multi_t *multi, size_t len TSRMLS_DC);
+static int clm_multi_chunk_rows(int remaining, double rate, double total_rate,
+                                int min_rows, int max_rows);
+
+/* }}} */
+
+/* {{{ clm_multi_render()
+   hands out bands of rows to every device as soon as it has a free slot;
+   after the first chunk, each device gets a share of the remaining rows
+   proportional to the throughput it has shown so far */
+int clm_multi_render(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_multi_t *multi = &CLMANDELBROT_G(multi);
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	clm_chunk_t chunks[MAX_NUM_DEVICES][CLM_MULTI_SLOTS];
+	clm_variant_t *variants[MAX_NUM_DEVICES];
+	cl_mem orbits[MAX_NUM_DEVICES], palettes[MAX_NUM_DEVICES];
+	double busy_since[MAX_NUM_DEVICES], busy[MAX_NUM_DEVICES];
+	long pixels[MAX_NUM_DEVICES];
+	int active[MAX_NUM_DEVICES];
+	char options[CLM_OPTIONS_SIZE];
+	int min_rows, max_rows;
+	int next = 0, inflight = 0, result = SUCCESS;
+	cl_uint d, p;
+	int s;
+
+	if (clm_multi_setup(TSRMLS_C) == FAILURE) {
+		return FAILURE;
+	}
+
+	if (clm_select_precision(ctx, multi->hasDouble TSRMLS_CC) == FAILURE
+		|| clm_perturb_prepare(ctx TSRMLS_CC) == FAILURE
+	) {
+		return FAILURE;
+	}
+	/* the devices share one program, so vectors only when asked for */
+	clm_variant_sampling(ctx);
+	clm_variant_vector(ctx, 1, 1);
+
+	/* the variant, the reference orbit and the palette exist once per
+	   platform; ctx points at those of the device being dispatched */
+	clm_variant_options(ctx, options, sizeof(options));
+	memset(orbits, 0, sizeof(orbits));
+	for (p = 0; p < multi->numPlatforms && result == SUCCESS; p++) {
+		clm_multi_platform_t *platform = &multi->platforms[p];
+
+		variants[p] = clm_variant_get(&platform->variants, platform->context, platform->count,
+		                              &multi->devices[platform->first],
+		                              clm_variant_kernel(ctx), options TSRMLS_CC);
+		ctx->perturb.buffer = NULL;
+		if (!variants[p] || clm_perturb_upload(ctx, platform->context TSRMLS_CC) == FAILURE
+			|| clm_palette_upload(&ctx->palette, &platform->palettes,
+			                      platform->context TSRMLS_CC) == FAILURE
+		) {
+			result = FAILURE;
+		}
+		orbits[p] = ctx->perturb.buffer;
+		palettes[p] = ctx->palette.buffer;
+	}
+	if (result == FAILURE) {
+		clm_multi_release_orbits(ctx, orbits, p);
+		return FAILURE;
+	}
+
+	min_rows = MAX(1, CLM_MULTI_MIN_CHUNK / ctx->width);
+	max_rows = MAX(min_rows, CLM_MULTI_MAX_CHUNK / ctx->width);
+	if (clm_multi_setup_buffers(multi, sizeof(cl_int) * ctx->width * max_rows TSRMLS_CC) == FAILURE) {
+		clm_multi_release_orbits(ctx, orbits, multi->numPlatforms);
+		return FAILURE;
+	}
+
+	memset(chunks, 0, sizeof(chunks));
+	last->numDevices = multi->count;
+	for (d = 0; d < multi->count; d++) {
+		busy[d] = 0.0;
+		pixels[d] = 0;
+		active[d] = 0;
+		last->devices[d].deviceId = multi->ids[d];
+		for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+			chunks[d][s].host = safe_emalloc(max_rows, sizeof(int) * ctx->width, 0);
+		}
+	}
+
+	for (;;) {
+		clm_chunk_t *oldest = NULL;
+		double total_rate = 0.0;
+
+		for (d = 0; d < multi->count; d++) {
+			if (busy[d] > 0.0) {
+				total_rate += pixels[d] / busy[d];
+			}
+		}
+
+		/* dispatch */
+		for (d = 0; d < multi->count && next < ctx->height && result == SUCCESS; d++) {
+			for (s = 0; s < CLM_MULTI_SLOTS && next < ctx->height; s++) {
+				clm_chunk_t *chunk = &chunks[d][s];
+				double rate = (busy[d] > 0.0) ? pixels[d] / busy[d] : 0.0;
+				cl_uint k = d - multi->platforms[multi->platformOf[d]].first;
+				cl_event kernel = NULL;
+				cl_int err;
+
+				if (chunk->busy) {
+					continue;
+				}
+
+				p = multi->platformOf[d];
+				ctx->variant = variants[p];
+				ctx->perturb.buffer = orbits[p];
+				ctx->palette.buffer = palettes[p];
+
+				chunk->y0 = next;
+				chunk->rows = clm_multi_chunk_rows(ctx->height - next, rate, total_rate,
+				                                   min_rows, max_rows);
+				if (clm_enqueue_rows(ctx, multi->queues[d], ctx->variant->kernels[k],
+				                     &ctx->variant->tuning[k], multi->buffers[d][s],
+				                     chunk->y0, chunk->rows, 0, NULL, &kernel TSRMLS_CC) == FAILURE) {
+					result = FAILURE;
+					break;
+				}
+				err = clEnqueueReadBuffer(multi->queues[d], multi->buffers[d][s], CL_FALSE, 0,
+				                          sizeof(cl_int) * ctx->width * chunk->rows, chunk->host,
+				                          1, &kernel, &chunk->event);
+				if (err != CL_SUCCESS) {
+					clReleaseEvent(kernel);
+					php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue read buffer");
+					result = FAILURE;
+					break;
+				}
+				clFlush(multi->queues[d]);
+
+				/* kept for its timestamps until the chunk is collected */
+				chunk->kernel = kernel;
+				if (active[d]++ == 0) {
+					busy_since[d] = clm_now();
+				}
+				chunk->busy = 1;
+				chunk->started = clm_now();
+				next += chunk->rows;
+				inflight++;
+			}
+		}
+
+		if (inflight == 0) {
+			break;
+		}
+
+		/* block on the chunk dispatched first, then collect whatever else
+		   has completed in the meantime */
+		for (d = 0; d < multi->count; d++) {
+			for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+				if (chunks[d][s].busy && (!oldest || chunks[d][s].started < oldest->started)) {
+					oldest = &chunks[d][s];
+				}
+			}
+		}
+		if (clWaitForEvents(1, &oldest->event) != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot render rows %d-%d",
+			                 oldest->y0, oldest->y0 + oldest->rows - 1);
+			result = FAILURE;
+		}
+
+		for (d = 0; d < multi->count; d++) {
+			for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+				clm_chunk_t *chunk = &chunks[d][s];
+				cl_int status = CL_COMPLETE;
+
+				if (!chunk->busy) {
+					continue;
+				}
+				if (chunk != oldest) {
+					clGetEventInfo(chunk->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+					               sizeof(status), &status, NULL);
+					if (status > CL_COMPLETE) {
+						continue;
+					}
+				}
+				if (status == CL_COMPLETE && result == SUCCESS) {
+					clm_draw(chunk->host, chunk->y0, chunk->rows, ctx TSRMLS_CC);
+				} else if (status < 0) {
+					result = FAILURE;
+				}
+
+				clm_prof_release(CLM_PROF_KERNEL, chunk->kernel TSRMLS_CC);
+				clm_prof_release(CLM_PROF_TRANSFER, chunk->event TSRMLS_CC);
+				chunk->kernel = NULL;
+				chunk->event = NULL;
+				chunk->busy = 0;
+				inflight--;
+
+				pixels[d] += (long)chunk->rows * ctx->width;
+				last->devices[d].chunks++;
+				last->devices[d].rows += chunk->rows;
+				if (--active[d] == 0) {
+					busy[d] += clm_now() - busy_since[d];
+				}
+			}
+		}
+
+		if (result == FAILURE && inflight == 0) {
+			break;
+		}
+	}
+
+	for (d = 0; d < multi->count; d++) {
+		last->devices[d].time = busy[d];
+		for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+			efree(chunks[d][s].host);
+		}
+	}
+	clm_multi_release_orbits(ctx, orbits, multi->numPlatforms);
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_multi_release_orbits()
+   keeps the first reference orbit in ctx, which releases it with the
+   render, and releases the copies on the other platforms */
+static void clm_multi_release_orbits(clmandelbrot_t *ctx, cl_mem *orbits, cl_uint count)
+{
+	cl_uint p;
+
+	ctx->perturb.buffer = count ? orbits[0] : NULL;
+	for (p = 1; p < count; p++) {
+		if (orbits[p]) {
+			clReleaseMemObject(orbits[p]);
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_multi_release() */
+void clm_multi_release(clm_multi_t *multi)
+{
+	cl_uint d, p;
+	int s;
+
+	for (d = 0; d < MAX_NUM_DEVICES; d++) {
+		for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+			if (multi->buffers[d][s]) {
+				clReleaseMemObject(multi->buffers[d][s]);
+			}
+		}
+		if (multi->queues[d]) {
+			clReleaseCommandQueue(multi->queues[d]);
+		}
+	}
+	for (p = 0; p < multi->numPlatforms; p++) {
+		clm_multi_platform_t *platform = &multi->platforms[p];
+
+		clm_variant_release_all(&platform->variants);
+		clm_palette_release_all(&platform->palettes);
+		if (platform->context) {
+			clReleaseContext(platform->context);
+		}
+	}
+	memset(multi, 0, sizeof(clm_multi_t));
+}
+/* }}} */
+
+/* {{{ clm_multi_setup()
+   one queue for every usable device, and one context for the devices of
+   each platform, since a context cannot span platforms; the kernel
+   variants are built for all devices of a platform at once */
+static int clm_multi_setup(TSRMLS_D)
+{
+	clm_multi_t *multi = &CLMANDELBROT_G(multi);
+	cl_device_id devices[MAX_NUM_DEVICES];
+	cl_platform_id platforms[MAX_NUM_DEVICES];
+	cl_uint ids[MAX_NUM_DEVICES];
+	cl_int err = CL_SUCCESS;
+	cl_uint i, p, n = 0;
+	double start;
+
+	if (multi->count) {
+		return SUCCESS;
+	}
+
+	if (clm_setup_device(TSRMLS_C) == FAILURE) {
+		return FAILURE;
+	}
+
+	/* double precision is used only when every device has it */
+	multi->hasDouble = 1;
+	for (i = 0; i < CLMANDELBROT_G(deviceCount); i++) {
+		cl_device_id device = CLMANDELBROT_G(deviceList)[i];
+		cl_bool available = 0, compiler = 0;
+		cl_device_fp_config fp_config = 0;
+
+		clGetDeviceInfo(device, CL_DEVICE_AVAILABLE, sizeof(available), &available, NULL);
+		clGetDeviceInfo(device, CL_DEVICE_COMPILER_AVAILABLE, sizeof(compiler), &compiler, NULL);
+		if (available && compiler
+			&& clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(cl_platform_id),
+			                   &platforms[n], NULL) == CL_SUCCESS
+		) {
+			clGetDeviceInfo(device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp_config), &fp_config, NULL);
+			if (fp_config == 0) {
+				multi->hasDouble = 0;
+			}
+			ids[n] = i;
+			devices[n++] = device;
+		}
+	}
+	if (n == 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "no device is available");
+		return FAILURE;
+	}
+
+	/* the devices of a platform are kept next to each other, in the order
+	   the platforms first appear */
+	for (i = 0; i < n; i++) {
+		cl_uint j;
+
+		for (p = 0; p < multi->numPlatforms; p++) {
+			if (multi->platforms[p].platform == platforms[i]) {
+				break;
+			}
+		}
+		if (p < multi->numPlatforms) {
+			continue;
+		}
+		multi->platforms[p].platform = platforms[i];
+		multi->platforms[p].first = multi->count;
+		for (j = i; j < n; j++) {
+			if (platforms[j] == platforms[i]) {
+				multi->ids[multi->count] = ids[j];
+				multi->devices[multi->count] = devices[j];
+				multi->platformOf[multi->count++] = p;
+				multi->platforms[p].count++;
+			}
+		}
+		multi->numPlatforms++;
+	}
+
+	start = clm_now();
+	for (p = 0; p < multi->numPlatforms; p++) {
+		clm_multi_platform_t *platform = &multi->platforms[p];
+		cl_context_properties properties[] = {
+			CL_CONTEXT_PLATFORM, (cl_context_properties)platform->platform, 0
+		};
+
+		platform->context = clCreateContext(properties, platform->count,
+		                                    &multi->devices[platform->first], NULL, NULL, &err);
+		if (!platform->context) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create context");
+			clm_multi_release(multi);
+			return FAILURE;
+		}
+	}
+
+	for (i = 0; i < multi->count; i++) {
+		multi->queues[i] = clCreateCommandQueue(multi->platforms[multi->platformOf[i]].context,
+		                                        multi->devices[i], CL_QUEUE_PROFILING_ENABLE, &err);
+		if (!multi->queues[i]) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create command queue");
+			clm_multi_release(multi);
+			return FAILURE;
+		}
+	}
+	clm_prof_add(CLM_PROF_CONTEXT, clm_now() - start TSRMLS_CC);
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_multi_setup_buffers() */
+static int clm_multi_setup_buffers(clm_multi_t *multi, size_t len TSRMLS_DC)
+{
+	cl_uint d;
+	int s;
+
+	if (multi->bufferSize >= len) {
+		return SUCCESS;
+	}
+
+	for (d = 0; d < multi->count; d++) {
+		for (s = 0; s < CLM_MULTI_SLOTS; s++) {
+			if (multi->buffers[d][s]) {
+				clReleaseMemObject(multi->buffers[d][s]);
+			}
+			multi->buffers[d][s] = clCreateBuffer(multi->platforms[multi->platformOf[d]].context,
+			                                      CL_MEM_WRITE_ONLY, len, NULL, NULL);
+			if (!multi->buffers[d][s]) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+				multi->bufferSize = 0;
+				return FAILURE;
+			}
+		}
+	}
+	multi->bufferSize = len;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_multi_chunk_rows()
+   guided self-scheduling weighted by throughput: half of the device's
+   share of what is left, so that later chunks can still even out */
+static int clm_multi_chunk_rows(int remaining, double rate, double total_rate,
+                                int min_rows, int max_rows)
+{
+	int rows;
+
+	if (rate <= 0.0 || total_rate <= 0.0) {
+		rows = min_rows;
+	} else {
+		rows = (int)(remaining * (rate / total_rate) / 2.0);
+	}
+	if (rows < min_rows) {
+		rows = min_rows;
+	}
+	if (rows > max_rows) {
+		rows = max_rows;
+	}
+	if (rows > remaining) {
+		rows = remaining;
+	}
+
+	return rows;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
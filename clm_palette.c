@@ -0,0 +1,220 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ext/standard/md5.h>
+#include <math.h>
+
+/* the palette is interpolated the way the kernel does it */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#else
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+/* {{{ clm_palette_parse()
+   reads the "palette" option: a list of gd truecolor values, which the
+   image spans from the first colour for points escaping at once to the
+   last one for points that do not escape */
+int clm_palette_parse(clm_palette_t *palette, zval *zpalette TSRMLS_DC)
+{
+	HashTable *colors;
+	HashPosition pos;
+	zval **entry;
+	PHP_MD5_CTX md5;
+	int i = 0;
+
+	if (Z_TYPE_P(zpalette) != IS_ARRAY) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "palette must be an array of colors");
+		return FAILURE;
+	}
+	colors = Z_ARRVAL_P(zpalette);
+	if (zend_hash_num_elements(colors) < 2 || zend_hash_num_elements(colors) > CLM_MAX_PALETTE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "palette must have between 2 and %d colors", CLM_MAX_PALETTE);
+		return FAILURE;
+	}
+
+	for (zend_hash_internal_pointer_reset_ex(colors, &pos);
+		zend_hash_get_current_data_ex(colors, (void **)&entry, &pos) == SUCCESS;
+		zend_hash_move_forward_ex(colors, &pos)
+	) {
+		zval tmp = **entry;
+
+		zval_copy_ctor(&tmp);
+		convert_to_long(&tmp);
+		/* the alpha channel is dropped, palette pixels are opaque */
+		palette->colors[i++] = (int)(Z_LVAL(tmp) & 0xffffff);
+	}
+	palette->count = i;
+
+	PHP_MD5Init(&md5);
+	PHP_MD5Update(&md5, (const unsigned char *)palette->colors, sizeof(int) * palette->count);
+	PHP_MD5Final(palette->key, &md5);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_palette_select()
+   palettes colour the packed pixels of direct renders: shade bitmaps and
+   progressive passes are gray only, and subdivision, whose kernels
+   compare gray borders, falls back to direct rendering */
+int clm_palette_select(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	if (!ctx->palette.count) {
+		return SUCCESS;
+	}
+	if (!ctx->pixels) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "palettes need an image to colour");
+		return FAILURE;
+	}
+	if (ctx->mode == CLM_MODE_PROGRESSIVE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "progressive passes cannot be coloured with a palette");
+		return FAILURE;
+	}
+	if (ctx->mode == CLM_MODE_SUBDIVIDE) {
+		ctx->mode = CLM_MODE_DIRECT;
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_palette_upload()
+   finds the palette among those uploaded to the context, or uploads it in
+   place of the least recently used one */
+int clm_palette_upload(clm_palette_t *palette, clm_palettes_t *cache, cl_context context TSRMLS_DC)
+{
+	clm_palette_entry_t *entry = NULL;
+	cl_int err = CL_SUCCESS;
+	int i;
+
+	palette->buffer = NULL;
+	if (!palette->count) {
+		return SUCCESS;
+	}
+
+	cache->clock++;
+	for (i = 0; i < CLM_MAX_PALETTES; i++) {
+		clm_palette_entry_t *e = &cache->entries[i];
+
+		if (e->buffer && memcmp(e->key, palette->key, sizeof(e->key)) == 0) {
+			e->lastUsed = cache->clock;
+			palette->buffer = e->buffer;
+			return SUCCESS;
+		}
+		if (!entry || (entry->buffer && (!e->buffer || e->lastUsed < entry->lastUsed))) {
+			entry = e;
+		}
+	}
+
+	if (entry->buffer) {
+		clReleaseMemObject(entry->buffer);
+	}
+	entry->buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+	                               sizeof(cl_int) * palette->count, palette->colors, &err);
+	if (!entry->buffer || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create palette buffer");
+		memset(entry, 0, sizeof(clm_palette_entry_t));
+		return FAILURE;
+	}
+	memcpy(entry->key, palette->key, sizeof(entry->key));
+	entry->lastUsed = cache->clock;
+	palette->buffer = entry->buffer;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_palette_args()
+   the last two arguments of the kernels writing packed pixels */
+cl_int clm_palette_args(const clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index)
+{
+	cl_int err;
+
+	if (!ctx->palette.count) {
+		return CL_SUCCESS;
+	}
+	err = clSetKernelArg(kernel, index, sizeof(cl_mem), &ctx->palette.buffer);
+	err |= clSetKernelArg(kernel, index + 1, sizeof(ctx->palette.count), &ctx->palette.count);
+	return err;
+}
+/* }}} */
+
+/* {{{ clm_palette_color()
+   MandelbrotRGBOf with a palette: n iterations escaping with |z|^2 = mag */
+int clm_palette_color(const clm_palette_t *palette, int n, int m, double mag)
+{
+	float mu = (float)n;
+	float t, p, f;
+	int k, s, rgb = 0;
+
+	if (palette->smooth && n < m && mag > 1) {
+		mu += 1.0f - log2f(0.5f * logf((float)mag));
+	}
+	t = mu / (float)m;
+	p = (t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t)) * (float)(palette->count - 1);
+	k = MIN((int)p, palette->count - 2);
+	f = p - (float)k;
+	for (s = 0; s <= 16; s += 8) {
+		float ca = (float)((palette->colors[k] >> s) & 0xff);
+		float cb = (float)((palette->colors[k + 1] >> s) & 0xff);
+		rgb |= (int)(ca + (cb - ca) * f + 0.5f) << s;
+	}
+	return rgb;
+}
+/* }}} */
+
+/* {{{ clm_palette_release_all() */
+void clm_palette_release_all(clm_palettes_t *cache)
+{
+	int i;
+
+	for (i = 0; i < CLM_MAX_PALETTES; i++) {
+		if (cache->entries[i].buffer) {
+			clReleaseMemObject(cache->entries[i].buffer);
+		}
+	}
+	memset(cache, 0, sizeof(clm_palettes_t));
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
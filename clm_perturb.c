@@ -0,0 +1,537 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ctype.h>
+#include <math.h>
+
+/* float keeps about 7 digits, double about 16; a pixel has to be well above
+   the rounding step of the coordinates around it */
+#define CLM_FLOAT_RESOLUTION  (1.0 / (1 << 16))
+#define CLM_DOUBLE_RESOLUTION (1.0 / (1LL << 46))
+
+/* the series approximation stops when the cubic term is no longer small
+   against the linear one */
+#define CLM_SA_TOLERANCE_FLOAT  1e-6
+#define CLM_SA_TOLERANCE_DOUBLE 1e-12
+
+/* the reference orbit stops at this squared radius, so that the integer
+   limb cannot overflow; pixels continue past it by rebasing */
+#define CLM_REFERENCE_BAILOUT 65536.0
+
+#define CLM_MP_MAX_EXPONENT 10000
+
+/* {{{ function prototypes */
+
+static int clm_mp_limbs(double unit);
+static int clm_mp_cmp_abs(const clm_mp_t *a, const clm_mp_t *b, int n);
+static void clm_mp_add(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n);
+static void clm_mp_sub(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n);
+static void clm_mp_mul(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n);
+static void clm_mp_div_small(clm_mp_t *x, cl_uint divisor, int n);
+static int clm_perturb_orbit(clmandelbrot_t *ctx);
+static void clm_perturb_series(clmandelbrot_t *ctx);
+
+/* }}} */
+
+/* {{{ clm_mp_from_double()
+   exact, since scaling by 2^32 and dropping the integer part never round */
+void clm_mp_from_double(clm_mp_t *x, double v)
+{
+	int i;
+
+	memset(x, 0, sizeof(clm_mp_t));
+	if (v < 0.0) {
+		x->neg = 1;
+		v = -v;
+	}
+	if (!(v < 4294967296.0)) {
+		return;
+	}
+
+	for (i = 0; i < CLM_MP_LIMBS && v != 0.0; i++) {
+		x->d[i] = (cl_uint)v;
+		v = (v - (double)x->d[i]) * 4294967296.0;
+	}
+}
+/* }}} */
+
+/* {{{ clm_mp_parse()
+   reads a decimal number such as "-0.743643887037158704752191506114774"
+   or "1.5e-200" without going through double */
+int clm_mp_parse(clm_mp_t *x, const char *str, int len)
+{
+	const char *p = str, *end = str + len;
+	const char *digits = NULL, *q;
+	char *buf;
+	int ndigits = 0, point = -1, exponent = 0, i;
+	cl_ulong ipart = 0;
+	int neg = 0;
+
+	memset(x, 0, sizeof(clm_mp_t));
+
+	while (p < end && isspace((unsigned char)*p)) {
+		p++;
+	}
+	if (p < end && (*p == '-' || *p == '+')) {
+		neg = (*p == '-');
+		p++;
+	}
+	digits = p;
+	for (; p < end; p++) {
+		if (*p == '.' && point < 0) {
+			point = ndigits;
+		} else if (*p >= '0' && *p <= '9') {
+			ndigits++;
+		} else {
+			break;
+		}
+	}
+	if (ndigits == 0) {
+		return FAILURE;
+	}
+	if (point < 0) {
+		point = ndigits;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		int eneg = 0, edigits = 0;
+		p++;
+		if (p < end && (*p == '-' || *p == '+')) {
+			eneg = (*p == '-');
+			p++;
+		}
+		for (; p < end && *p >= '0' && *p <= '9'; p++, edigits++) {
+			if (exponent > CLM_MP_MAX_EXPONENT) {
+				return FAILURE;
+			}
+			exponent = exponent * 10 + (*p - '0');
+		}
+		if (edigits == 0) {
+			return FAILURE;
+		}
+		if (eneg) {
+			exponent = -exponent;
+		}
+	}
+	while (p < end && isspace((unsigned char)*p)) {
+		p++;
+	}
+	if (p != end) {
+		return FAILURE;
+	}
+
+	/* the decimal point moves by the exponent; digit i then has the weight
+	   10^(point - 1 - i) */
+	point += exponent;
+
+	/* collect the digits without the point */
+	buf = emalloc(ndigits);
+	for (q = digits, i = 0; i < ndigits; q++) {
+		if (*q != '.') {
+			buf[i++] = *q - '0';
+		}
+	}
+
+	/* fraction: Horner's scheme from the last digit, one division by ten
+	   per digit, then one per zero between the point and the first digit */
+	for (i = ndigits - 1; i >= 0 && i >= point; i--) {
+		x->d[0] = buf[i];
+		clm_mp_div_small(x, 10, CLM_MP_LIMBS);
+	}
+	for (i = (point < 0 ? point : 0); i < 0; i++) {
+		clm_mp_div_small(x, 10, CLM_MP_LIMBS);
+	}
+	for (i = 0; i < point; i++) {
+		ipart = ipart * 10 + (i < ndigits ? buf[i] : 0);
+		if (ipart > 0xFFFFFFFFULL) {
+			efree(buf);
+			return FAILURE;
+		}
+	}
+	efree(buf);
+
+	x->d[0] = (cl_uint)ipart;
+	x->neg = neg;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_mp_to_double() */
+double clm_mp_to_double(const clm_mp_t *x)
+{
+	double v = 0.0;
+	int i;
+
+	for (i = CLM_MP_LIMBS - 1; i >= 0; i--) {
+		v = v / 4294967296.0 + (double)x->d[i];
+	}
+	return x->neg ? -v : v;
+}
+/* }}} */
+
+/* {{{ clm_precision_name() */
+const char *clm_precision_name(int precision)
+{
+	switch (precision) {
+		case CLM_PRECISION_FLOAT:
+			return "float";
+		case CLM_PRECISION_DOUBLE:
+			return "double";
+		case CLM_PRECISION_PERTURB:
+			return "perturbation";
+	}
+	return "auto";
+}
+/* }}} */
+
+/* {{{ clm_select_precision()
+   resolves the requested precision against what the renderer supports;
+   perturbation with float offsets stands in for double on devices without
+   double support */
+int clm_select_precision(clmandelbrot_t *ctx, zend_bool has_double TSRMLS_DC)
+{
+	double scale = MAX(2.0, MAX(fabs(ctx->centerX), fabs(ctx->centerY)));
+
+	if (ctx->precision == CLM_PRECISION_AUTO) {
+		if (ctx->unit >= scale * CLM_FLOAT_RESOLUTION) {
+			ctx->precision = CLM_PRECISION_FLOAT;
+		} else if (ctx->unit >= scale * CLM_DOUBLE_RESOLUTION && has_double) {
+			ctx->precision = CLM_PRECISION_DOUBLE;
+		} else {
+			ctx->precision = CLM_PRECISION_PERTURB;
+		}
+	}
+
+	if (ctx->precision == CLM_PRECISION_DOUBLE && !has_double) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "the device does not support double precision");
+		return FAILURE;
+	}
+	if (ctx->precision == CLM_PRECISION_PERTURB && !has_double && ctx->unit < CLM_FLOAT_MIN_UNIT) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "unit %g needs double precision, which the device does not support",
+		                 ctx->unit);
+		return FAILURE;
+	}
+
+	ctx->useDouble = (ctx->precision != CLM_PRECISION_FLOAT && has_double);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_perturb_prepare()
+   computes the reference orbit at the image center and the series
+   approximation around it */
+int clm_perturb_prepare(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	double start;
+
+	last->precision = clm_precision_name(ctx->precision);
+	if (ctx->precision != CLM_PRECISION_PERTURB) {
+		return SUCCESS;
+	}
+
+	start = clm_now();
+	if (clm_perturb_orbit(ctx) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot compute the reference orbit");
+		return FAILURE;
+	}
+	clm_perturb_series(ctx);
+	clm_prof_add(CLM_PROF_REFERENCE, clm_now() - start TSRMLS_CC);
+
+	last->reference = ctx->perturb.length;
+	last->skipped = ctx->perturb.skip;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_perturb_upload()
+   copies the reference orbit to the device, in the precision of the kernel */
+int clm_perturb_upload(clmandelbrot_t *ctx, cl_context context TSRMLS_DC)
+{
+	clm_perturb_t *perturb = &ctx->perturb;
+	size_t count = 2 * (size_t)perturb->length;
+	cl_int err = CL_SUCCESS;
+	void *host;
+	size_t len;
+
+	if (ctx->precision != CLM_PRECISION_PERTURB) {
+		return SUCCESS;
+	}
+
+	if (ctx->useDouble) {
+		len = count * sizeof(cl_double);
+		host = perturb->orbit;
+	} else {
+		cl_float *orbit;
+		size_t i;
+
+		len = count * sizeof(cl_float);
+		host = orbit = safe_emalloc(count, sizeof(cl_float), 0);
+		for (i = 0; i < count; i++) {
+			orbit[i] = (cl_float)perturb->orbit[i];
+		}
+	}
+
+	perturb->buffer = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+	                                 len, host, &err);
+	if (host != perturb->orbit) {
+		efree(host);
+	}
+	if (!perturb->buffer || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_perturb_release() */
+void clm_perturb_release(clm_perturb_t *perturb)
+{
+	if (perturb->buffer) {
+		clReleaseMemObject(perturb->buffer);
+	}
+	if (perturb->orbit) {
+		efree(perturb->orbit);
+	}
+	memset(perturb, 0, sizeof(clm_perturb_t));
+}
+/* }}} */
+
+/* {{{ clm_perturb_orbit()
+   Z(k+1) = Z(k)^2 + C in fixed point, with 64 bits more than the pixel
+   size needs; stored as doubles, which is all the offsets need */
+static int clm_perturb_orbit(clmandelbrot_t *ctx)
+{
+	clm_perturb_t *perturb = &ctx->perturb;
+	const int n = clm_mp_limbs(ctx->unit);
+	double bailout = MIN((double)ctx->bailout, CLM_REFERENCE_BAILOUT);
+	clm_mp_t zr = ctx->centerRe, zi = ctx->centerIm, rr, ii, ri;
+	double *orbit;
+	int k;
+
+	orbit = safe_emalloc((size_t)ctx->iterations + 1, 2 * sizeof(double), 0);
+	orbit[0] = 0.0;
+	orbit[1] = 0.0;
+	orbit[2] = clm_mp_to_double(&zr);
+	orbit[3] = clm_mp_to_double(&zi);
+
+	for (k = 1; k < ctx->iterations; k++) {
+		if (orbit[2 * k] * orbit[2 * k] + orbit[2 * k + 1] * orbit[2 * k + 1] > bailout) {
+			break;
+		}
+		clm_mp_mul(&rr, &zr, &zr, n);
+		clm_mp_mul(&ii, &zi, &zi, n);
+		clm_mp_mul(&ri, &zr, &zi, n);
+		clm_mp_sub(&zr, &rr, &ii, n);
+		clm_mp_add(&zr, &zr, &ctx->centerRe, n);
+		clm_mp_add(&zi, &ri, &ri, n);
+		clm_mp_add(&zi, &zi, &ctx->centerIm, n);
+		orbit[2 * k + 2] = clm_mp_to_double(&zr);
+		orbit[2 * k + 3] = clm_mp_to_double(&zi);
+	}
+
+	perturb->orbit = orbit;
+	perturb->length = k + 1;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_perturb_series()
+   the offset after k iterations is approximated by a u + b u^2 + c u^3,
+   where u is the pixel offset divided by the radius of the image, so that
+   the coefficients stay in range at any depth:
+     a' = 2 Z a + r,  b' = 2 Z b + a^2,  c' = 2 Z c + 2 a b
+   the approximation is kept while the cubic term is negligible and no
+   pixel can have escaped yet */
+static void clm_perturb_series(clmandelbrot_t *ctx)
+{
+	clm_perturb_t *perturb = &ctx->perturb;
+	const double *orbit = perturb->orbit;
+	double tolerance = ctx->useDouble ? CLM_SA_TOLERANCE_DOUBLE : CLM_SA_TOLERANCE_FLOAT;
+	double radius = ctx->unit * sqrt((double)ctx->width * ctx->width
+	                                 + (double)ctx->height * ctx->height) / 2.0;
+	double escape = sqrt((double)ctx->bailout);
+	double ar = radius, ai = 0.0, br = 0.0, bi = 0.0, cr = 0.0, ci = 0.0;
+	int k = 1;
+
+	perturb->scale = ctx->unit / radius;
+
+	while (ctx->series && k + 1 < perturb->length && k < ctx->iterations) {
+		double zr = orbit[2 * k], zi = orbit[2 * k + 1];
+		double nar = 2 * (zr * ar - zi * ai) + radius;
+		double nai = 2 * (zr * ai + zi * ar);
+		double nbr = 2 * (zr * br - zi * bi) + (ar * ar - ai * ai);
+		double nbi = 2 * (zr * bi + zi * br) + 2 * ar * ai;
+		double ncr = 2 * (zr * cr - zi * ci) + 2 * (ar * br - ai * bi);
+		double nci = 2 * (zr * ci + zi * cr) + 2 * (ar * bi + ai * br);
+		double a = hypot(nar, nai), b = hypot(nbr, nbi), c = hypot(ncr, nci);
+		double z = hypot(orbit[2 * k + 2], orbit[2 * k + 3]);
+
+		if (!(c <= tolerance * a) || !(z + a + b + c <= escape)) {
+			break;
+		}
+		ar = nar; ai = nai;
+		br = nbr; bi = nbi;
+		cr = ncr; ci = nci;
+		k++;
+	}
+
+	perturb->skip = k - 1;
+	perturb->coeffs[0] = ar;
+	perturb->coeffs[1] = ai;
+	perturb->coeffs[2] = br;
+	perturb->coeffs[3] = bi;
+	perturb->coeffs[4] = cr;
+	perturb->coeffs[5] = ci;
+}
+/* }}} */
+
+/* {{{ clm_mp_limbs()
+   limbs needed to resolve the pixel size with 64 bits to spare */
+static int clm_mp_limbs(double unit)
+{
+	int bits = (int)ceil(-log2(unit)) + 64;
+	int n = 2 + bits / 32;
+
+	return MIN(MAX(n, 3), CLM_MP_LIMBS);
+}
+/* }}} */
+
+/* {{{ clm_mp_cmp_abs() */
+static int clm_mp_cmp_abs(const clm_mp_t *a, const clm_mp_t *b, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (a->d[i] != b->d[i]) {
+			return a->d[i] < b->d[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+/* }}} */
+
+/* {{{ clm_mp_add()
+   r may be a or b */
+static void clm_mp_add(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n)
+{
+	const clm_mp_t *big = a, *small = b;
+	cl_ulong acc = 0;
+	int i, neg;
+
+	if (a->neg == b->neg) {
+		neg = a->neg;
+		for (i = n - 1; i >= 0; i--) {
+			acc += (cl_ulong)a->d[i] + b->d[i];
+			r->d[i] = (cl_uint)acc;
+			acc >>= 32;
+		}
+	} else {
+		if (clm_mp_cmp_abs(a, b, n) < 0) {
+			big = b;
+			small = a;
+		}
+		neg = big->neg;
+		for (i = n - 1; i >= 0; i--) {
+			cl_ulong sub = (cl_ulong)small->d[i] + acc;
+			acc = (big->d[i] < sub) ? 1 : 0;
+			r->d[i] = (cl_uint)(big->d[i] - sub);
+		}
+	}
+	r->neg = neg;
+}
+/* }}} */
+
+/* {{{ clm_mp_sub() */
+static void clm_mp_sub(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n)
+{
+	clm_mp_t nb = *b;
+
+	nb.neg = !b->neg;
+	clm_mp_add(r, a, &nb, n);
+}
+/* }}} */
+
+/* {{{ clm_mp_mul()
+   truncated product; limb i + j of the full product has the weight of
+   limb i times limb j */
+static void clm_mp_mul(clm_mp_t *r, const clm_mp_t *a, const clm_mp_t *b, int n)
+{
+	cl_uint t[2 * CLM_MP_LIMBS];
+	int i, j;
+
+	memset(t, 0, sizeof(cl_uint) * 2 * n);
+	for (i = n - 1; i >= 0; i--) {
+		cl_ulong carry = 0;
+		for (j = n - 1; j >= 0; j--) {
+			cl_ulong cur = (cl_ulong)a->d[i] * b->d[j] + t[i + j + 1] + carry;
+			t[i + j + 1] = (cl_uint)cur;
+			carry = cur >> 32;
+		}
+		t[i] = (cl_uint)carry;
+	}
+
+	/* t[0] only fills for products of 2^32 and more, which the reference
+	   bailout rules out */
+	memcpy(r->d, t + 1, sizeof(cl_uint) * n);
+	r->neg = a->neg != b->neg;
+}
+/* }}} */
+
+/* {{{ clm_mp_div_small() */
+static void clm_mp_div_small(clm_mp_t *x, cl_uint divisor, int n)
+{
+	cl_ulong rem = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		cl_ulong cur = (rem << 32) | x->d[i];
+		x->d[i] = (cl_uint)(cur / divisor);
+		rem = cur % divisor;
+	}
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,162 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+static const char *clm_prof_names[CLM_PROF_STAGES] = {
+	"devices", "context", "build", "reference", "render",
+	"kernel", "transfer", "draw", "total"
+};
+
+/* {{{ clm_prof_add()
+   adds to the time of a stage in the current call */
+void clm_prof_add(int stage, double seconds TSRMLS_DC)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	unsigned int bit = 1U << stage;
+
+	if (last->stageMask & bit) {
+		last->stages[stage] += seconds;
+	} else {
+		last->stages[stage] = seconds;
+		last->stageMask |= bit;
+	}
+}
+/* }}} */
+
+/* {{{ clm_prof_event()
+   adds the execution time of a completed command; commands that have not
+   completed, or queues without profiling, are silently skipped */
+void clm_prof_event(int stage, cl_event event TSRMLS_DC)
+{
+	cl_ulong begin = 0, end = 0;
+
+	if (!event
+		|| clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START,
+		                           sizeof(begin), &begin, NULL) != CL_SUCCESS
+		|| clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,
+		                           sizeof(end), &end, NULL) != CL_SUCCESS
+		|| end < begin
+	) {
+		return;
+	}
+	clm_prof_add(stage, (double)(end - begin) / 1e9 TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_prof_release() */
+void clm_prof_release(int stage, cl_event event TSRMLS_DC)
+{
+	if (event) {
+		clm_prof_event(stage, event TSRMLS_CC);
+		clReleaseEvent(event);
+	}
+}
+/* }}} */
+
+/* {{{ clm_prof_commit()
+   adds the stages timed by the current call to the histograms, each as
+   one sample; the times stay in the last render statistics */
+void clm_prof_commit(TSRMLS_D)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	int stage;
+
+	for (stage = 0; stage < CLM_PROF_STAGES; stage++) {
+		clm_prof_stage_t *prof = &CLMANDELBROT_G(prof)[stage];
+		double seconds = last->stages[stage];
+		double us = seconds * 1e6;
+		int bucket = 0;
+
+		if (!(last->stageMask & (1U << stage))) {
+			continue;
+		}
+		while (bucket < CLM_PROF_BUCKETS - 1 && us > (double)(1L << bucket)) {
+			bucket++;
+		}
+		if (prof->count == 0 || seconds < prof->min) {
+			prof->min = seconds;
+		}
+		if (seconds > prof->max) {
+			prof->max = seconds;
+		}
+		prof->count++;
+		prof->total += seconds;
+		prof->buckets[bucket]++;
+	}
+	last->stageMask = 0;
+}
+/* }}} */
+
+/* {{{ clm_prof_begin()
+   clears the statistics of the last render as a new one starts, keeping
+   the device enumeration when it ran while this render was set up */
+void clm_prof_begin(TSRMLS_D)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	const unsigned int bit = 1U << CLM_PROF_DEVICES;
+	double devices = last->stages[CLM_PROF_DEVICES];
+	int enumerated = (last->stageMask & bit) != 0;
+
+	memset(last, 0, sizeof(clm_last_t));
+	if (enumerated) {
+		last->stages[CLM_PROF_DEVICES] = devices;
+		last->stageMask = bit;
+	}
+}
+/* }}} */
+
+/* {{{ clm_prof_reset() */
+void clm_prof_reset(TSRMLS_D)
+{
+	memset(CLMANDELBROT_G(prof), 0, sizeof(CLMANDELBROT_G(prof)));
+}
+/* }}} */
+
+/* {{{ clm_prof_name() */
+const char *clm_prof_name(int stage)
+{
+	return clm_prof_names[stage];
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
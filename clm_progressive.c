@@ -0,0 +1,240 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+/* the first pass computes every CLM_PROGRESSIVE_STRIDE-th pixel of every
+   CLM_PROGRESSIVE_STRIDE-th row; each further pass halves the stride */
+#define CLM_PROGRESSIVE_STRIDE 8
+
+/* {{{ function prototypes */
+
+static int clm_progressive_launch(clmandelbrot_t *ctx, cl_command_queue queue, cl_kernel kernel,
+                                  cl_mem output, int stride, int refine TSRMLS_DC);
+static void clm_progressive_draw(clmandelbrot_t *ctx, int stride);
+static long clm_progressive_lattice(const clmandelbrot_t *ctx, int stride);
+
+/* }}} */
+
+/* {{{ clm_progressive()
+   renders in passes of decreasing stride into a buffer of its own, read
+   back into ctx->bitmap after each pass. Every pixel is computed by
+   exactly one pass, and each coarse pass is shown to the callback with
+   the computed pixels spread over their stride x stride block while the
+   device works on the next one. The callback may render on the same
+   device, which reuses or reallocates the shared output buffer, so the
+   passes keep out of it and hold their own reference to the queue. The
+   caller shows the complete image */
+int clm_progressive(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	size_t len = (size_t)ctx->width * ctx->height;
+	cl_command_queue queue = dev->queue;
+	cl_kernel kernel;
+	cl_mem output;
+	cl_int err = CL_SUCCESS;
+	int result = FAILURE;
+	int stride = CLM_PROGRESSIVE_STRIDE;
+
+	kernel = clCreateKernel(ctx->variant->program, "MandelbrotStride", &err);
+	if (!kernel || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+		return FAILURE;
+	}
+	output = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, len, NULL, &err);
+	if (!output || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		clReleaseKernel(kernel);
+		return FAILURE;
+	}
+	clRetainCommandQueue(queue);
+	if (!ctx->bitmap) {
+		ctx->bitmap = safe_emalloc(ctx->width, ctx->height, 0);
+	}
+
+	if (clm_progressive_launch(ctx, queue, kernel, output, stride, 0 TSRMLS_CC) == FAILURE) {
+		goto cleanup;
+	}
+	while (1) {
+		err = clEnqueueReadBuffer(queue, output, CL_TRUE, 0, len, ctx->bitmap,
+		                          0, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot read output buffer");
+			goto cleanup;
+		}
+		if (stride > 1) {
+			if (clm_progressive_launch(ctx, queue, kernel, output,
+			                           stride / 2, 1 TSRMLS_CC) == FAILURE) {
+				goto cleanup;
+			}
+			clFlush(queue);
+		}
+
+		clm_progressive_draw(ctx, stride);
+		if (stride == 1) {
+			break;
+		}
+		if (clm_progressive_notify(ctx, stride TSRMLS_CC) == FAILURE) {
+			goto cleanup;
+		}
+		if (!ctx->callback) {
+			/* refinement was declined; the pass already launched still counts */
+			clFinish(queue);
+			ctx->iterated = clm_progressive_lattice(ctx, stride / 2);
+			result = SUCCESS;
+			goto cleanup;
+		}
+		stride /= 2;
+	}
+
+	ctx->iterated = len;
+	result = SUCCESS;
+
+cleanup:
+	/* a pass may still be running when a launch or the callback failed */
+	clFinish(queue);
+	clReleaseMemObject(output);
+	clReleaseCommandQueue(queue);
+	clReleaseKernel(kernel);
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_progressive_notify()
+   calls the callback with the image and the stride of the pass; a
+   callback returning false clears ctx->callback to stop refining */
+int clm_progressive_notify(clmandelbrot_t *ctx, int stride TSRMLS_DC)
+{
+	zval *retval = NULL, *zstride, *params[2];
+	int result = SUCCESS;
+
+	if (!ctx->callback) {
+		return SUCCESS;
+	}
+
+	MAKE_STD_ZVAL(zstride);
+	ZVAL_LONG(zstride, stride);
+	MAKE_STD_ZVAL(retval);
+	params[0] = ctx->image;
+	params[1] = zstride;
+	if (call_user_function(EG(function_table), NULL, ctx->callback, retval,
+	                       2, params TSRMLS_CC) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot call the callback");
+		result = FAILURE;
+	} else if (Z_TYPE_P(retval) == IS_BOOL && !Z_BVAL_P(retval)) {
+		ctx->callback = NULL;
+	}
+	zval_ptr_dtor(&retval);
+	zval_ptr_dtor(&zstride);
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_progressive_launch() */
+static int clm_progressive_launch(clmandelbrot_t *ctx, cl_command_queue queue, cl_kernel kernel,
+                                  cl_mem output, int stride, int refine TSRMLS_DC)
+{
+	cl_int err = CL_SUCCESS;
+	size_t cols = (ctx->width + stride - 1) / stride;
+	size_t rows = (ctx->height + stride - 1) / stride;
+	size_t global;
+
+	/* a refining pass runs pairs of lattice rows without the points of the
+	   previous pass, i.e. cols / 2 + cols work items per pair */
+	if (refine) {
+		global = (rows + 1) / 2 * (cols / 2 + cols);
+	} else {
+		global = cols * rows;
+	}
+
+	err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+	err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+	err |= clSetKernelArg(kernel, 3, sizeof(stride), &stride);
+	err |= clSetKernelArg(kernel, 4, sizeof(refine), &refine);
+	err |= clm_set_real_arg(ctx, kernel, 5, &ctx->centerX, 1);
+	err |= clm_set_real_arg(ctx, kernel, 6, &ctx->centerY, 1);
+	err |= clm_set_real_arg(ctx, kernel, 7, &ctx->unit, 1);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+		return FAILURE;
+	}
+
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL,
+	                             0, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_progressive_draw()
+   fills each stride x stride block with the shade of its top left pixel */
+static void clm_progressive_draw(clmandelbrot_t *ctx, int stride)
+{
+	int x, y, c;
+
+	for (y = 0; y < ctx->height; y++) {
+		const unsigned char *src = ctx->bitmap + (size_t)(y - y % stride) * ctx->width;
+		int *row = ctx->pixels[y];
+
+		for (x = 0; x < ctx->width; x++) {
+			c = src[x - x % stride];
+			row[x] = (c << 16) | (c << 8) | c;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_progressive_lattice()
+   number of pixels computed once the pass with the given stride is done */
+static long clm_progressive_lattice(const clmandelbrot_t *ctx, int stride)
+{
+	return (long)((ctx->width + stride - 1) / stride) * ((ctx->height + stride - 1) / stride);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,564 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <ext/standard/md5.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define CLM_SHM_PAGE 4096
+#define CLM_SHM_MIN_SIZE (1024 * 1024)
+
+#define CLM_SHM_EMPTY 0
+#define CLM_SHM_USED 1
+#define CLM_SHM_DELETED 2
+
+/* {{{ type definitions */
+
+/* seq changes whenever the entry or its pages change and is odd while a
+   store writes them; values are never reused, so a lookup that sees the
+   same even seq before and after copying has read one consistent entry */
+typedef struct {
+	volatile unsigned long seq;
+	unsigned char key[CLM_SHM_KEY_SIZE];
+	int           state;
+	int           width;
+	int           height;
+	int           depth;     /* bytes per pixel */
+	int           precision;
+	unsigned int  first;
+	unsigned int  pages;
+	unsigned long lastUsed;
+} clm_shm_entry_t;
+
+typedef struct {
+	volatile pid_t   writer;     /* process storing an entry, or 0 */
+	unsigned long    sequence;
+	size_t           size;
+	unsigned int     numEntries; /* power of two */
+	unsigned int     numPages;
+	unsigned int     used;       /* entries in use */
+	unsigned int     deleted;    /* tombstones */
+	unsigned int     usedPages;
+	unsigned long    clock;
+	long             hits;
+	long             misses;
+	long             stores;
+	long             evictions;
+	clm_shm_entry_t  *entries;
+	unsigned char    *pageMap;
+	unsigned char    *pages;
+} clm_shm_t;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static int clm_shm_lock(void);
+static void clm_shm_unlock(void);
+static unsigned long clm_shm_stamp(void);
+static clm_shm_entry_t *clm_shm_find(const unsigned char *key);
+static clm_shm_entry_t *clm_shm_slot(clm_shm_entry_t *entries, unsigned int count,
+                                     const unsigned char *key);
+static void clm_shm_free(clm_shm_entry_t *entry);
+static int clm_shm_alloc(unsigned int pages);
+static int clm_shm_evict(void);
+static void clm_shm_rehash(void);
+static int clm_shm_depth(const clmandelbrot_t *ctx);
+
+/* }}} */
+
+/* the segment is mapped once in MINIT, so it is shared by every process
+   forked from the master afterwards (PHP-FPM and Apache prefork workers) */
+static clm_shm_t *clm_shm = NULL;
+
+/* {{{ clm_shm_startup()
+   maps a shared anonymous segment of the given size; a size of zero
+   leaves the cache disabled */
+int clm_shm_startup(long size)
+{
+	clm_shm_t *shm;
+	size_t header, entries, pages, count;
+	void *segment;
+
+	if (size <= 0) {
+		return SUCCESS;
+	}
+	if (size < CLM_SHM_MIN_SIZE) {
+		size = CLM_SHM_MIN_SIZE;
+	}
+
+	/* two entry slots per page keep the probe sequences short even when
+	   every entry is a single page */
+	pages = (size_t)size / CLM_SHM_PAGE;
+	for (count = 1; count < pages * 2; count <<= 1);
+	header = (sizeof(clm_shm_t) + 63) & ~(size_t)63;
+	entries = count * sizeof(clm_shm_entry_t);
+	pages = ((size_t)size - header - entries) / (CLM_SHM_PAGE + 1);
+
+	segment = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (segment == MAP_FAILED) {
+		return FAILURE;
+	}
+
+	shm = (clm_shm_t *)segment;
+	memset(shm, 0, header + entries + pages);
+	shm->size = (size_t)size;
+	shm->numEntries = (unsigned int)count;
+	shm->numPages = (unsigned int)pages;
+	shm->entries = (clm_shm_entry_t *)((char *)segment + header);
+	shm->pageMap = (unsigned char *)shm->entries + entries;
+	shm->pages = (unsigned char *)segment + (size_t)size - pages * CLM_SHM_PAGE;
+
+	clm_shm = shm;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_shm_shutdown() */
+void clm_shm_shutdown(void)
+{
+	if (clm_shm) {
+		munmap(clm_shm, clm_shm->size);
+		clm_shm = NULL;
+	}
+}
+/* }}} */
+
+/* {{{ clm_shm_key()
+   digests every parameter that changes the rendered pixels; the interior
+   check and the periodicity check only skip work, and a progressive
+   render ends with the pixels of a direct one, so they are left out */
+void clm_shm_key(const clmandelbrot_t *ctx, unsigned char *key)
+{
+	PHP_MD5_CTX md5;
+	int params[8];
+
+	params[0] = ctx->width;
+	params[1] = ctx->height;
+	params[2] = ctx->iterations;
+	params[3] = ctx->precision;
+	params[4] = ctx->series;
+	params[5] = (ctx->mode == CLM_MODE_SUBDIVIDE);
+	params[6] = ctx->samples;
+	params[7] = ctx->adaptive;
+
+	PHP_MD5Init(&md5);
+	PHP_MD5Update(&md5, (const unsigned char *)params, sizeof(params));
+	PHP_MD5Update(&md5, (const unsigned char *)&ctx->bailout, sizeof(ctx->bailout));
+	PHP_MD5Update(&md5, (const unsigned char *)&ctx->unit, sizeof(ctx->unit));
+	PHP_MD5Update(&md5, (const unsigned char *)&ctx->centerRe.neg, sizeof(int));
+	PHP_MD5Update(&md5, (const unsigned char *)ctx->centerRe.d, sizeof(ctx->centerRe.d));
+	PHP_MD5Update(&md5, (const unsigned char *)&ctx->centerIm.neg, sizeof(int));
+	PHP_MD5Update(&md5, (const unsigned char *)ctx->centerIm.d, sizeof(ctx->centerIm.d));
+	if (ctx->palette.count) {
+		PHP_MD5Update(&md5, (const unsigned char *)&ctx->palette.smooth, sizeof(ctx->palette.smooth));
+		PHP_MD5Update(&md5, ctx->palette.key, sizeof(ctx->palette.key));
+	}
+	PHP_MD5Final(key, &md5);
+}
+/* }}} */
+
+/* {{{ clm_shm_slot()
+   returns the slot holding key, or the slot where it would be inserted */
+static clm_shm_entry_t *clm_shm_slot(clm_shm_entry_t *entries, unsigned int count,
+                                     const unsigned char *key)
+{
+	clm_shm_entry_t *slot = NULL, *entry;
+	unsigned int mask = count - 1, i, n;
+
+	memcpy(&i, key, sizeof(i));
+	for (n = 0; n < count; n++, i++) {
+		entry = &entries[i & mask];
+		if (entry->state == CLM_SHM_EMPTY) {
+			return slot ? slot : entry;
+		}
+		if (entry->state == CLM_SHM_DELETED) {
+			if (!slot) {
+				slot = entry;
+			}
+		} else if (memcmp(entry->key, key, CLM_SHM_KEY_SIZE) == 0) {
+			return entry;
+		}
+	}
+
+	return slot;
+}
+/* }}} */
+
+/* {{{ clm_shm_find() */
+static clm_shm_entry_t *clm_shm_find(const unsigned char *key)
+{
+	clm_shm_entry_t *entry = clm_shm_slot(clm_shm->entries, clm_shm->numEntries, key);
+
+	if (entry && entry->state == CLM_SHM_USED) {
+		return entry;
+	}
+	return NULL;
+}
+/* }}} */
+
+/* {{{ clm_shm_fetch()
+   copies a cached image into ctx->pixels without taking any lock: the
+   entry is validated by its seq, so a store or an eviction running at the
+   same time turns the lookup into a miss, and a worker that dies or bails
+   out here leaves nothing behind */
+int clm_shm_fetch(const unsigned char *key, clmandelbrot_t *ctx)
+{
+	clm_shm_entry_t *entry, copy;
+	const unsigned char *data;
+	int depth = clm_shm_depth(ctx);
+	size_t length = (size_t)ctx->width * ctx->height * depth;
+	unsigned long seq = 1;
+	int x, y, c;
+
+	/* the histogram of an equalized render is not kept */
+	if (!clm_shm || ctx->equalize) {
+		return FAILURE;
+	}
+
+	entry = clm_shm_find(key);
+	if (entry) {
+		seq = entry->seq;
+		__sync_synchronize();
+		memcpy(&copy, entry, sizeof(copy));
+	}
+	if (!entry || (seq & 1) || copy.state != CLM_SHM_USED
+		|| memcmp(copy.key, key, CLM_SHM_KEY_SIZE) != 0
+		|| copy.width != ctx->width || copy.height != ctx->height || copy.depth != depth
+		|| copy.first >= clm_shm->numPages || copy.pages > clm_shm->numPages - copy.first
+		|| length > (size_t)copy.pages * CLM_SHM_PAGE
+	) {
+		__sync_fetch_and_add(&clm_shm->misses, 1);
+		return FAILURE;
+	}
+
+	data = clm_shm->pages + (size_t)copy.first * CLM_SHM_PAGE;
+	if (!ctx->pixels) {
+		memcpy(ctx->bitmap, data, length);
+	} else if (depth == sizeof(int)) {
+		for (y = 0; y < ctx->height; y++) {
+			memcpy(ctx->pixels[y], data, ctx->width * sizeof(int));
+			data += ctx->width * sizeof(int);
+		}
+	} else {
+		for (y = 0; y < ctx->height; y++) {
+			int *row = ctx->pixels[y];
+			for (x = 0; x < ctx->width; x++) {
+				c = *data++;
+				row[x] = (c << 16) | (c << 8) | c;
+			}
+		}
+	}
+
+	/* the pages may have been handed to another entry while copying */
+	__sync_synchronize();
+	if (entry->seq != seq) {
+		__sync_fetch_and_add(&clm_shm->misses, 1);
+		return FAILURE;
+	}
+
+	entry->lastUsed = __sync_add_and_fetch(&clm_shm->clock, 1);
+	ctx->precision = copy.precision;
+	__sync_fetch_and_add(&clm_shm->hits, 1);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_shm_store()
+   keeps the rendered image as one gray byte per pixel, or the whole
+   truecolor pixel when a palette coloured it, evicting the least
+   recently used entries until a long enough run of pages is free; the
+   store is skipped while another worker is storing */
+void clm_shm_store(const unsigned char *key, const clmandelbrot_t *ctx)
+{
+	clm_shm_entry_t *entry;
+	unsigned char *data;
+	int depth = clm_shm_depth(ctx);
+	size_t length = (size_t)ctx->width * ctx->height * depth;
+	unsigned int pages = (unsigned int)((length + CLM_SHM_PAGE - 1) / CLM_SHM_PAGE);
+	int first, x, y;
+
+	if (!clm_shm || ctx->equalize || pages == 0 || pages > clm_shm->numPages / 2) {
+		return;
+	}
+
+	/* a timeout must not unwind past the lock */
+	HANDLE_BLOCK_INTERRUPTIONS();
+	if (clm_shm_lock() == FAILURE) {
+		HANDLE_UNBLOCK_INTERRUPTIONS();
+		return;
+	}
+
+	/* another worker may have rendered the same view meanwhile; an entry
+	   left half written by a killed worker is replaced */
+	entry = clm_shm_find(key);
+	if (entry && !(entry->seq & 1)) {
+		goto done;
+	}
+	if (entry) {
+		clm_shm_free(entry);
+	}
+
+	if ((clm_shm->used + clm_shm->deleted + 1) * 4 > clm_shm->numEntries * 3) {
+		clm_shm_rehash();
+	}
+	entry = clm_shm_slot(clm_shm->entries, clm_shm->numEntries, key);
+	if (!entry) {
+		goto done;
+	}
+	while ((first = clm_shm_alloc(pages)) < 0) {
+		if (clm_shm_evict() == FAILURE) {
+			goto done;
+		}
+	}
+
+	entry->seq = clm_shm_stamp() | 1;
+	__sync_synchronize();
+
+	if (entry->state == CLM_SHM_DELETED) {
+		clm_shm->deleted--;
+	}
+	memcpy(entry->key, key, CLM_SHM_KEY_SIZE);
+	entry->state = CLM_SHM_USED;
+	entry->width = ctx->width;
+	entry->height = ctx->height;
+	entry->depth = depth;
+	entry->precision = ctx->precision;
+	entry->first = (unsigned int)first;
+	entry->pages = pages;
+	entry->lastUsed = __sync_add_and_fetch(&clm_shm->clock, 1);
+	memset(clm_shm->pageMap + first, 1, pages);
+	clm_shm->used++;
+	clm_shm->usedPages += pages;
+	clm_shm->stores++;
+
+	data = clm_shm->pages + (size_t)first * CLM_SHM_PAGE;
+	if (!ctx->pixels) {
+		memcpy(data, ctx->bitmap, length);
+	} else if (depth == sizeof(int)) {
+		for (y = 0; y < ctx->height; y++) {
+			memcpy(data, ctx->pixels[y], ctx->width * sizeof(int));
+			data += ctx->width * sizeof(int);
+		}
+	} else {
+		for (y = 0; y < ctx->height; y++) {
+			const int *row = ctx->pixels[y];
+			for (x = 0; x < ctx->width; x++) {
+				*data++ = (unsigned char)(row[x] & 0xff);
+			}
+		}
+	}
+
+	__sync_synchronize();
+	entry->seq = clm_shm_stamp();
+
+done:
+	clm_shm_unlock();
+	HANDLE_UNBLOCK_INTERRUPTIONS();
+}
+/* }}} */
+
+/* {{{ clm_shm_lock()
+   takes the store lock unless another live process holds it; the lock of
+   a worker that was killed while storing is taken over, so it can never
+   block the cache for good. An entry that worker left half written keeps
+   an odd seq, so lookups miss it until it is stored again or evicted */
+static int clm_shm_lock(void)
+{
+	pid_t self = getpid(), owner;
+
+	if (__sync_bool_compare_and_swap(&clm_shm->writer, 0, self)) {
+		__sync_synchronize();
+		return SUCCESS;
+	}
+	owner = clm_shm->writer;
+	if (owner != 0 && owner != self && kill(owner, 0) == -1 && errno == ESRCH
+		&& __sync_bool_compare_and_swap(&clm_shm->writer, owner, self)
+	) {
+		__sync_synchronize();
+		return SUCCESS;
+	}
+	return FAILURE;
+}
+/* }}} */
+
+/* {{{ clm_shm_unlock() */
+static void clm_shm_unlock(void)
+{
+	__sync_synchronize();
+	clm_shm->writer = 0;
+}
+/* }}} */
+
+/* {{{ clm_shm_stamp()
+   a new even seq; called with the store lock held */
+static unsigned long clm_shm_stamp(void)
+{
+	clm_shm->sequence += 2;
+	return clm_shm->sequence;
+}
+/* }}} */
+
+/* {{{ clm_shm_alloc()
+   first fit over the page map; returns the first page or -1 */
+static int clm_shm_alloc(unsigned int pages)
+{
+	const unsigned char *map = clm_shm->pageMap;
+	unsigned int i, run = 0;
+
+	for (i = 0; i < clm_shm->numPages; i++) {
+		if (map[i]) {
+			run = 0;
+		} else if (++run == pages) {
+			return (int)(i + 1 - pages);
+		}
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ clm_shm_free() */
+static void clm_shm_free(clm_shm_entry_t *entry)
+{
+	/* lookups copying the entry now miss, before its pages are reused */
+	entry->seq = clm_shm_stamp();
+	__sync_synchronize();
+	memset(clm_shm->pageMap + entry->first, 0, entry->pages);
+	clm_shm->usedPages -= entry->pages;
+	clm_shm->used--;
+	clm_shm->deleted++;
+	entry->state = CLM_SHM_DELETED;
+}
+/* }}} */
+
+/* {{{ clm_shm_evict()
+   drops the least recently used entry */
+static int clm_shm_evict(void)
+{
+	clm_shm_entry_t *entry, *oldest = NULL;
+	unsigned int i;
+
+	for (i = 0; i < clm_shm->numEntries; i++) {
+		entry = &clm_shm->entries[i];
+		if (entry->state == CLM_SHM_USED
+			&& (!oldest || entry->lastUsed < oldest->lastUsed)
+		) {
+			oldest = entry;
+		}
+	}
+	if (!oldest) {
+		return FAILURE;
+	}
+
+	clm_shm_free(oldest);
+	clm_shm->evictions++;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_shm_rehash()
+   reinserts the live entries to get rid of the tombstones; plain malloc()
+   because a bailout here would leave the store lock held. An entry keeps
+   its seq when it moves, and a lookup that was reading the slot it left
+   sees another seq there, or none */
+static void clm_shm_rehash(void)
+{
+	size_t size = clm_shm->numEntries * sizeof(clm_shm_entry_t);
+	clm_shm_entry_t *copy = malloc(size);
+	unsigned int i;
+
+	if (!copy) {
+		return;
+	}
+
+	memcpy(copy, clm_shm->entries, size);
+	memset(clm_shm->entries, 0, size);
+	for (i = 0; i < clm_shm->numEntries; i++) {
+		if (copy[i].state == CLM_SHM_USED) {
+			*clm_shm_slot(clm_shm->entries, clm_shm->numEntries, copy[i].key) = copy[i];
+		}
+	}
+	clm_shm->deleted = 0;
+	free(copy);
+}
+/* }}} */
+
+/* {{{ clm_shm_depth()
+   gray renders are rebuilt from their blue channel, palette renders are
+   not; the palette is part of the key, so both never share an entry */
+static int clm_shm_depth(const clmandelbrot_t *ctx)
+{
+	return ctx->palette.count ? (int)sizeof(int) : 1;
+}
+/* }}} */
+
+/* {{{ clm_shm_stats()
+   counters are read without the store lock; they are only informational */
+int clm_shm_stats(clm_shm_stats_t *stats)
+{
+	memset(stats, 0, sizeof(clm_shm_stats_t));
+	if (!clm_shm) {
+		return FAILURE;
+	}
+
+	stats->size = (long)clm_shm->size;
+	stats->entries = clm_shm->used;
+	stats->usedBytes = (long)clm_shm->usedPages * CLM_SHM_PAGE;
+	stats->freeBytes = (long)(clm_shm->numPages - clm_shm->usedPages) * CLM_SHM_PAGE;
+	stats->hits = clm_shm->hits;
+	stats->misses = clm_shm->misses;
+	stats->stores = clm_shm->stores;
+	stats->evictions = clm_shm->evictions;
+	return SUCCESS;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
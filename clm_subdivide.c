@@ -0,0 +1,323 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+/* tiles start at CLM_SUBDIVIDE_TILE pixels and are quartered down to
+   CLM_SUBDIVIDE_MIN; both must be powers of two */
+#define CLM_SUBDIVIDE_TILE 64
+#define CLM_SUBDIVIDE_MIN  8
+
+/* {{{ type definitions */
+
+enum {
+	CLM_STAGE_BORDER,
+	CLM_STAGE_CLASSIFY,
+	CLM_STAGE_FILL,
+	CLM_STAGE_ITERATE,
+	CLM_NUM_STAGES
+};
+
+/* tile lists: the current level, its quarters, uniform tiles and tiles to
+   iterate pixel by pixel */
+enum {
+	CLM_LIST_CURRENT,
+	CLM_LIST_NEXT,
+	CLM_LIST_UNIFORM,
+	CLM_LIST_ITERATE,
+	CLM_NUM_LISTS
+};
+
+/* }}} */
+
+/* {{{ globals */
+
+static const char *clm_stage_names[CLM_NUM_STAGES] = {
+	"MandelbrotBorderRGB",
+	"MandelbrotClassify",
+	"MandelbrotFill",
+	"MandelbrotTileRGB"
+};
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static int clm_subdivide_levels(clmandelbrot_t *ctx, cl_kernel *kernels, cl_mem *lists,
+                                cl_mem counts, cl_mem counters, int count TSRMLS_DC);
+static int clm_subdivide_launch(clmandelbrot_t *ctx, cl_kernel kernel, size_t global TSRMLS_DC);
+static cl_int clm_subdivide_set_view(clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index);
+
+/* }}} */
+
+/* {{{ clm_subdivide()
+   Mariani-Silver rendering into the device output buffer: the escape time
+   level sets are simply connected, so a tile whose border pixels share an
+   escape count has that count inside as well. Each level computes the
+   borders of its tiles, keeping their counts in a buffer of their own
+   since distinct counts can share a shade, and sorts the tiles on the
+   device into uniform ones, which
+   are filled, and the rest, which are quartered or, at the smallest size,
+   iterated. Only the list lengths come back to the host between levels */
+int clm_subdivide(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	cl_kernel kernels[CLM_NUM_STAGES] = { NULL };
+	cl_mem lists[CLM_NUM_LISTS] = { NULL };
+	cl_mem counts = NULL, counters = NULL;
+	size_t capacity, len;
+	cl_int err = CL_SUCCESS;
+	cl_int *top;
+	int count = 0;
+	int result = FAILURE;
+	int i, x, y;
+
+	for (i = 0; i < CLM_NUM_STAGES; i++) {
+		kernels[i] = clCreateKernel(ctx->variant->program, clm_stage_names[i], &err);
+		if (!kernels[i] || err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+			goto cleanup;
+		}
+	}
+
+	/* no list ever holds more tiles than the grid of the smallest ones */
+	capacity = (size_t)((ctx->width + CLM_SUBDIVIDE_MIN - 1) / CLM_SUBDIVIDE_MIN)
+	         * ((ctx->height + CLM_SUBDIVIDE_MIN - 1) / CLM_SUBDIVIDE_MIN);
+	len = 2 * sizeof(cl_int) * capacity;
+	for (i = 0; i < CLM_NUM_LISTS; i++) {
+		lists[i] = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, len, NULL, NULL);
+		if (!lists[i]) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+			goto cleanup;
+		}
+	}
+	counts = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+	                        sizeof(cl_int) * ctx->width * ctx->height, NULL, NULL);
+	counters = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, 4 * sizeof(cl_int), NULL, NULL);
+	if (!counts || !counters) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		goto cleanup;
+	}
+
+	top = safe_emalloc(capacity, 2 * sizeof(cl_int), 0);
+	for (y = 0; y < ctx->height; y += CLM_SUBDIVIDE_TILE) {
+		for (x = 0; x < ctx->width; x += CLM_SUBDIVIDE_TILE) {
+			top[2 * count] = x;
+			top[2 * count + 1] = y;
+			count++;
+		}
+	}
+	err = clEnqueueWriteBuffer(dev->queue, lists[CLM_LIST_CURRENT], CL_TRUE, 0,
+	                           2 * sizeof(cl_int) * count, top, 0, NULL, NULL);
+	efree(top);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue write buffer");
+		goto cleanup;
+	}
+
+	result = clm_subdivide_levels(ctx, kernels, lists, counts, counters, count TSRMLS_CC);
+
+cleanup:
+	if (counters) {
+		clReleaseMemObject(counters);
+	}
+	if (counts) {
+		clReleaseMemObject(counts);
+	}
+	for (i = 0; i < CLM_NUM_LISTS; i++) {
+		if (lists[i]) {
+			clReleaseMemObject(lists[i]);
+		}
+	}
+	for (i = 0; i < CLM_NUM_STAGES; i++) {
+		if (kernels[i]) {
+			clReleaseKernel(kernels[i]);
+		}
+	}
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_subdivide_levels()
+   runs the levels from the largest tiles down; ctx->iterated receives the
+   number of pixels that were actually iterated */
+static int clm_subdivide_levels(clmandelbrot_t *ctx, cl_kernel *kernels, cl_mem *lists,
+                                cl_mem counts, cl_mem counters, int count TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	static const cl_int zero[4] = { 0, 0, 0, 0 };
+	cl_int found[4];
+	cl_int err = CL_SUCCESS;
+	cl_int size = CLM_SUBDIVIDE_TILE;
+	cl_int parent = 0;
+	cl_int smallest = CLM_SUBDIVIDE_MIN;
+	cl_kernel kernel;
+	cl_mem swap;
+
+	ctx->iterated = 0;
+
+	while (count > 0) {
+		err = clEnqueueWriteBuffer(dev->queue, counters, CL_FALSE, 0, sizeof(zero), zero,
+		                           0, NULL, NULL);
+
+		kernel = kernels[CLM_STAGE_BORDER];
+		err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &dev->output);
+		err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &counts);
+		err |= clSetKernelArg(kernel, 2, sizeof(ctx->width), &ctx->width);
+		err |= clSetKernelArg(kernel, 3, sizeof(ctx->height), &ctx->height);
+		err |= clm_subdivide_set_view(ctx, kernel, 4);
+		err |= clSetKernelArg(kernel, 7, sizeof(cl_mem), &lists[CLM_LIST_CURRENT]);
+		err |= clSetKernelArg(kernel, 8, sizeof(size), &size);
+		err |= clSetKernelArg(kernel, 9, sizeof(parent), &parent);
+
+		kernel = kernels[CLM_STAGE_CLASSIFY];
+		err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &counts);
+		err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+		err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+		err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &lists[CLM_LIST_CURRENT]);
+		err |= clSetKernelArg(kernel, 4, sizeof(count), &count);
+		err |= clSetKernelArg(kernel, 5, sizeof(size), &size);
+		err |= clSetKernelArg(kernel, 6, sizeof(parent), &parent);
+		err |= clSetKernelArg(kernel, 7, sizeof(smallest), &smallest);
+		err |= clSetKernelArg(kernel, 8, sizeof(cl_mem), &lists[CLM_LIST_NEXT]);
+		err |= clSetKernelArg(kernel, 9, sizeof(cl_mem), &lists[CLM_LIST_UNIFORM]);
+		err |= clSetKernelArg(kernel, 10, sizeof(cl_mem), &lists[CLM_LIST_ITERATE]);
+		err |= clSetKernelArg(kernel, 11, sizeof(cl_mem), &counters);
+		if (err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+			return FAILURE;
+		}
+
+		if (clm_subdivide_launch(ctx, kernels[CLM_STAGE_BORDER],
+		                         (size_t)count * 4 * size TSRMLS_CC) == FAILURE
+			|| clm_subdivide_launch(ctx, kernels[CLM_STAGE_CLASSIFY],
+			                        (size_t)count TSRMLS_CC) == FAILURE
+		) {
+			return FAILURE;
+		}
+
+		/* the list lengths decide the size of the following launches */
+		err = clEnqueueReadBuffer(dev->queue, counters, CL_TRUE, 0, sizeof(found), found,
+		                          0, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot read tile counters");
+			return FAILURE;
+		}
+		ctx->iterated += found[3];
+
+		if (found[1] > 0) {
+			kernel = kernels[CLM_STAGE_FILL];
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dev->output);
+			err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+			err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+			err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &lists[CLM_LIST_UNIFORM]);
+			err |= clSetKernelArg(kernel, 4, sizeof(size), &size);
+			if (err != CL_SUCCESS) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+				return FAILURE;
+			}
+			if (clm_subdivide_launch(ctx, kernel, (size_t)found[1] * size * size TSRMLS_CC) == FAILURE) {
+				return FAILURE;
+			}
+		}
+
+		if (found[2] > 0) {
+			kernel = kernels[CLM_STAGE_ITERATE];
+			err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &dev->output);
+			err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+			err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+			err |= clm_subdivide_set_view(ctx, kernel, 3);
+			err |= clSetKernelArg(kernel, 6, sizeof(cl_mem), &lists[CLM_LIST_ITERATE]);
+			err |= clSetKernelArg(kernel, 7, sizeof(size), &size);
+			if (err != CL_SUCCESS) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+				return FAILURE;
+			}
+			if (clm_subdivide_launch(ctx, kernel, (size_t)found[2] * size * size TSRMLS_CC) == FAILURE) {
+				return FAILURE;
+			}
+		}
+
+		swap = lists[CLM_LIST_CURRENT];
+		lists[CLM_LIST_CURRENT] = lists[CLM_LIST_NEXT];
+		lists[CLM_LIST_NEXT] = swap;
+		count = found[0];
+		size /= 2;
+		parent = 1;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_subdivide_launch() */
+static int clm_subdivide_launch(clmandelbrot_t *ctx, cl_kernel kernel, size_t global TSRMLS_DC)
+{
+	cl_int err;
+
+	err = clEnqueueNDRangeKernel(ctx->dev->queue, kernel, 1, NULL, &global, NULL,
+	                             0, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_subdivide_set_view()
+   center and pixel size, in the precision of the variant */
+static cl_int clm_subdivide_set_view(clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index)
+{
+	cl_int err = CL_SUCCESS;
+
+	err |= clm_set_real_arg(ctx, kernel, index, &ctx->centerX, 1);
+	err |= clm_set_real_arg(ctx, kernel, index + 1, &ctx->centerY, 1);
+	err |= clm_set_real_arg(ctx, kernel, index + 2, &ctx->unit, 1);
+
+	return err;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
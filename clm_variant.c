@@ -0,0 +1,291 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+
+#include "mandelbrot_cl.h"
+
+/* {{{ function prototypes */
+
+static clm_variant_t *clm_variant_slot(clm_variants_t *cache);
+static int clm_variant_build(clm_variant_t *variant, cl_context context, cl_uint num_devices,
+                             const cl_device_id *devices TSRMLS_DC);
+static void clm_variant_release(clm_variant_t *variant);
+
+/* }}} */
+
+/* {{{ clm_variant_options()
+   the specialization parameters become preprocessor macros, so the kernel
+   loop bound and the bailout test are compile-time constants */
+void clm_variant_options(const clmandelbrot_t *ctx, char *buf, size_t size)
+{
+	char vector[32] = "", samples[48] = "", palette[40] = "";
+
+	if (ctx->vectorWidth > 1) {
+		snprintf(vector, sizeof(vector), " -D CLM_VECTOR=%d", ctx->vectorWidth);
+	}
+	if (ctx->samples > 1) {
+		snprintf(samples, sizeof(samples), " -D CLM_SAMPLES=%d%s",
+		         ctx->samples, ctx->adaptive ? " -D CLM_ADAPTIVE" : "");
+	}
+	if (ctx->palette.count) {
+		snprintf(palette, sizeof(palette), " -D CLM_PALETTE%s",
+		         ctx->palette.smooth ? " -D CLM_SMOOTH" : "");
+	}
+
+	/* %a prints the float exactly, which keeps the CPU renderer in step */
+	snprintf(buf, size, "-D CLM_ITERATIONS=%d -D CLM_BAILOUT=%af%s%s%s%s%s%s%s",
+	         ctx->iterations, (double)ctx->bailout,
+	         ctx->useDouble ? " -D CLM_DOUBLE" : "",
+	         ctx->interiorCheck ? " -D CLM_INTERIOR_CHECK" : "",
+	         ctx->periodicity ? " -D CLM_PERIODICITY" : "",
+	         vector, samples, palette,
+	         ctx->equalize ? " -D CLM_EQUALIZE" : "");
+}
+/* }}} */
+
+/* {{{ clm_variant_sampling()
+   perturbation and equalized renders are never antialiased; the adaptive
+   kernel needs the work groups of a 2D range, so subdivision and
+   progressive passes sample every pixel instead. Batches of map tiles
+   render adaptive tiles one by one */
+void clm_variant_sampling(clmandelbrot_t *ctx)
+{
+	if (ctx->precision == CLM_PRECISION_PERTURB || ctx->equalize) {
+		ctx->samples = 1;
+	}
+	if (ctx->samples < 2 || ctx->mode != CLM_MODE_DIRECT) {
+		ctx->adaptive = 0;
+	}
+}
+/* }}} */
+
+/* {{{ clm_variant_vector()
+   settles the number of pixels a work item of the direct kernel computes
+   at once; the widths given are the ones the device prefers, and tiled,
+   perturbation, antialiased, coloured and equalized renders always run
+   scalar kernels */
+void clm_variant_vector(clmandelbrot_t *ctx, int float_width, int double_width)
+{
+	if (ctx->tileCount || ctx->precision == CLM_PRECISION_PERTURB || ctx->samples > 1
+		|| ctx->palette.count || ctx->equalize
+	) {
+		ctx->vectorWidth = 1;
+	} else if (ctx->vectorWidth == 0) {
+		ctx->vectorWidth = ctx->useDouble ? double_width : float_width;
+	}
+}
+/* }}} */
+
+/* {{{ clm_variant_kernel() */
+const char *clm_variant_kernel(const clmandelbrot_t *ctx)
+{
+	if (ctx->tileCount) {
+		return "MandelbrotTileSetRGB";
+	}
+	if (ctx->precision == CLM_PRECISION_PERTURB) {
+		return "MandelbrotPerturbRGB";
+	}
+	if (ctx->adaptive) {
+		return "MandelbrotAdaptiveRGB";
+	}
+	return (ctx->vectorWidth > 1) ? "MandelbrotRGBVec" : "MandelbrotRGB";
+}
+/* }}} */
+
+/* {{{ clm_variant_get()
+   returns the kernel specialized for the given build options, building it
+   on first use; the least recently used variant makes room for new ones */
+clm_variant_t *clm_variant_get(clm_variants_t *cache, cl_context context,
+                               cl_uint num_devices, const cl_device_id *devices,
+                               const char *kernel, const char *options TSRMLS_DC)
+{
+	clm_variant_t *variant;
+	int i;
+
+	cache->clock++;
+
+	for (i = 0; i < cache->count; i++) {
+		variant = &cache->entries[i];
+		if (strcmp(variant->kernelName, kernel) == 0 && strcmp(variant->options, options) == 0) {
+			variant->hits++;
+			variant->lastUsed = cache->clock;
+			CLMANDELBROT_G(cacheHits)++;
+			return variant;
+		}
+	}
+
+	CLMANDELBROT_G(cacheMisses)++;
+
+	variant = clm_variant_slot(cache);
+	strlcpy(variant->kernelName, kernel, sizeof(variant->kernelName));
+	strlcpy(variant->options, options, sizeof(variant->options));
+	variant->lastUsed = cache->clock;
+
+	if (clm_variant_build(variant, context, num_devices, devices TSRMLS_CC) == FAILURE) {
+		clm_variant_release(variant);
+		cache->count--;
+		return NULL;
+	}
+
+	return variant;
+}
+/* }}} */
+
+/* {{{ clm_variant_release_all() */
+void clm_variant_release_all(clm_variants_t *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		clm_variant_release(&cache->entries[i]);
+	}
+	memset(cache, 0, sizeof(clm_variants_t));
+}
+/* }}} */
+
+/* {{{ clm_variant_slot()
+   a free entry at the end of the table, evicting the least recently used
+   variant when the table is full */
+static clm_variant_t *clm_variant_slot(clm_variants_t *cache)
+{
+	int i, victim = 0;
+
+	if (cache->count == CLM_MAX_VARIANTS) {
+		for (i = 1; i < cache->count; i++) {
+			if (cache->entries[i].lastUsed < cache->entries[victim].lastUsed) {
+				victim = i;
+			}
+		}
+		clm_variant_release(&cache->entries[victim]);
+		cache->count--;
+		if (victim != cache->count) {
+			cache->entries[victim] = cache->entries[cache->count];
+		}
+	}
+
+	memset(&cache->entries[cache->count], 0, sizeof(clm_variant_t));
+	return &cache->entries[cache->count++];
+}
+/* }}} */
+
+/* {{{ clm_variant_build() */
+static int clm_variant_build(clm_variant_t *variant, cl_context context, cl_uint num_devices,
+                             const cl_device_id *devices TSRMLS_DC)
+{
+	double start = clm_now();
+	cl_int err = CL_SUCCESS;
+	cl_uint i;
+
+	/* program binaries are cached on disk per device */
+	if (num_devices == 1) {
+		variant->program = clm_load_program_binary(context, devices[0], Mandelbrot_cl,
+		                                           variant->options TSRMLS_CC);
+		variant->fromBinary = (variant->program != NULL);
+	}
+
+	if (!variant->program) {
+		variant->program = clCreateProgramWithSource(context, 1, &Mandelbrot_cl, NULL, &err);
+		if (err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create program with source");
+			return FAILURE;
+		}
+
+		// compile
+		err = clBuildProgram(variant->program, num_devices, devices, variant->options, NULL, NULL);
+		if (err != CL_SUCCESS) {
+			size_t len;
+			char info[2048];
+
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "Error: Failed to build program executable");
+			clGetProgramBuildInfo(variant->program, devices[0],
+			                      CL_PROGRAM_BUILD_LOG, sizeof(info), info, &len);
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", info);
+			return FAILURE;
+		}
+
+		if (num_devices == 1) {
+			clm_save_program_binary(variant->program, devices[0], Mandelbrot_cl,
+			                        variant->options TSRMLS_CC);
+		}
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		variant->kernels[i] = clCreateKernel(variant->program, variant->kernelName, &err);
+		if (!variant->kernels[i] || err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+			return FAILURE;
+		}
+		variant->numDevices++;
+
+		err = clGetKernelWorkGroupInfo(variant->kernels[i], devices[i],
+		                               CL_KERNEL_WORK_GROUP_SIZE,
+		                               sizeof(size_t), &variant->workGroupSize[i], NULL);
+		if (err != CL_SUCCESS) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot get kernel work group info");
+			return FAILURE;
+		}
+		clm_tune_load(variant, i, devices[i] TSRMLS_CC);
+	}
+
+	variant->buildTime = clm_now() - start;
+	clm_prof_add(CLM_PROF_BUILD, variant->buildTime TSRMLS_CC);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_variant_release() */
+static void clm_variant_release(clm_variant_t *variant)
+{
+	cl_uint i;
+
+	for (i = 0; i < variant->numDevices; i++) {
+		clReleaseKernel(variant->kernels[i]);
+	}
+	if (variant->program) {
+		clReleaseProgram(variant->program);
+	}
+	memset(variant, 0, sizeof(clm_variant_t));
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,448 @@
+/*
+   +----------------------------------------------------------------------+
+   | All rights reserved                                                  |
+   |                                                                      |
+   | Redistribution and use in source and binary forms, with or without   |
+   | modification, are permitted provided that the following conditions   |
+   | are met:                                                             |
+   |                                                                      |
+   | 1. Redistributions of source code must retain the above copyright    |
+   |    notice, this list of conditions and the following disclaimer.     |
+   | 2. Redistributions in binary form must reproduce the above copyright |
+   |    notice, this list of conditions and the following disclaimer in   |
+   |    the documentation and/or other materials provided with the        |
+   |    distribution.                                                     |
+   | 3. The names of the authors may not be used to endorse or promote    |
+   |    products derived from this software without specific prior        |
+   |    written permission.                                               |
+   |                                                                      |
+   | THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS  |
+   | "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT    |
+   | LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS    |
+   | FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE       |
+   | COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,  |
+   | INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, |
+   | BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     |
+   | LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER     |
+   | CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT   |
+   | LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN    |
+   | ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE      |
+   | POSSIBILITY OF SUCH DAMAGE.                                          |
+   +----------------------------------------------------------------------+
+   | Authors: Ryusuke Sekiyama <rsky0711@gmail.com>                       |
+   +----------------------------------------------------------------------+
+*/
+
+#include "php_clmandelbrot.h"
+#include <math.h>
+
+/* {{{ type definitions */
+
+/* the pixels of one axis that a move keeps in view: count of them, from
+   first + i * to in the next frame and source + i * from in the last */
+typedef struct {
+	int count;
+	int first;
+	int to;
+	int source;
+	int from;
+} clm_span_t;
+
+/* }}} */
+
+/* {{{ function prototypes */
+
+static void clm_viewport_rebase(clm_viewport_t *vp);
+static void clm_viewport_span(const clm_viewport_t *vp, int n, int half, int last, int next,
+                              clm_span_t *span);
+static int clm_viewport_copy(clm_viewport_t *vp, cl_kernel kernel, cl_mem output, cl_mem input,
+                             const clm_span_t *sx, const clm_span_t *sy TSRMLS_DC);
+static int clm_viewport_compute(clm_viewport_t *vp, cl_kernel kernel, cl_mem output,
+                                int cols, int x0, int xStep, int xSkip,
+                                int rows, int y0, int yStep, int ySkip TSRMLS_DC);
+static int clm_viewport_rect(clm_viewport_t *vp, cl_kernel kernel, cl_mem output,
+                             int x0, int y0, int x1, int y1 TSRMLS_DC);
+static int clm_viewport_launch(clm_viewport_t *vp, cl_kernel kernel, size_t global TSRMLS_DC);
+static int clm_floor_div(int a, int b);
+
+/* }}} */
+
+/* {{{ clm_viewport_pan()
+   moves the view by dx pixels to the right and dy pixels down */
+void clm_viewport_pan(clm_viewport_t *vp, long dx, long dy)
+{
+	if (fabs((double)vp->offX + dx) > CLM_VIEWPORT_MAX_OFFSET
+		|| fabs((double)vp->offY + dy) > CLM_VIEWPORT_MAX_OFFSET
+	) {
+		vp->originX += ((double)vp->offX + dx) * vp->ctx.unit;
+		vp->originY -= ((double)vp->offY + dy) * vp->ctx.unit;
+		vp->offX = vp->offY = 0;
+		vp->move = CLM_VIEW_FULL;
+		return;
+	}
+
+	vp->offX += (int)dx;
+	vp->offY += (int)dy;
+	vp->move = CLM_VIEW_PAN;
+}
+/* }}} */
+
+/* {{{ clm_viewport_zoom()
+   divides the pixel size by ratio around the center of the view. Zooming
+   in by an integer ratio keeps the grid, whose every ratio-th pixel along
+   both axes is then one of the last frame; zooming out by one keeps the
+   grid points of every ratio-th pixel, and the center moves to the
+   nearest of them. Exact for powers of two; any other ratio, and either
+   zoom of an antialiased view, whose samples do not scale with the
+   pixels, renders afresh */
+void clm_viewport_zoom(clm_viewport_t *vp, double ratio)
+{
+	clmandelbrot_t *ctx = &vp->ctx;
+	double inverse = 1.0 / ratio;
+	int k;
+
+	if (ratio > 1.0 && ratio == floor(ratio) && ctx->samples < 2
+		&& fabs((double)vp->offX * ratio) <= CLM_VIEWPORT_MAX_OFFSET
+		&& fabs((double)vp->offY * ratio) <= CLM_VIEWPORT_MAX_OFFSET
+	) {
+		k = (int)ratio;
+		vp->offX *= k;
+		vp->offY *= k;
+		ctx->unit /= k;
+		vp->ratio = k;
+		vp->move = CLM_VIEW_ZOOM_IN;
+	} else if (ratio < 1.0 && fabs(floor(inverse + 0.5) * ratio - 1.0) < 1e-12
+		&& ctx->samples < 2
+	) {
+		k = (int)floor(inverse + 0.5);
+		vp->offX = clm_floor_div(vp->offX + k / 2, k);
+		vp->offY = clm_floor_div(vp->offY + k / 2, k);
+		ctx->unit *= k;
+		vp->ratio = k;
+		vp->move = CLM_VIEW_ZOOM_OUT;
+	} else if (ratio == 1.0) {
+		vp->move = CLM_VIEW_PAN;
+	} else {
+		clm_viewport_rebase(vp);
+		ctx->unit /= ratio;
+		vp->move = CLM_VIEW_FULL;
+	}
+}
+/* }}} */
+
+/* {{{ clm_viewport_render()
+   renders the view into the back frame, which becomes the front one: the
+   pixels the move keeps are copied from the last frame and the others
+   computed. ctx has been prepared for the view; frames of a released
+   context or of the other precision are not reused */
+int clm_viewport_render(clm_viewport_t *vp TSRMLS_DC)
+{
+	clmandelbrot_t *ctx = &vp->ctx;
+	clm_device_t *dev = ctx->dev;
+	size_t len = sizeof(cl_int) * ctx->width * ctx->height;
+	cl_kernel compute = NULL, copy = NULL;
+	cl_mem output, input;
+	clm_span_t sx, sy;
+	cl_int err = CL_SUCCESS;
+	int result = FAILURE;
+	int i;
+
+	if (vp->context != dev->context) {
+		clm_viewport_release(vp);
+	}
+	if (!vp->frames[0]) {
+		if (len > dev->maxAlloc) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "the viewport is too large for the device");
+			return FAILURE;
+		}
+		for (i = 0; i < 2; i++) {
+			vp->frames[i] = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, len, NULL, NULL);
+			if (!vp->frames[i]) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+				clm_viewport_release(vp);
+				return FAILURE;
+			}
+		}
+		vp->context = dev->context;
+	}
+	if (!vp->valid || vp->useDouble != ctx->useDouble) {
+		vp->move = CLM_VIEW_FULL;
+	}
+	if (vp->move == CLM_VIEW_FULL) {
+		/* around the center, so that the frame is that of clmandelbrot() */
+		clm_viewport_rebase(vp);
+	}
+
+	compute = clCreateKernel(ctx->variant->program, "MandelbrotViewportRGB", &err);
+	if (compute && err == CL_SUCCESS) {
+		copy = clCreateKernel(ctx->variant->program, "MandelbrotViewportCopy", &err);
+	}
+	if (!compute || !copy || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+		goto cleanup;
+	}
+
+	output = vp->frames[!vp->front];
+	input = vp->frames[vp->front];
+	ctx->iterated = 0;
+	vp->valid = 0;
+
+	clm_viewport_span(vp, ctx->width, ctx->width / 2, vp->frameX, vp->offX, &sx);
+	clm_viewport_span(vp, ctx->height, ctx->height - 1 - ctx->height / 2,
+	                  vp->frameY, vp->offY, &sy);
+	if (sx.count == 0 || sy.count == 0) {
+		if (clm_viewport_rect(vp, compute, output, 0, 0, ctx->width, ctx->height TSRMLS_CC) == FAILURE) {
+			goto cleanup;
+		}
+	} else if (vp->move == CLM_VIEW_ZOOM_IN) {
+		/* the rows between those kept, then the gaps of the rows kept */
+		if (clm_viewport_copy(vp, copy, output, input, &sx, &sy TSRMLS_CC) == FAILURE
+			|| clm_viewport_compute(vp, compute, output, ctx->width, 0, 1, 0,
+			                        ctx->height - sy.count, sy.first, sy.to, 1 TSRMLS_CC) == FAILURE
+			|| clm_viewport_compute(vp, compute, output, ctx->width - sx.count, sx.first, sx.to, 1,
+			                        sy.count, sy.first, sy.to, 0 TSRMLS_CC) == FAILURE
+		) {
+			goto cleanup;
+		}
+	} else {
+		/* the pixels kept form a rectangle; the bands above and below it,
+		   then the strips on its left and right */
+		int x1 = sx.first + sx.count;
+		int y1 = sy.first + sy.count;
+
+		if (clm_viewport_copy(vp, copy, output, input, &sx, &sy TSRMLS_CC) == FAILURE
+			|| clm_viewport_rect(vp, compute, output, 0, 0, ctx->width, sy.first TSRMLS_CC) == FAILURE
+			|| clm_viewport_rect(vp, compute, output, 0, y1, ctx->width, ctx->height TSRMLS_CC) == FAILURE
+			|| clm_viewport_rect(vp, compute, output, 0, sy.first, sx.first, y1 TSRMLS_CC) == FAILURE
+			|| clm_viewport_rect(vp, compute, output, x1, sy.first, ctx->width, y1 TSRMLS_CC) == FAILURE
+		) {
+			goto cleanup;
+		}
+	}
+
+	vp->front = !vp->front;
+	vp->frameX = vp->offX;
+	vp->frameY = vp->offY;
+	vp->useDouble = ctx->useDouble;
+	vp->valid = 1;
+	result = SUCCESS;
+
+cleanup:
+	if (copy) {
+		clReleaseKernel(copy);
+	}
+	if (compute) {
+		clReleaseKernel(compute);
+	}
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_viewport_draw()
+   copies the last frame into ctx->pixels */
+int clm_viewport_draw(clm_viewport_t *vp TSRMLS_DC)
+{
+	clmandelbrot_t *ctx = &vp->ctx;
+	clm_device_t *dev = ctx->dev;
+	size_t len = sizeof(cl_int) * ctx->width * ctx->height;
+	cl_mem frame = vp->frames[vp->front];
+	cl_event map = NULL;
+	cl_int err = CL_SUCCESS;
+	cl_int *rgb;
+
+	rgb = clEnqueueMapBuffer(dev->queue, frame, CL_TRUE, CL_MAP_READ,
+	                         0, len, 0, NULL, &map, &err);
+	if (!rgb || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot map output buffer");
+		return FAILURE;
+	}
+	clm_prof_release(CLM_PROF_TRANSFER, map TSRMLS_CC);
+
+	clm_draw(rgb, 0, ctx->height, ctx TSRMLS_CC);
+
+	clEnqueueUnmapMemObject(dev->queue, frame, rgb, 0, NULL, NULL);
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_viewport_release() */
+void clm_viewport_release(clm_viewport_t *vp)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (vp->frames[i]) {
+			clReleaseMemObject(vp->frames[i]);
+			vp->frames[i] = NULL;
+		}
+	}
+	vp->context = NULL;
+	vp->valid = 0;
+}
+/* }}} */
+
+/* {{{ clm_viewport_rebase()
+   moves the origin of the grid to the center of the view */
+static void clm_viewport_rebase(clm_viewport_t *vp)
+{
+	vp->originX += vp->offX * vp->ctx.unit;
+	vp->originY -= vp->offY * vp->ctx.unit;
+	vp->offX = vp->offY = 0;
+}
+/* }}} */
+
+/* {{{ clm_viewport_span()
+   the pixels of an axis of n pixels that the move keeps. Pixel p of a
+   frame with offset off is grid point p - half + off, and grid point g at
+   the last zoom is g * ratio after zooming in, g / ratio after zooming out */
+static void clm_viewport_span(const clm_viewport_t *vp, int n, int half, int last, int next,
+                              clm_span_t *span)
+{
+	int k = vp->ratio;
+	int c, hi;
+
+	memset(span, 0, sizeof(clm_span_t));
+	span->to = span->from = 1;
+
+	switch (vp->move) {
+		case CLM_VIEW_PAN:
+			if (abs(next - last) < n) {
+				span->first = MAX(0, last - next);
+				span->count = n - abs(next - last);
+				span->source = span->first + next - last;
+			}
+			break;
+
+		case CLM_VIEW_ZOOM_IN:
+			/* the pixels on grid points that are multiples of k */
+			span->first = ((half - next) % k + k) % k;
+			span->count = (span->first < n) ? (n - 1 - span->first) / k + 1 : 0;
+			span->source = (span->first - half + next) / k + half - last;
+			span->to = k;
+			break;
+
+		case CLM_VIEW_ZOOM_OUT:
+			/* pixel p of the next frame is pixel k * p + c of the last */
+			c = k * (next - half) + half - last;
+			span->first = MAX(0, -clm_floor_div(c, k));
+			hi = MIN(n - 1, clm_floor_div(n - 1 - c, k));
+			span->count = MAX(0, hi - span->first + 1);
+			span->source = k * span->first + c;
+			span->from = k;
+			break;
+	}
+}
+/* }}} */
+
+/* {{{ clm_viewport_copy() */
+static int clm_viewport_copy(clm_viewport_t *vp, cl_kernel kernel, cl_mem output, cl_mem input,
+                             const clm_span_t *sx, const clm_span_t *sy TSRMLS_DC)
+{
+	cl_int err = CL_SUCCESS;
+
+	err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &input);
+	err |= clSetKernelArg(kernel, 2, sizeof(vp->ctx.width), &vp->ctx.width);
+	err |= clSetKernelArg(kernel, 3, sizeof(sx->count), &sx->count);
+	err |= clSetKernelArg(kernel, 4, sizeof(sy->count), &sy->count);
+	err |= clSetKernelArg(kernel, 5, sizeof(sx->first), &sx->first);
+	err |= clSetKernelArg(kernel, 6, sizeof(sy->first), &sy->first);
+	err |= clSetKernelArg(kernel, 7, sizeof(sx->to), &sx->to);
+	err |= clSetKernelArg(kernel, 8, sizeof(sx->source), &sx->source);
+	err |= clSetKernelArg(kernel, 9, sizeof(sy->source), &sy->source);
+	err |= clSetKernelArg(kernel, 10, sizeof(sx->from), &sx->from);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+		return FAILURE;
+	}
+
+	return clm_viewport_launch(vp, kernel, (size_t)sx->count * sy->count TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_viewport_compute()
+   computes cols x rows pixels, placed as by MandelbrotViewportAxis */
+static int clm_viewport_compute(clm_viewport_t *vp, cl_kernel kernel, cl_mem output,
+                                int cols, int x0, int xStep, int xSkip,
+                                int rows, int y0, int yStep, int ySkip TSRMLS_DC)
+{
+	clmandelbrot_t *ctx = &vp->ctx;
+	cl_int err = CL_SUCCESS;
+	int py = -vp->offY;
+
+	if (cols <= 0 || rows <= 0) {
+		return SUCCESS;
+	}
+
+	err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+	err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+	err |= clSetKernelArg(kernel, 3, sizeof(vp->offX), &vp->offX);
+	err |= clSetKernelArg(kernel, 4, sizeof(py), &py);
+	err |= clm_set_real_arg(ctx, kernel, 5, &vp->originX, 1);
+	err |= clm_set_real_arg(ctx, kernel, 6, &vp->originY, 1);
+	err |= clm_set_real_arg(ctx, kernel, 7, &ctx->unit, 1);
+	err |= clSetKernelArg(kernel, 8, sizeof(cols), &cols);
+	err |= clSetKernelArg(kernel, 9, sizeof(rows), &rows);
+	err |= clSetKernelArg(kernel, 10, sizeof(x0), &x0);
+	err |= clSetKernelArg(kernel, 11, sizeof(xStep), &xStep);
+	err |= clSetKernelArg(kernel, 12, sizeof(xSkip), &xSkip);
+	err |= clSetKernelArg(kernel, 13, sizeof(y0), &y0);
+	err |= clSetKernelArg(kernel, 14, sizeof(yStep), &yStep);
+	err |= clSetKernelArg(kernel, 15, sizeof(ySkip), &ySkip);
+	err |= clm_palette_args(ctx, kernel, 16);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+		return FAILURE;
+	}
+
+	ctx->iterated += (long)cols * rows;
+	return clm_viewport_launch(vp, kernel, (size_t)cols * rows TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_viewport_rect()
+   computes the pixels x0 .. x1 - 1 of the rows y0 .. y1 - 1 */
+static int clm_viewport_rect(clm_viewport_t *vp, cl_kernel kernel, cl_mem output,
+                             int x0, int y0, int x1, int y1 TSRMLS_DC)
+{
+	return clm_viewport_compute(vp, kernel, output, x1 - x0, x0, 1, 0, y1 - y0, y0, 1, 0 TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_viewport_launch() */
+static int clm_viewport_launch(clm_viewport_t *vp, cl_kernel kernel, size_t global TSRMLS_DC)
+{
+	cl_int err;
+
+	if (global == 0) {
+		return SUCCESS;
+	}
+
+	err = clEnqueueNDRangeKernel(vp->ctx.dev->queue, kernel, 1, NULL, &global, NULL,
+	                             0, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_floor_div() */
+static int clm_floor_div(int a, int b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -34,34 +34,17 @@
 */
 
 #include "php_clmandelbrot.h"
-#ifdef HAVE_GD_BUNDLED
-#include <ext/gd/libgd/gd.h>
+#include <ext/standard/php_smart_str.h>
+#include <limits.h>
+#include <math.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
 #else
-#include <gd.h>
+#include <time.h>
 #endif
-#include <OpenCL/opencl.h>
-
-#define MAX_NUM_DEVICES 10
 
 /* {{{ type definitions */
 
-typedef struct {
-	cl_uint          deviceId;
-	cl_uint          deviceCount;
-	cl_device_id     deviceList[MAX_NUM_DEVICES];
-	cl_context       context;
-	cl_command_queue queue;
-	cl_program       program;
-	cl_kernel        kernel;
-	cl_mem           output;
-	int width;
-	int height;
-	float centerX;
-	float centerY;
-	float unit;
-	unsigned char *bitmap;
-} clmandelbrot_t;
-
 typedef enum {
 	PARAM_TYPE_BITFIELD = 0,
 	PARAM_TYPE_BOOL,
@@ -88,7 +71,10 @@ typedef struct {
 
 /* {{{ globals */
 
-#include "mandelbrot_cl.h"
+ZEND_DECLARE_MODULE_GLOBALS(clmandelbrot)
+
+static int le_clm_job;
+static int le_clm_viewport;
 
 static const device_info_param_t device_info_list[] = {
 	{ "type",                          CL_DEVICE_TYPE,                          PARAM_TYPE_BITFIELD  },
@@ -169,26 +155,92 @@ static const platform_info_param_t platform_info_list[] = {
 	{ NULL, 0 }
 };
 
+#define CLM_DEVICE_INFO_COUNT   (sizeof(device_info_list) / sizeof(device_info_list[0]) - 1)
+#define CLM_PLATFORM_INFO_COUNT (sizeof(platform_info_list) / sizeof(platform_info_list[0]) - 1)
+
 /* }}} */
 
 /* {{{ function prototypes */
 
+static PHP_MINIT_FUNCTION(clmandelbrot);
+static PHP_MSHUTDOWN_FUNCTION(clmandelbrot);
+static PHP_RSHUTDOWN_FUNCTION(clmandelbrot);
 static PHP_MINFO_FUNCTION(clmandelbrot);
 
 static PHP_FUNCTION(clmandelbrot);
 static PHP_FUNCTION(cl_get_devices);
-
-static zval *clm_get_device_info(cl_device_id device TSRMLS_DC);
-static zval *clm_get_platform_info(cl_platform_id device TSRMLS_DC);
-
+static PHP_FUNCTION(cl_refresh_devices);
+static PHP_FUNCTION(clmandelbrot_warmup);
+static PHP_FUNCTION(clmandelbrot_last_info);
+static PHP_FUNCTION(clmandelbrot_last_histogram);
+static PHP_FUNCTION(clmandelbrot_variants);
+static PHP_FUNCTION(clmandelbrot_submit);
+static PHP_FUNCTION(clmandelbrot_poll);
+static PHP_FUNCTION(clmandelbrot_wait);
+static PHP_FUNCTION(clmandelbrot_fetch);
+static PHP_FUNCTION(clmandelbrot_batch);
+static PHP_FUNCTION(clmandelbrot_tile);
+static PHP_FUNCTION(clmandelbrot_tiles);
+static PHP_FUNCTION(clmandelbrot_progressive);
+static PHP_FUNCTION(clmandelbrot_viewport);
+static PHP_FUNCTION(clmandelbrot_viewport_pan);
+static PHP_FUNCTION(clmandelbrot_viewport_zoom);
+static PHP_FUNCTION(clmandelbrot_viewport_image);
+static PHP_FUNCTION(clmandelbrot_viewport_view);
+static PHP_FUNCTION(clmandelbrot_raw);
+static PHP_FUNCTION(clmandelbrot_encode);
+static PHP_FUNCTION(clmandelbrot_stats);
+static PHP_FUNCTION(clmandelbrot_autotune);
+
+static zval *clm_get_device_info(const clm_device_snapshot_t *snapshot TSRMLS_DC);
+static zval *clm_get_platform_info(const clm_device_snapshot_t *snapshot TSRMLS_DC);
+static zval *clm_device_list(TSRMLS_D);
+static void clm_snapshot_device(clm_device_snapshot_t *snapshot, cl_device_id device);
+static void clm_snapshot_platform(clm_device_snapshot_t *snapshot, cl_platform_id platform);
+static void clm_release_snapshots(TSRMLS_D);
+static void clm_refresh_devices(TSRMLS_D);
+
+static void clm_init_globals(zend_clmandelbrot_globals *globals);
+static void clm_release_device(clm_device_t *dev);
+static void clm_release_cache(TSRMLS_D);
+static void clm_add_variants(zval *list, long device, const clm_variants_t *cache TSRMLS_DC);
+static zval *clm_tuning_zval(const clm_tuning_t *tuning);
+
+static int clm_parse_options(clmandelbrot_t *ctx, HashTable *options TSRMLS_DC);
+static int clm_prepare(clmandelbrot_t *ctx TSRMLS_DC);
+static zval *clm_create_image(long width, long height, gdImagePtr *im TSRMLS_DC);
+static int clm_init_context(clmandelbrot_t *ctx, int width, int height, double unit,
+                            long device, zval *zoptions TSRMLS_DC);
+static int clm_cache_fetch(clmandelbrot_t *ctx, unsigned char *key, double start TSRMLS_DC);
+static const char *clm_mode_name(int mode);
 static int clm_process(gdImagePtr im, clmandelbrot_t *ctx TSRMLS_DC);
+static int clm_render_bitmap(clmandelbrot_t *ctx, long width, long height, double unit,
+                             long device, zval *zoptions TSRMLS_DC);
+static int clm_submit(gdImagePtr im, clm_job_t *job TSRMLS_DC);
+static int clm_collect(clm_job_t *job TSRMLS_DC);
+static clm_job_t *clm_batch_submit(zval *zframe, long device, zval *zoptions TSRMLS_DC);
+static int clm_tile_check(long z, long x, long y TSRMLS_DC);
+static int clm_tile_size(zval *zoptions, long *size TSRMLS_DC);
+static int clm_encode_level(zval *zoptions, long *level TSRMLS_DC);
+static void clm_tile_view(clmandelbrot_t *ctx, long z, long x, long y);
+static int clm_process_tiles(clmandelbrot_t *ctxs, gdImagePtr *ims, int count TSRMLS_DC);
+static int clm_execute_tiles(clmandelbrot_t *base, clmandelbrot_t *ctxs, gdImagePtr *ims,
+                             int count TSRMLS_DC);
 static void clm_release(clmandelbrot_t *ctx TSRMLS_DC);
-static int clm_setup_device(clmandelbrot_t *ctx TSRMLS_DC);
+static void clm_job_dtor_ex(clm_job_t *job TSRMLS_DC);
+static void clm_job_dtor(zend_rsrc_list_entry *rsrc TSRMLS_DC);
+static int clm_viewport_process(clm_viewport_t *vp, gdImagePtr im TSRMLS_DC);
+static void clm_viewport_frame(clm_viewport_t *vp, int render, zval *return_value TSRMLS_DC);
+static void clm_viewport_dtor(zend_rsrc_list_entry *rsrc TSRMLS_DC);
 static int clm_check_device(clmandelbrot_t *ctx TSRMLS_DC);
-static int clm_setup_kernel(clmandelbrot_t *ctx TSRMLS_DC);
+static int clm_vector_width(cl_device_id device, cl_device_info param);
+static zend_bool clm_queue_has_offset(cl_command_queue queue);
+static int clm_setup_context(clmandelbrot_t *ctx TSRMLS_DC);
 static int clm_setup_queue(clmandelbrot_t *ctx TSRMLS_DC);
+static int clm_setup_tiles(clmandelbrot_t *ctx TSRMLS_DC);
+static int clm_setup_io_queue(clmandelbrot_t *ctx TSRMLS_DC);
 static int clm_execute(clmandelbrot_t *ctx TSRMLS_DC);
-static void clm_draw(gdImagePtr im, clmandelbrot_t *ctx TSRMLS_DC);
+static int clm_execute_tiled(clmandelbrot_t *ctx TSRMLS_DC);
 
 /* }}} */
 
@@ -199,6 +251,89 @@ ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALU
 	ZEND_ARG_INFO(0, height)
 	ZEND_ARG_INFO(0, unit)
 	ZEND_ARG_INFO(0, device)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_job_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, job)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_batch_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_ARRAY_INFO(0, frames, 0)
+	ZEND_ARG_INFO(0, callback)
+	ZEND_ARG_INFO(0, device)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_tile_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, z)
+	ZEND_ARG_INFO(0, x)
+	ZEND_ARG_INFO(0, y)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+	ZEND_ARG_INFO(0, device)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_tiles_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 5)
+	ZEND_ARG_INFO(0, z)
+	ZEND_ARG_INFO(0, x0)
+	ZEND_ARG_INFO(0, y0)
+	ZEND_ARG_INFO(0, x1)
+	ZEND_ARG_INFO(0, y1)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+	ZEND_ARG_INFO(0, device)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_progressive_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, width)
+	ZEND_ARG_INFO(0, height)
+	ZEND_ARG_INFO(0, callback)
+	ZEND_ARG_INFO(0, unit)
+	ZEND_ARG_INFO(0, device)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_viewport_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 1)
+	ZEND_ARG_INFO(0, viewport)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_viewport_pan_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, viewport)
+	ZEND_ARG_INFO(0, dx)
+	ZEND_ARG_INFO(0, dy)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_viewport_zoom_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 2)
+	ZEND_ARG_INFO(0, viewport)
+	ZEND_ARG_INFO(0, ratio)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_encode_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 3)
+	ZEND_ARG_INFO(0, format)
+	ZEND_ARG_INFO(0, width)
+	ZEND_ARG_INFO(0, height)
+	ZEND_ARG_INFO(0, unit)
+	ZEND_ARG_INFO(0, device)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_last_info_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_stats_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 0)
+	ZEND_ARG_INFO(0, reset)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_variants_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_warmup_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 0)
+	ZEND_ARG_INFO(0, device)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(clmandelbrot_autotune_arg_info, ZEND_SEND_BY_VAL, ZEND_RETURN_VALUE, 0)
+	ZEND_ARG_INFO(0, device)
+	ZEND_ARG_ARRAY_INFO(0, options, 1)
 ZEND_END_ARG_INFO()
 
 /* }}} */
@@ -207,6 +342,28 @@ ZEND_END_ARG_INFO()
 static zend_function_entry clmandelbrot_functions[] = {
 	PHP_FE(clmandelbrot, clmandelbrot_arg_info)
 	PHP_FE(cl_get_devices, NULL)
+	PHP_FE(cl_refresh_devices, NULL)
+	PHP_FE(clmandelbrot_warmup, clmandelbrot_warmup_arg_info)
+	PHP_FE(clmandelbrot_last_info, clmandelbrot_last_info_arg_info)
+	PHP_FE(clmandelbrot_last_histogram, clmandelbrot_last_info_arg_info)
+	PHP_FE(clmandelbrot_variants, clmandelbrot_variants_arg_info)
+	PHP_FE(clmandelbrot_submit, clmandelbrot_arg_info)
+	PHP_FE(clmandelbrot_poll, clmandelbrot_job_arg_info)
+	PHP_FE(clmandelbrot_wait, clmandelbrot_job_arg_info)
+	PHP_FE(clmandelbrot_fetch, clmandelbrot_job_arg_info)
+	PHP_FE(clmandelbrot_batch, clmandelbrot_batch_arg_info)
+	PHP_FE(clmandelbrot_tile, clmandelbrot_tile_arg_info)
+	PHP_FE(clmandelbrot_tiles, clmandelbrot_tiles_arg_info)
+	PHP_FE(clmandelbrot_progressive, clmandelbrot_progressive_arg_info)
+	PHP_FE(clmandelbrot_viewport, clmandelbrot_arg_info)
+	PHP_FE(clmandelbrot_viewport_pan, clmandelbrot_viewport_pan_arg_info)
+	PHP_FE(clmandelbrot_viewport_zoom, clmandelbrot_viewport_zoom_arg_info)
+	PHP_FE(clmandelbrot_viewport_image, clmandelbrot_viewport_arg_info)
+	PHP_FE(clmandelbrot_viewport_view, clmandelbrot_viewport_arg_info)
+	PHP_FE(clmandelbrot_raw, clmandelbrot_arg_info)
+	PHP_FE(clmandelbrot_encode, clmandelbrot_encode_arg_info)
+	PHP_FE(clmandelbrot_stats, clmandelbrot_stats_arg_info)
+	PHP_FE(clmandelbrot_autotune, clmandelbrot_autotune_arg_info)
 	{ NULL, NULL, NULL }
 };
 /* }}} */
@@ -228,10 +385,10 @@ zend_module_entry clmandelbrot_module_entry = {
 	clmandelbrot_deps,
 	"clmandelbrot",
 	clmandelbrot_functions,
+	PHP_MINIT(clmandelbrot),
+	PHP_MSHUTDOWN(clmandelbrot),
 	NULL,
-	NULL,
-	NULL,
-	NULL,
+	PHP_RSHUTDOWN(clmandelbrot),
 	PHP_MINFO(clmandelbrot),
 	PHP_CLMANDELBROT_VERSION,
 	STANDARD_MODULE_PROPERTIES
@@ -242,329 +399,2571 @@ zend_module_entry clmandelbrot_module_entry = {
 ZEND_GET_MODULE(clmandelbrot)
 #endif
 
+/* {{{ ini entries */
+PHP_INI_BEGIN()
+	STD_PHP_INI_ENTRY("clmandelbrot.cache_dir", "", PHP_INI_SYSTEM, OnUpdateString,
+	                  cacheDir, zend_clmandelbrot_globals, clmandelbrot_globals)
+	STD_PHP_INI_ENTRY("clmandelbrot.cpu_threads", "0", PHP_INI_ALL, OnUpdateLong,
+	                  cpuThreads, zend_clmandelbrot_globals, clmandelbrot_globals)
+	STD_PHP_INI_BOOLEAN("clmandelbrot.cpu_fallback", "1", PHP_INI_ALL, OnUpdateBool,
+	                  cpuFallback, zend_clmandelbrot_globals, clmandelbrot_globals)
+	STD_PHP_INI_ENTRY("clmandelbrot.tile_size", "0", PHP_INI_ALL, OnUpdateLong,
+	                  tileSize, zend_clmandelbrot_globals, clmandelbrot_globals)
+	STD_PHP_INI_ENTRY("clmandelbrot.shm_cache_size", "0", PHP_INI_SYSTEM, OnUpdateLong,
+	                  shmCacheSize, zend_clmandelbrot_globals, clmandelbrot_globals)
+	STD_PHP_INI_BOOLEAN("clmandelbrot.autotune", "0", PHP_INI_ALL, OnUpdateBool,
+	                  autotune, zend_clmandelbrot_globals, clmandelbrot_globals)
+PHP_INI_END()
+/* }}} */
+
+/* {{{ PHP_MINIT_FUNCTION */
+static PHP_MINIT_FUNCTION(clmandelbrot)
+{
+	ZEND_INIT_MODULE_GLOBALS(clmandelbrot, clm_init_globals, NULL);
+	REGISTER_INI_ENTRIES();
+	if (clm_shm_startup(CLMANDELBROT_G(shmCacheSize)) == FAILURE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot map %ld bytes for the shared render cache",
+		                 CLMANDELBROT_G(shmCacheSize));
+	}
+	le_clm_job = zend_register_list_destructors_ex(clm_job_dtor, NULL,
+	                                               "clmandelbrot render", module_number);
+	le_clm_viewport = zend_register_list_destructors_ex(clm_viewport_dtor, NULL,
+	                                                    "clmandelbrot viewport", module_number);
+	REGISTER_LONG_CONSTANT("CLMANDELBROT_DEVICE_CPU", CLM_DEVICE_CPU, CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("CLMANDELBROT_DEVICE_ALL", CLM_DEVICE_ALL, CONST_CS | CONST_PERSISTENT);
+	REGISTER_LONG_CONSTANT("CLMANDELBROT_BATCH_DEPTH", CLM_BATCH_DEPTH, CONST_CS | CONST_PERSISTENT);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ PHP_MSHUTDOWN_FUNCTION */
+static PHP_MSHUTDOWN_FUNCTION(clmandelbrot)
+{
+	clm_release_cache(TSRMLS_C);
+	clm_release_snapshots(TSRMLS_C);
+	clm_equalize_shutdown(TSRMLS_C);
+	clm_cpu_shutdown();
+	clm_shm_shutdown();
+	UNREGISTER_INI_ENTRIES();
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ PHP_RSHUTDOWN_FUNCTION */
+static PHP_RSHUTDOWN_FUNCTION(clmandelbrot)
+{
+	/* the arrays handed out are request memory; the snapshot stays */
+	if (CLMANDELBROT_G(deviceInfo)) {
+		zval_ptr_dtor(&CLMANDELBROT_G(deviceInfo));
+		CLMANDELBROT_G(deviceInfo) = NULL;
+	}
+	return SUCCESS;
+}
+/* }}} */
+
 /* {{{ PHP_MINFO_FUNCTION */
 static PHP_MINFO_FUNCTION(clmandelbrot)
 {
+	clm_shm_stats_t shm;
+	char buf[32];
+	int stage;
+
 	php_printf("PHP Matsuri 2011\n");
 	php_info_print_table_start();
 	php_info_print_table_row(2, "Version",PHP_CLMANDELBROT_VERSION " (alpha)");
 	php_info_print_table_row(2, "Released", "2011-10-16");
 	php_info_print_table_row(2, "Authors", "Ryusuke Sekiyama 'rsky0711@gmail.com' (lead)\n");
 	php_info_print_table_end();
+
+	php_info_print_table_start();
+	php_info_print_table_header(2, "Program cache", "");
+	snprintf(buf, sizeof(buf), "%ld", CLMANDELBROT_G(cacheHits));
+	php_info_print_table_row(2, "Hits", buf);
+	snprintf(buf, sizeof(buf), "%ld", CLMANDELBROT_G(cacheMisses));
+	php_info_print_table_row(2, "Misses", buf);
+	snprintf(buf, sizeof(buf), "%ld", CLMANDELBROT_G(binaryHits));
+	php_info_print_table_row(2, "Binaries loaded from disk", buf);
+	snprintf(buf, sizeof(buf), "%ld", CLMANDELBROT_G(binaryWrites));
+	php_info_print_table_row(2, "Binaries written to disk", buf);
+	php_info_print_table_end();
+
+	php_info_print_table_start();
+	php_info_print_table_header(2, "Shared render cache", "");
+	if (clm_shm_stats(&shm) == SUCCESS) {
+		snprintf(buf, sizeof(buf), "%ld", shm.size);
+		php_info_print_table_row(2, "Segment size", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.entries);
+		php_info_print_table_row(2, "Entries", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.usedBytes);
+		php_info_print_table_row(2, "Used bytes", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.freeBytes);
+		php_info_print_table_row(2, "Free bytes", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.hits);
+		php_info_print_table_row(2, "Hits", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.misses);
+		php_info_print_table_row(2, "Misses", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.stores);
+		php_info_print_table_row(2, "Stores", buf);
+		snprintf(buf, sizeof(buf), "%ld", shm.evictions);
+		php_info_print_table_row(2, "Evictions", buf);
+	} else {
+		php_info_print_table_row(2, "Status", "disabled");
+	}
+	php_info_print_table_end();
+
+	php_info_print_table_start();
+	php_info_print_table_header(5, "Stage", "Calls", "Mean (ms)", "Max (ms)", "Total (s)");
+	for (stage = 0; stage < CLM_PROF_STAGES; stage++) {
+		const clm_prof_stage_t *prof = &CLMANDELBROT_G(prof)[stage];
+		char calls[32], mean[32], max[32], total[32];
+
+		snprintf(calls, sizeof(calls), "%ld", prof->count);
+		snprintf(mean, sizeof(mean), "%.3f",
+		         prof->count ? prof->total * 1e3 / prof->count : 0.0);
+		snprintf(max, sizeof(max), "%.3f", prof->max * 1e3);
+		snprintf(total, sizeof(total), "%.3f", prof->total);
+		php_info_print_table_row(5, clm_prof_name(stage), calls, mean, max, total);
+	}
+	php_info_print_table_end();
+
+	php_info_print_table_start();
+	php_info_print_table_header(2, "CPU renderer", "");
+	php_info_print_table_row(2, "Instruction set", clm_cpu_isa());
+	php_info_print_table_end();
+
+	DISPLAY_INI_ENTRIES();
 }
 /* }}} */
 
-/* {{{ proto resource clmandelbrot(int width, int height[, float unit])
-   */
+/* {{{ proto resource clmandelbrot(int width, int height[, float unit[, int device[, array options]]])
+   device may be CLMANDELBROT_DEVICE_CPU to use the built-in CPU renderer,
+   or CLMANDELBROT_DEVICE_ALL to share the work among all OpenCL devices.
+   options: "iterations" (int) and "bailout" (escape radius, float); each
+   distinct combination is compiled into its own kernel variant once.
+   "center_x" and "center_y" may be numeric strings with any number of
+   digits; "precision" is one of "auto" (default), "float", "double" or
+   "perturbation", and "series" (default true) enables the series
+   approximation of perturbation renders. "interior_check" (default true)
+   skips points inside the main cardioid and the period-2 bulb, and
+   "periodicity" (default true) stops iterating orbits that have become
+   cyclic; neither changes the image. "mode" is "direct" (default) or
+   "subdivide", which fills tiles whose border escapes at a single count
+   without iterating them; it applies to single OpenCL devices without
+   perturbation and tiling, other renders fall back to "direct".
+   "vector_width" (4, 8 or 16) has a work item compute that many pixels at
+   once with vector types, 1 forces the scalar kernel and 0 (default) takes
+   the width the device prefers; the image is the same either way.
+   "antialias" (1 to 4, default 1) averages that many samples squared per
+   pixel, every pixel with "antialias_mode" "grid" (default) or only those
+   next to a pixel of another shade with "adaptive"; perturbation renders
+   are not antialiased.
+   "palette" is a list of 2 to 256 gd truecolor values the kernel colours
+   the image with, from the first for points escaping at once to the last
+   for points that never escape; "smooth" (default true) interpolates them
+   by the normalized iteration count. Shades returned without an image and
+   progressive passes cannot be coloured, and "subdivide" renders with a
+   palette fall back to "direct".
+   "equalize" colours by the rank of the escape count among all escaping
+   points of the image instead, computed on the device; such renders are
+   direct, not antialiased, and their histogram is returned by
+   clmandelbrot_last_histogram() */
 static PHP_FUNCTION(clmandelbrot)
 {
 	long width = 0;
 	long height = 0;
 	double unit = 0.0;
 	long device = 0;
-
-	zend_fcall_info fci;
-	zend_fcall_info_cache fcc;
-	zval *zim = NULL, *callable, *args, *zwidth, *zheight;
-	int err;
+	zval *zoptions = NULL;
+	zval *zim;
 	gdImagePtr im;
 
 	RETVAL_FALSE;
 
 	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
-			"ll|dl", &width, &height, &unit, &device) == FAILURE) {
-		return;
-	}
-
-	MAKE_STD_ZVAL(callable);
-	ZVAL_STRING(callable, "imagecreatetruecolor", 1);
-	err = zend_fcall_info_init(callable, 0, &fci, &fcc,
-	                           NULL, NULL TSRMLS_CC);
-
-	if (err != SUCCESS) {
-		zval_ptr_dtor(&callable);
+			"ll|dla!", &width, &height, &unit, &device, &zoptions) == FAILURE) {
 		return;
 	}
 
-	MAKE_STD_ZVAL(args);
-	MAKE_STD_ZVAL(zwidth);
-	MAKE_STD_ZVAL(zheight);
-	ZVAL_LONG(zwidth, width);
-	ZVAL_LONG(zheight, height);
-	array_init(args);
-	add_next_index_zval(args, zwidth);
-	add_next_index_zval(args, zheight);
-
-	zend_fcall_info_call(&fci, &fcc, &zim, args TSRMLS_CC);
-	zval_ptr_dtor(&callable);
-	zval_ptr_dtor(&args);
-
+	zim = clm_create_image(width, height, &im TSRMLS_CC);
 	if (!zim) {
 		return;
 	}
 
-	ZEND_FETCH_RESOURCE_NO_RETURN(im, gdImagePtr, &zim, -1,
-	                              "Image", phpi_get_le_gd());
 	if (im) {
-		size_t len;
 		clmandelbrot_t ctx = { 0 };
-		ctx.deviceId = (cl_uint)device;
-		ctx.width = gdImageSX(im);
-		ctx.height = gdImageSY(im);
-		if (unit > 0.0) {
-			ctx.unit = (float)unit;
-		} else {
-			ctx.unit = 10.0f / (float)(ctx.width + ctx.height);
-		}
-		len = ctx.width * ctx.height;
-		ctx.bitmap = ecalloc(len, sizeof(unsigned char));
-		if (!ctx.bitmap) {
-			php_error_docref(NULL TSRMLS_CC, E_WARNING,
-			                 "cannot allocate memory");
-		} else {
-			if (clm_process(im, &ctx TSRMLS_CC) == SUCCESS) {
-				RETVAL_ZVAL(zim, 1, 0);
-			}
+		if (clm_init_context(&ctx, gdImageSX(im), gdImageSY(im), unit, device,
+		                     zoptions TSRMLS_CC) == SUCCESS
+			&& clm_process(im, &ctx TSRMLS_CC) == SUCCESS
+		) {
+			RETVAL_ZVAL(zim, 1, 0);
 		}
-		clm_release(&ctx);
+		clm_release(&ctx TSRMLS_CC);
 	}
 	zval_ptr_dtor(&zim);
 }
 /* }}} clmandelbrot */
 
-/* {{{ proto array cl_get_devices(void)
-   */
-static PHP_FUNCTION(cl_get_devices)
+/* {{{ proto resource clmandelbrot_submit(int width, int height[, float unit[, int device[, array options]]])
+   starts a render like clmandelbrot() and returns without waiting for the
+   device; the image is collected with clmandelbrot_fetch(). CPU,
+   multi-device, tiled and subdivided renders complete before it returns */
+static PHP_FUNCTION(clmandelbrot_submit)
 {
-	clmandelbrot_t ctx = { 0 };
-	cl_uint i = 0;
+	long width = 0;
+	long height = 0;
+	double unit = 0.0;
+	long device = 0;
+	zval *zoptions = NULL;
+	clm_job_t *job;
+	gdImagePtr im;
 
 	RETVAL_FALSE;
 
-	if (ZEND_NUM_ARGS() != 0) {
-		WRONG_PARAM_COUNT;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"ll|dla!", &width, &height, &unit, &device, &zoptions) == FAILURE) {
+		return;
 	}
 
-	if (clm_setup_device(&ctx TSRMLS_CC) == FAILURE) {
+	job = ecalloc(1, sizeof(clm_job_t));
+	job->image = clm_create_image(width, height, &im TSRMLS_CC);
+	if (!job->image || !im
+		|| clm_init_context(&job->ctx, gdImageSX(im), gdImageSY(im), unit, device,
+		                    zoptions TSRMLS_CC) == FAILURE
+		|| clm_submit(im, job TSRMLS_CC) == FAILURE
+	) {
+		clm_job_dtor_ex(job TSRMLS_CC);
 		return;
 	}
 
-	array_init(return_value);
+	ZEND_REGISTER_RESOURCE(return_value, job, le_clm_job);
+}
+/* }}} clmandelbrot_submit */
+
+/* {{{ proto bool clmandelbrot_poll(resource job)
+   whether the image of a submitted render is ready */
+static PHP_FUNCTION(clmandelbrot_poll)
+{
+	zval *zjob = NULL;
+	clm_job_t *job;
+	cl_int status = CL_COMPLETE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zjob) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(job, clm_job_t *, &zjob, -1, "clmandelbrot render", le_clm_job);
 
-	for (i = 0; i < ctx.deviceCount; i++) {
-		zval *zinfo = clm_get_device_info(ctx.deviceList[i] TSRMLS_CC);
-		add_next_index_zval(return_value, zinfo);
+	if (job->event) {
+		clGetEventInfo(job->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+		               sizeof(status), &status, NULL);
 	}
+
+	/* a failed command has a negative status and counts as finished */
+	RETURN_BOOL(status <= CL_COMPLETE);
 }
-/* }}} cl_get_devices */
+/* }}} clmandelbrot_poll */
 
-/* {{{ clm_get_device_info() */
-static zval *clm_get_device_info(cl_device_id device TSRMLS_DC)
+/* {{{ proto bool clmandelbrot_wait(resource job)
+   blocks until a submitted render has finished; false if it failed */
+static PHP_FUNCTION(clmandelbrot_wait)
 {
-	const device_info_param_t *param = device_info_list;
-	cl_int err = CL_SUCCESS;
-	char buf[1024] = { 0 };
-	size_t len = 0;
-	cl_uint max_work_item_dimensions = 0;
-	zval *zinfo;
+	zval *zjob = NULL;
+	clm_job_t *job;
 
-	err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
-	                      sizeof(max_work_item_dimensions),
-	                      &max_work_item_dimensions, NULL);
-	if (err != CL_SUCCESS) {
-		max_work_item_dimensions = 0;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zjob) == FAILURE) {
+		return;
 	}
+	ZEND_FETCH_RESOURCE(job, clm_job_t *, &zjob, -1, "clmandelbrot render", le_clm_job);
 
-	MAKE_STD_ZVAL(zinfo);
-	array_init_size(zinfo, 64);
+	RETURN_BOOL(clm_collect(job TSRMLS_CC) == SUCCESS);
+}
+/* }}} clmandelbrot_wait */
 
-	while (param->key != NULL) {
-		switch (param->type) {
-			case PARAM_TYPE_BITFIELD: {
-				cl_bitfield val = 0;
-				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
-				if (err == CL_SUCCESS) {
-					long lval = (long)val;
-					add_assoc_long(zinfo, param->key, lval);
-				}
-			}
-			break;
+/* {{{ proto resource clmandelbrot_fetch(resource job)
+   waits for a submitted render and returns its image */
+static PHP_FUNCTION(clmandelbrot_fetch)
+{
+	zval *zjob = NULL;
+	clm_job_t *job;
 
-			case PARAM_TYPE_BOOL: {
-				cl_bool val = 0;
-				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
-				if (err == CL_SUCCESS) {
-					zend_bool bval = (zend_bool)val;
-					add_assoc_bool(zinfo, param->key, bval);
-				}
-			}
-			break;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zjob) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(job, clm_job_t *, &zjob, -1, "clmandelbrot render", le_clm_job);
 
-			case PARAM_TYPE_SIZE: {
-				size_t val = 0;
-				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
-				if (err == CL_SUCCESS) {
-					long lval = (long)val;
-					add_assoc_long(zinfo, param->key, lval);
-				}
-			}
-			break;
+	if (clm_collect(job TSRMLS_CC) == FAILURE) {
+		RETURN_FALSE;
+	}
+	RETURN_ZVAL(job->image, 1, 0);
+}
+/* }}} clmandelbrot_fetch */
+
+/* {{{ proto mixed clmandelbrot_batch(array frames[, callable callback[, int device[, array options]]])
+   renders a sequence of frames with CLMANDELBROT_BATCH_DEPTH of them in
+   flight, so the device computes the next frames while earlier ones are
+   read back and handed out. Each frame is an array with "width" and
+   "height", optionally "unit", and any option of clmandelbrot(), which
+   override the common options. Without a callback, the images are
+   returned in an array; otherwise callback(image, index) receives each
+   frame as it completes, the number of frames delivered is returned, and
+   a callback returning false stops the batch */
+static PHP_FUNCTION(clmandelbrot_batch)
+{
+	zval *zframes = NULL;
+	zval *zcallback = NULL;
+	long device = 0;
+	zval *zoptions = NULL;
+	clm_job_t *jobs[CLM_BATCH_DEPTH] = { NULL };
+	HashTable *frames;
+	HashPosition pos;
+	zval **zframe;
+	int count, submitted = 0, done = 0, result = SUCCESS;
+	int i;
 
-			case PARAM_TYPE_UINT: {
-				cl_uint val = 0;
-				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
-				if (err == CL_SUCCESS) {
-					long lval = (long)val;
-					add_assoc_long(zinfo, param->key, lval);
-				}
-			}
-			break;
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"a|z!la!", &zframes, &zcallback, &device, &zoptions) == FAILURE) {
+		return;
+	}
+	if (zcallback && !zend_is_callable(zcallback, 0, NULL TSRMLS_CC)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "callback is not callable");
+		RETURN_FALSE;
+	}
 
-			case PARAM_TYPE_ULONG: {
-				cl_ulong val = 0;
-				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
-				if (err == CL_SUCCESS) {
-					long lval = (long)val;
-					add_assoc_long(zinfo, param->key, lval);
-				}
-			}
-			break;
+	frames = Z_ARRVAL_P(zframes);
+	count = zend_hash_num_elements(frames);
+	if (!zcallback) {
+		array_init_size(return_value, count);
+	}
 
-			case PARAM_TYPE_STRING: {
-				err = clGetDeviceInfo(device, param->name, sizeof(buf), buf, &len);
-				if (err == CL_SUCCESS) {
-					add_assoc_stringl(zinfo, param->key, buf, len, 1);
-				}
+	zend_hash_internal_pointer_reset_ex(frames, &pos);
+	while (done < count) {
+		clm_job_t *job;
+
+		while (submitted < count && submitted - done < CLM_BATCH_DEPTH) {
+			zend_hash_get_current_data_ex(frames, (void **)&zframe, &pos);
+			zend_hash_move_forward_ex(frames, &pos);
+			job = clm_batch_submit(*zframe, device, zoptions TSRMLS_CC);
+			if (!job) {
+				result = FAILURE;
+				break;
 			}
+			jobs[submitted++ % CLM_BATCH_DEPTH] = job;
+		}
+		if (result == FAILURE) {
 			break;
+		}
 
-			case PARAM_TYPE_PLATFORM: {
-				cl_platform_id platform;
-				err = clGetDeviceInfo(device, param->name, sizeof(platform), &platform, NULL);
-				if (err == CL_SUCCESS) {
-					zval *pinfo = clm_get_platform_info(platform TSRMLS_CC);
-					add_assoc_zval(zinfo, param->key, pinfo);
-				}
-			}
+		job = jobs[done % CLM_BATCH_DEPTH];
+		if (clm_collect(job TSRMLS_CC) == FAILURE) {
+			result = FAILURE;
 			break;
+		}
 
-			case PARAM_TYPE_MAX_WORK_ITEM_SIZES: {
-				size_t siz = sizeof(size_t) * max_work_item_dimensions;
-				size_t *sizes = ecalloc(max_work_item_dimensions, sizeof(size_t));
-				if (!sizes) {
-					break;
-				}
-
-				err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, siz, sizes, NULL);
-				if (err == CL_SUCCESS) {
-					cl_uint i;
-					zval *zsizes;
-					MAKE_STD_ZVAL(zsizes);
-					array_init_size(zsizes, max_work_item_dimensions);
-					for (i = 0; i < max_work_item_dimensions; i++) {
-						long lval = (long)sizes[i];
-						add_next_index_long(zsizes, lval);
-					}
-					add_assoc_zval(zinfo, param->key, zsizes);
-				}
-
-				efree(sizes);
+		if (zcallback) {
+			zval *retval = NULL, *zindex, *params[2];
+			int stop;
+
+			MAKE_STD_ZVAL(zindex);
+			ZVAL_LONG(zindex, done);
+			MAKE_STD_ZVAL(retval);
+			params[0] = job->image;
+			params[1] = zindex;
+			if (call_user_function(EG(function_table), NULL, zcallback, retval,
+			                       2, params TSRMLS_CC) == FAILURE) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot call the callback");
+				result = FAILURE;
 			}
-			break;
+			stop = (Z_TYPE_P(retval) == IS_BOOL && !Z_BVAL_P(retval));
+			zval_ptr_dtor(&retval);
+			zval_ptr_dtor(&zindex);
+			if (result == FAILURE) {
+				break;
+			}
+			if (stop) {
+				done++;
+				break;
+			}
+		} else {
+			zval_add_ref(&job->image);
+			add_next_index_zval(return_value, job->image);
 		}
 
-		if (err != CL_SUCCESS) {
-			add_assoc_null(zinfo, param->key);
-		}
+		clm_job_dtor_ex(job TSRMLS_CC);
+		jobs[done++ % CLM_BATCH_DEPTH] = NULL;
+	}
 
-		param++;
+	/* frames still in flight when the batch stopped early */
+	for (i = 0; i < CLM_BATCH_DEPTH; i++) {
+		if (jobs[i]) {
+			clm_job_dtor_ex(jobs[i] TSRMLS_CC);
+		}
 	}
 
-	return zinfo;
+	if (result == FAILURE) {
+		if (!zcallback) {
+			zval_dtor(return_value);
+		}
+		RETURN_FALSE;
+	}
+	if (zcallback) {
+		RETURN_LONG(done);
+	}
 }
-/* }}} */
-
-/* {{{ clm_get_platform_info() */
-static zval *clm_get_platform_info(cl_platform_id platform TSRMLS_DC)
+/* }}} clmandelbrot_batch */
+
+/* {{{ proto resource clmandelbrot_progressive(int width, int height, callable callback[, float unit[, int device[, array options]]])
+   renders like clmandelbrot() in passes with a stride of 8, 4, 2 and 1
+   pixels, each computing only the pixels the earlier ones have not.
+   callback(image, stride) is called with the partial image after every
+   pass and returning false stops the refinement, in which case the
+   partial image is returned. Renders that cannot run in passes (CPU,
+   multi-device, tiled and perturbation renders) call it once, with a
+   stride of 1 */
+static PHP_FUNCTION(clmandelbrot_progressive)
 {
-	const platform_info_param_t *param = platform_info_list;
-	cl_int err = CL_SUCCESS;
-	char buf[1024] = { 0 };
-	size_t len = 0;
-	zval *zinfo;
+	long width = 0;
+	long height = 0;
+	zval *zcallback = NULL;
+	double unit = 0.0;
+	long device = 0;
+	zval *zoptions = NULL;
+	zval *zim;
+	gdImagePtr im;
 
-	MAKE_STD_ZVAL(zinfo);
-	array_init_size(zinfo, 8);
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"llz|dla!", &width, &height, &zcallback, &unit, &device, &zoptions) == FAILURE) {
+		return;
+	}
+	if (!zend_is_callable(zcallback, 0, NULL TSRMLS_CC)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "callback is not callable");
+		return;
+	}
+
+	zim = clm_create_image(width, height, &im TSRMLS_CC);
+	if (!zim) {
+		return;
+	}
+
+	if (im) {
+		clmandelbrot_t ctx = { 0 };
+		if (clm_init_context(&ctx, gdImageSX(im), gdImageSY(im), unit, device,
+		                     zoptions TSRMLS_CC) == SUCCESS) {
+			ctx.mode = CLM_MODE_PROGRESSIVE;
+			ctx.image = zim;
+			ctx.callback = zcallback;
+			if (clm_process(im, &ctx TSRMLS_CC) == SUCCESS
+				&& clm_progressive_notify(&ctx, 1 TSRMLS_CC) == SUCCESS
+			) {
+				RETVAL_ZVAL(zim, 1, 0);
+			}
+		}
+		clm_release(&ctx TSRMLS_CC);
+	}
+	zval_ptr_dtor(&zim);
+}
+/* }}} clmandelbrot_progressive */
+
+/* {{{ proto resource clmandelbrot_viewport(int width, int height[, float unit[, int device[, array options]]])
+   renders the first frame of a view on the device, which keeps it for
+   the moves of clmandelbrot_viewport_pan() and _zoom(); they compute only
+   the pixels they bring into view and copy the others on the device. The
+   options are those of clmandelbrot(), except that viewports render on
+   one OpenCL device in float or double precision, antialias every pixel
+   and do not equalize */
+static PHP_FUNCTION(clmandelbrot_viewport)
+{
+	long width = 0;
+	long height = 0;
+	double unit = 0.0;
+	long device = 0;
+	zval *zoptions = NULL;
+	clm_viewport_t *vp;
+	clmandelbrot_t *ctx;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"ll|dla!", &width, &height, &unit, &device, &zoptions) == FAILURE) {
+		return;
+	}
+	if (width <= 0 || height <= 0 || width > INT_MAX / height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid image dimensions");
+		return;
+	}
+
+	vp = ecalloc(1, sizeof(clm_viewport_t));
+	ctx = &vp->ctx;
+	if (clm_init_context(ctx, (int)width, (int)height, unit, device, zoptions TSRMLS_CC) == FAILURE) {
+		goto failure;
+	}
+	if (ctx->useCpu || ctx->useAll) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "viewports need a single OpenCL device");
+		goto failure;
+	}
+	if (ctx->precision == CLM_PRECISION_PERTURB) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "viewports render in float or double precision");
+		goto failure;
+	}
+	if (ctx->equalize) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "viewports cannot be equalized");
+		goto failure;
+	}
+	/* the adaptive kernel compares a pixel with its neighbours, which a
+	   strip computed on its own does not have */
+	ctx->mode = CLM_MODE_DIRECT;
+	ctx->adaptive = 0;
+	ctx->vectorWidth = 1;
+	vp->precision = ctx->precision;
+	vp->originX = ctx->centerX;
+	vp->originY = ctx->centerY;
+	vp->move = CLM_VIEW_FULL;
+
+	if (clm_viewport_process(vp, NULL TSRMLS_CC) == FAILURE) {
+		goto failure;
+	}
+	ZEND_REGISTER_RESOURCE(return_value, vp, le_clm_viewport);
+	return;
+
+failure:
+	clm_viewport_release(vp);
+	clm_release(ctx TSRMLS_CC);
+	efree(vp);
+}
+/* }}} clmandelbrot_viewport */
+
+/* {{{ proto resource clmandelbrot_viewport_pan(resource viewport, int dx, int dy)
+   moves the view by dx pixels to the right and dy pixels down and returns
+   its image; only the strips that come into view are computed */
+static PHP_FUNCTION(clmandelbrot_viewport_pan)
+{
+	zval *zvp = NULL;
+	long dx = 0, dy = 0;
+	clm_viewport_t *vp;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rll", &zvp, &dx, &dy) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(vp, clm_viewport_t *, &zvp, -1, "clmandelbrot viewport", le_clm_viewport);
+
+	clm_viewport_pan(vp, dx, dy);
+	clm_viewport_frame(vp, 1, return_value TSRMLS_CC);
+}
+/* }}} clmandelbrot_viewport_pan */
+
+/* {{{ proto resource clmandelbrot_viewport_zoom(resource viewport, float ratio)
+   divides the pixel size by ratio around the center of the view and
+   returns its image. Zooming in by an integer ratio keeps every ratio-th
+   pixel of both axes from the last frame, and zooming out by one, e.g.
+   0.5, keeps the last frame shrunk in the middle, with the center moved
+   by less than a pixel onto the grid of the last frame; other ratios, and
+   any zoom of an antialiased view, compute the whole frame */
+static PHP_FUNCTION(clmandelbrot_viewport_zoom)
+{
+	zval *zvp = NULL;
+	double ratio = 1.0;
+	clm_viewport_t *vp;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "rd", &zvp, &ratio) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(vp, clm_viewport_t *, &zvp, -1, "clmandelbrot viewport", le_clm_viewport);
+
+	if (!(ratio > 0.0) || vp->ctx.unit / ratio < CLM_MIN_UNIT) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "ratio must be positive and leave the unit at least %g", CLM_MIN_UNIT);
+		return;
+	}
+
+	clm_viewport_zoom(vp, ratio);
+	clm_viewport_frame(vp, 1, return_value TSRMLS_CC);
+}
+/* }}} clmandelbrot_viewport_zoom */
+
+/* {{{ proto resource clmandelbrot_viewport_image(resource viewport)
+   the image of the view, read back from the device without computing */
+static PHP_FUNCTION(clmandelbrot_viewport_image)
+{
+	zval *zvp = NULL;
+	clm_viewport_t *vp;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zvp) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(vp, clm_viewport_t *, &zvp, -1, "clmandelbrot viewport", le_clm_viewport);
+
+	/* a failed move, or a device released since, leaves no frame to read */
+	clm_viewport_frame(vp, !vp->valid || vp->context != vp->ctx.dev->context,
+	                   return_value TSRMLS_CC);
+}
+/* }}} clmandelbrot_viewport_image */
+
+/* {{{ proto array clmandelbrot_viewport_view(resource viewport)
+   the center and the pixel size of the view */
+static PHP_FUNCTION(clmandelbrot_viewport_view)
+{
+	zval *zvp = NULL;
+	clm_viewport_t *vp;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zvp) == FAILURE) {
+		return;
+	}
+	ZEND_FETCH_RESOURCE(vp, clm_viewport_t *, &zvp, -1, "clmandelbrot viewport", le_clm_viewport);
+
+	array_init_size(return_value, 3);
+	add_assoc_double(return_value, "center_x", vp->originX + vp->offX * vp->ctx.unit);
+	add_assoc_double(return_value, "center_y", vp->originY - vp->offY * vp->ctx.unit);
+	add_assoc_double(return_value, "unit", vp->ctx.unit);
+}
+/* }}} clmandelbrot_viewport_view */
+
+/* {{{ proto string clmandelbrot_raw(int width, int height[, float unit[, int device[, array options]]])
+   renders like clmandelbrot() without a gd image and returns the shades,
+   one byte per pixel row by row from the top, as a binary string */
+static PHP_FUNCTION(clmandelbrot_raw)
+{
+	long width = 0;
+	long height = 0;
+	double unit = 0.0;
+	long device = 0;
+	zval *zoptions = NULL;
+	clmandelbrot_t ctx = { 0 };
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"ll|dla!", &width, &height, &unit, &device, &zoptions) == FAILURE) {
+		return;
+	}
+
+	if (clm_render_bitmap(&ctx, width, height, unit, device, zoptions TSRMLS_CC) == SUCCESS) {
+		/* the string adopts the buffer */
+		RETVAL_STRINGL((char *)ctx.bitmap, ctx.width * ctx.height, 0);
+		ctx.bitmap = NULL;
+	}
+	clm_release(&ctx TSRMLS_CC);
+}
+/* }}} clmandelbrot_raw */
+
+/* {{{ proto mixed clmandelbrot_encode(string format, int width, int height[, float unit[, int device[, array options[, resource stream]]]])
+   renders like clmandelbrot() and encodes the shades as "png" (8-bit
+   grayscale), "pgm" or "ppm" without a gd image. The "compression" option
+   (0-9, default 1) is the zlib level of PNG output, 0 writing stored
+   blocks only. Returns the encoded bytes, or the number of bytes written
+   when a stream is given */
+static PHP_FUNCTION(clmandelbrot_encode)
+{
+	char *name = NULL;
+	int name_len = 0;
+	long width = 0;
+	long height = 0;
+	double unit = 0.0;
+	long device = 0;
+	zval *zoptions = NULL;
+	zval *zstream = NULL;
+	php_stream *stream = NULL;
+	long level = CLM_DEFAULT_COMPRESSION;
+	clmandelbrot_t ctx = { 0 };
+	int format;
+	long written;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "sll|dla!r", &name, &name_len,
+			&width, &height, &unit, &device, &zoptions, &zstream) == FAILURE) {
+		return;
+	}
+
+	format = clm_encode_format(name);
+	if (format < 0) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown format '%s'", name);
+		return;
+	}
+	if (clm_encode_level(zoptions, &level TSRMLS_CC) == FAILURE) {
+		return;
+	}
+	if (zstream) {
+		php_stream_from_zval(stream, &zstream);
+	}
 
-	while (param->key != NULL) {
-		err = clGetPlatformInfo(platform, param->name, sizeof(buf), buf, &len);
-		if (err == CL_SUCCESS) {
-			add_assoc_stringl(zinfo, param->key, buf, len, 1);
+	if (clm_render_bitmap(&ctx, width, height, unit, device, zoptions TSRMLS_CC) == SUCCESS) {
+		if (stream) {
+			written = clm_encode(format, (int)level, ctx.bitmap, ctx.width, ctx.height,
+			                     stream, NULL TSRMLS_CC);
+			if (written >= 0) {
+				RETVAL_LONG(written);
+			}
 		} else {
-			add_assoc_null(zinfo, param->key);
+			smart_str out = { 0 };
+
+			written = clm_encode(format, (int)level, ctx.bitmap, ctx.width, ctx.height,
+			                     NULL, &out TSRMLS_CC);
+			if (written >= 0) {
+				smart_str_0(&out);
+				RETVAL_STRINGL(out.c, out.len, 0);
+			} else {
+				smart_str_free(&out);
+			}
+		}
+	}
+	clm_release(&ctx TSRMLS_CC);
+}
+/* }}} clmandelbrot_encode */
+
+/* {{{ proto resource clmandelbrot_tile(int z, int x, int y[, array options[, int device]])
+   renders tile x, y of zoom level z of a slippy map, with y growing
+   downwards; the "size" option (default 256) sets the tile size in pixels
+   and the other options are those of clmandelbrot() */
+static PHP_FUNCTION(clmandelbrot_tile)
+{
+	long z = 0, x = 0, y = 0;
+	zval *zoptions = NULL;
+	long device = 0;
+	long size = CLM_MAP_TILE_SIZE;
+	zval *zim;
+	gdImagePtr im;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"lll|a!l", &z, &x, &y, &zoptions, &device) == FAILURE) {
+		return;
+	}
+	if (clm_tile_check(z, x, y TSRMLS_CC) == FAILURE
+		|| clm_tile_size(zoptions, &size TSRMLS_CC) == FAILURE
+	) {
+		return;
+	}
+
+	zim = clm_create_image(size, size, &im TSRMLS_CC);
+	if (!zim) {
+		return;
+	}
+
+	if (im) {
+		clmandelbrot_t ctx = { 0 };
+		if (clm_init_context(&ctx, gdImageSX(im), gdImageSY(im), 0.0, device,
+		                     zoptions TSRMLS_CC) == SUCCESS) {
+			clm_tile_view(&ctx, z, x, y);
+			if (clm_process(im, &ctx TSRMLS_CC) == SUCCESS) {
+				RETVAL_ZVAL(zim, 1, 0);
+			}
+		}
+		clm_release(&ctx TSRMLS_CC);
+	}
+	zval_ptr_dtor(&zim);
+}
+/* }}} clmandelbrot_tile */
+
+/* {{{ proto array clmandelbrot_tiles(int z, int x0, int y0, int x1, int y1[, array options[, int device]])
+   renders the tiles x0 .. x1, y0 .. y1 of zoom level z, such as those of
+   one viewport, in a single launch; returns the images indexed by y, then
+   x. Each tile is identical to its clmandelbrot_tile() render */
+static PHP_FUNCTION(clmandelbrot_tiles)
+{
+	long z = 0, x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+	zval *zoptions = NULL;
+	long device = 0;
+	long size = CLM_MAP_TILE_SIZE;
+	clmandelbrot_t *ctxs;
+	gdImagePtr *ims;
+	zval **zims;
+	int cols, rows, count, i;
+	int result = SUCCESS;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC,
+			"lllll|a!l", &z, &x0, &y0, &x1, &y1, &zoptions, &device) == FAILURE) {
+		return;
+	}
+	if (clm_tile_check(z, x0, y0 TSRMLS_CC) == FAILURE
+		|| clm_tile_check(z, x1, y1 TSRMLS_CC) == FAILURE
+		|| clm_tile_size(zoptions, &size TSRMLS_CC) == FAILURE
+	) {
+		return;
+	}
+	/* the spans are bounded one by one first, so the product cannot overflow */
+	if (x1 < x0 || y1 < y0
+		|| x1 - x0 >= CLM_MAP_MAX_TILES || y1 - y0 >= CLM_MAP_MAX_TILES
+		|| (x1 - x0 + 1) * (y1 - y0 + 1) > CLM_MAP_MAX_TILES
+	) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "the range must have between 1 and %d tiles", CLM_MAP_MAX_TILES);
+		return;
+	}
+
+	cols = (int)(x1 - x0 + 1);
+	rows = (int)(y1 - y0 + 1);
+	count = cols * rows;
+	if (count <= 0) {
+		return;
+	}
+	ctxs = ecalloc(count, sizeof(clmandelbrot_t));
+	ims = ecalloc(count, sizeof(gdImagePtr));
+	zims = ecalloc(count, sizeof(zval *));
+
+	for (i = 0; i < count && result == SUCCESS; i++) {
+		zims[i] = clm_create_image(size, size, &ims[i] TSRMLS_CC);
+		if (!zims[i] || !ims[i]
+			|| clm_init_context(&ctxs[i], gdImageSX(ims[i]), gdImageSY(ims[i]), 0.0, device,
+			                    zoptions TSRMLS_CC) == FAILURE
+		) {
+			result = FAILURE;
+			break;
+		}
+		clm_tile_view(&ctxs[i], z, x0 + i % cols, y0 + i / cols);
+	}
+
+	if (result == SUCCESS && clm_process_tiles(ctxs, ims, count TSRMLS_CC) == SUCCESS) {
+		zval *row = NULL;
+
+		array_init_size(return_value, rows);
+		for (i = 0; i < count; i++) {
+			if (i % cols == 0) {
+				MAKE_STD_ZVAL(row);
+				array_init_size(row, cols);
+				add_index_zval(return_value, y0 + i / cols, row);
+			}
+			add_index_zval(row, x0 + i % cols, zims[i]);
+			zims[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		clm_release(&ctxs[i] TSRMLS_CC);
+		if (zims[i]) {
+			zval_ptr_dtor(&zims[i]);
+		}
+	}
+	efree(zims);
+	efree(ims);
+	efree(ctxs);
+}
+/* }}} clmandelbrot_tiles */
+
+/* {{{ proto array cl_get_devices(void)
+   the info of every device, read from the drivers once per process; the
+   arrays of one request are shared between the calls */
+static PHP_FUNCTION(cl_get_devices)
+{
+	zval *zlist;
+
+	RETVAL_FALSE;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	zlist = clm_device_list(TSRMLS_C);
+	if (zlist) {
+		RETURN_ZVAL(zlist, 1, 0);
+	}
+}
+/* }}} cl_get_devices */
+
+/* {{{ proto array cl_refresh_devices(void)
+   enumerates the devices again, reads their info afresh and returns it
+   like cl_get_devices() */
+static PHP_FUNCTION(cl_refresh_devices)
+{
+	zval *zlist;
+
+	RETVAL_FALSE;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	clm_refresh_devices(TSRMLS_C);
+	zlist = clm_device_list(TSRMLS_C);
+	if (zlist) {
+		RETURN_ZVAL(zlist, 1, 0);
+	}
+}
+/* }}} cl_refresh_devices */
+
+/* {{{ proto array clmandelbrot_last_info(void)
+   describes how the last clmandelbrot() call was rendered */
+static PHP_FUNCTION(clmandelbrot_last_info)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	zval *zdevices;
+	cl_uint i;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	if (!last->backend) {
+		RETURN_NULL();
+	}
+
+	array_init(return_value);
+	add_assoc_string(return_value, "backend", (char *)last->backend, 1);
+	if (last->precision) {
+		add_assoc_string(return_value, "precision", (char *)last->precision, 1);
+	} else {
+		add_assoc_null(return_value, "precision");
+	}
+	add_assoc_long(return_value, "width", last->width);
+	add_assoc_long(return_value, "height", last->height);
+	add_assoc_double(return_value, "time", last->time);
+	add_assoc_long(return_value, "reference_iterations", last->reference);
+	add_assoc_long(return_value, "skipped_iterations", last->skipped);
+	add_assoc_string(return_value, "mode", (char *)last->mode, 1);
+	add_assoc_long(return_value, "iterated_pixels", last->iterated);
+
+	MAKE_STD_ZVAL(zdevices);
+	array_init_size(zdevices, last->numDevices);
+	for (i = 0; i < last->numDevices; i++) {
+		zval *zstat;
+		MAKE_STD_ZVAL(zstat);
+		array_init_size(zstat, 4);
+		add_assoc_long(zstat, "chunks", last->devices[i].chunks);
+		add_assoc_long(zstat, "rows", last->devices[i].rows);
+		add_assoc_double(zstat, "time", last->devices[i].time);
+		add_index_zval(zdevices, last->devices[i].deviceId, zstat);
+	}
+	add_assoc_zval(return_value, "devices", zdevices);
+}
+/* }}} clmandelbrot_last_info */
+
+/* {{{ proto array clmandelbrot_last_histogram(void)
+   the escape count histogram of the last clmandelbrot() call if it was
+   equalized: one bin per count up to the iteration limit, whose bin holds
+   the points that never escaped, and the least, greatest and mean count
+   of the escaping points */
+static PHP_FUNCTION(clmandelbrot_last_histogram)
+{
+	clm_histogram_t *hist = &CLMANDELBROT_G(histogram);
+	zval *zbins;
+	int n;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	if (!CLMANDELBROT_G(last).equalized || !hist->count) {
+		RETURN_NULL();
+	}
+
+	MAKE_STD_ZVAL(zbins);
+	array_init_size(zbins, hist->count);
+	for (n = 0; n < hist->count; n++) {
+		add_next_index_long(zbins, (long)hist->bins[n]);
+	}
+
+	array_init(return_value);
+	add_assoc_zval(return_value, "bins", zbins);
+	add_assoc_long(return_value, "escaped", hist->escaped);
+	add_assoc_long(return_value, "interior", (long)hist->bins[hist->count - 1]);
+	if (hist->escaped) {
+		add_assoc_long(return_value, "min", hist->min);
+		add_assoc_long(return_value, "max", hist->max);
+		add_assoc_double(return_value, "mean", hist->mean);
+	} else {
+		add_assoc_null(return_value, "min");
+		add_assoc_null(return_value, "max");
+		add_assoc_null(return_value, "mean");
+	}
+}
+/* }}} clmandelbrot_last_histogram */
+
+/* {{{ proto array clmandelbrot_stats([bool reset])
+   returns the stage times of the last call and their cumulative
+   histograms, keyed by the upper bound of each bucket in microseconds */
+static PHP_FUNCTION(clmandelbrot_stats)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	zend_bool reset = 0;
+	zval *zlast, *zstages;
+	int stage, i;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|b", &reset) == FAILURE) {
+		return;
+	}
+
+	MAKE_STD_ZVAL(zlast);
+	array_init(zlast);
+	MAKE_STD_ZVAL(zstages);
+	array_init_size(zstages, CLM_PROF_STAGES);
+
+	for (stage = 0; stage < CLM_PROF_STAGES; stage++) {
+		const clm_prof_stage_t *prof = &CLMANDELBROT_G(prof)[stage];
+		zval *zstage, *zhistogram;
+
+		if (last->backend && last->stages[stage] > 0.0) {
+			add_assoc_double(zlast, (char *)clm_prof_name(stage), last->stages[stage]);
+		}
+
+		MAKE_STD_ZVAL(zhistogram);
+		array_init(zhistogram);
+		for (i = 0; i < CLM_PROF_BUCKETS; i++) {
+			if (prof->buckets[i]) {
+				add_index_long(zhistogram, 1L << i, prof->buckets[i]);
+			}
 		}
-		param++;
+
+		MAKE_STD_ZVAL(zstage);
+		array_init_size(zstage, 6);
+		add_assoc_long(zstage, "count", prof->count);
+		add_assoc_double(zstage, "total", prof->total);
+		add_assoc_double(zstage, "min", prof->min);
+		add_assoc_double(zstage, "max", prof->max);
+		add_assoc_double(zstage, "mean", prof->count ? prof->total / prof->count : 0.0);
+		add_assoc_zval(zstage, "histogram", zhistogram);
+		add_assoc_zval(zstages, (char *)clm_prof_name(stage), zstage);
+	}
+
+	array_init_size(return_value, 2);
+	add_assoc_zval(return_value, "last", zlast);
+	add_assoc_zval(return_value, "stages", zstages);
+
+	if (reset) {
+		clm_prof_reset(TSRMLS_C);
+	}
+}
+/* }}} clmandelbrot_stats */
+
+/* {{{ proto array clmandelbrot_variants(void)
+   lists the kernel variants compiled so far */
+static PHP_FUNCTION(clmandelbrot_variants)
+{
+	cl_uint i;
+
+	if (ZEND_NUM_ARGS() != 0) {
+		WRONG_PARAM_COUNT;
+	}
+
+	array_init(return_value);
+
+	for (i = 0; i < MAX_NUM_DEVICES; i++) {
+		clm_add_variants(return_value, (long)i, &CLMANDELBROT_G(devices)[i].variants TSRMLS_CC);
+	}
+	for (i = 0; i < CLMANDELBROT_G(multi).numPlatforms; i++) {
+		clm_add_variants(return_value, CLM_DEVICE_ALL,
+		                 &CLMANDELBROT_G(multi).platforms[i].variants TSRMLS_CC);
+	}
+}
+/* }}} clmandelbrot_variants */
+
+/* {{{ proto array clmandelbrot_warmup([int device])
+   builds (or loads) the program for every device, or for the given one */
+static PHP_FUNCTION(clmandelbrot_warmup)
+{
+	long device = -1;
+	cl_uint i = 0;
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|l", &device) == FAILURE) {
+		return;
+	}
+
+	if (clm_setup_device(TSRMLS_C) == FAILURE) {
+		return;
+	}
+
+	array_init(return_value);
+
+	for (i = 0; i < CLMANDELBROT_G(deviceCount); i++) {
+		clmandelbrot_t ctx = { 0 };
+		if (device >= 0 && (cl_uint)device != i) {
+			continue;
+		}
+		ctx.deviceId = i;
+		clm_parse_options(&ctx, NULL TSRMLS_CC);
+		/* the variant used for the default view */
+		ctx.precision = CLM_PRECISION_FLOAT;
+		add_index_bool(return_value, i, clm_prepare(&ctx TSRMLS_CC) == SUCCESS);
+	}
+}
+/* }}} clmandelbrot_warmup */
+
+/* {{{ proto array clmandelbrot_autotune([int device[, array options]])
+   times the launch shapes of the kernel variant for the options on an
+   OpenCL device and keeps the fastest one, also in the profile of the
+   device under clmandelbrot.cache_dir; the view of the options is the
+   one timed */
+static PHP_FUNCTION(clmandelbrot_autotune)
+{
+	long device = 0;
+	zval *zoptions = NULL;
+	clmandelbrot_t ctx = { 0 };
+
+	RETVAL_FALSE;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "|la!", &device, &zoptions) == FAILURE) {
+		return;
+	}
+	if (clm_init_context(&ctx, CLM_TUNE_PROBE_SIZE, CLM_TUNE_PROBE_SIZE, 0.0, device,
+	                     zoptions TSRMLS_CC) == FAILURE) {
+		return;
+	}
+	if (ctx.useCpu || ctx.useAll) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "autotuning needs an OpenCL device");
+		return;
+	}
+
+	if (clm_prepare(&ctx TSRMLS_CC) == SUCCESS
+		&& clm_autotune(&ctx TSRMLS_CC) == SUCCESS
+	) {
+		zval *ztuning = clm_tuning_zval(&ctx.variant->tuning[0]);
+		RETVAL_ZVAL(ztuning, 0, 1);
+	}
+	clm_release(&ctx TSRMLS_CC);
+}
+/* }}} clmandelbrot_autotune */
+
+/* {{{ clm_device_list()
+   the cl_get_devices() array of the request, built from the snapshot on
+   first use; NULL without devices */
+static zval *clm_device_list(TSRMLS_D)
+{
+	zval *zlist;
+	cl_uint i;
+
+	if (CLMANDELBROT_G(deviceInfo)) {
+		return CLMANDELBROT_G(deviceInfo);
+	}
+	if (clm_setup_device(TSRMLS_C) == FAILURE) {
+		return NULL;
+	}
+
+	if (!CLMANDELBROT_G(infoLoaded)) {
+		double start = clm_now();
+
+		for (i = 0; i < CLMANDELBROT_G(deviceCount); i++) {
+			clm_snapshot_device(&CLMANDELBROT_G(snapshots)[i], CLMANDELBROT_G(deviceList)[i]);
+		}
+		CLMANDELBROT_G(infoLoaded) = 1;
+		clm_prof_add(CLM_PROF_DEVICES, clm_now() - start TSRMLS_CC);
+	}
+
+	MAKE_STD_ZVAL(zlist);
+	array_init_size(zlist, CLMANDELBROT_G(deviceCount));
+	for (i = 0; i < CLMANDELBROT_G(deviceCount); i++) {
+		add_next_index_zval(zlist, clm_get_device_info(&CLMANDELBROT_G(snapshots)[i] TSRMLS_CC));
+	}
+	CLMANDELBROT_G(deviceInfo) = zlist;
+	return zlist;
+}
+/* }}} */
+
+/* {{{ clm_get_device_info() */
+static zval *clm_get_device_info(const clm_device_snapshot_t *snapshot TSRMLS_DC)
+{
+	const device_info_param_t *param = device_info_list;
+	const clm_info_value_t *value = snapshot->device;
+	zval *zinfo;
+
+	MAKE_STD_ZVAL(zinfo);
+	array_init_size(zinfo, 64);
+
+	for (; param->key != NULL; param++, value++) {
+		if (!value->valid) {
+			add_assoc_null(zinfo, param->key);
+			continue;
+		}
+
+		switch (param->type) {
+			case PARAM_TYPE_BOOL:
+				add_assoc_bool(zinfo, param->key, (zend_bool)value->lval);
+				break;
+
+			case PARAM_TYPE_STRING:
+				add_assoc_stringl(zinfo, param->key, value->str, value->len, 1);
+				break;
+
+			case PARAM_TYPE_PLATFORM:
+				add_assoc_zval(zinfo, param->key, clm_get_platform_info(snapshot TSRMLS_CC));
+				break;
+
+			case PARAM_TYPE_MAX_WORK_ITEM_SIZES: {
+				size_t i;
+				zval *zsizes;
+				MAKE_STD_ZVAL(zsizes);
+				array_init_size(zsizes, value->len);
+				for (i = 0; i < value->len; i++) {
+					add_next_index_long(zsizes, value->sizes[i]);
+				}
+				add_assoc_zval(zinfo, param->key, zsizes);
+			}
+			break;
+
+			default:
+				add_assoc_long(zinfo, param->key, value->lval);
+				break;
+		}
+	}
+
+	return zinfo;
+}
+/* }}} */
+
+/* {{{ clm_get_platform_info() */
+static zval *clm_get_platform_info(const clm_device_snapshot_t *snapshot TSRMLS_DC)
+{
+	const platform_info_param_t *param = platform_info_list;
+	const clm_info_value_t *value = snapshot->platform;
+	zval *zinfo;
+
+	MAKE_STD_ZVAL(zinfo);
+	array_init_size(zinfo, 8);
+
+	for (; param->key != NULL; param++, value++) {
+		if (value->valid) {
+			add_assoc_stringl(zinfo, param->key, value->str, value->len, 1);
+		} else {
+			add_assoc_null(zinfo, param->key);
+		}
+	}
+
+	return zinfo;
+}
+/* }}} */
+
+/* {{{ clm_snapshot_device()
+   reads every entry of device_info_list into persistent memory */
+static void clm_snapshot_device(clm_device_snapshot_t *snapshot, cl_device_id device)
+{
+	const device_info_param_t *param = device_info_list;
+	clm_info_value_t *value;
+	cl_int err = CL_SUCCESS;
+	char buf[1024] = { 0 };
+	size_t len = 0;
+	cl_uint max_work_item_dimensions = 0;
+
+	err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
+	                      sizeof(max_work_item_dimensions),
+	                      &max_work_item_dimensions, NULL);
+	if (err != CL_SUCCESS) {
+		max_work_item_dimensions = 0;
+	}
+
+	snapshot->device = pecalloc(CLM_DEVICE_INFO_COUNT, sizeof(clm_info_value_t), 1);
+	for (value = snapshot->device; param->key != NULL; param++, value++) {
+		switch (param->type) {
+			case PARAM_TYPE_BITFIELD: {
+				cl_bitfield val = 0;
+				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
+				value->lval = (long)val;
+			}
+			break;
+
+			case PARAM_TYPE_BOOL: {
+				cl_bool val = 0;
+				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
+				value->lval = (long)val;
+			}
+			break;
+
+			case PARAM_TYPE_SIZE: {
+				size_t val = 0;
+				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
+				value->lval = (long)val;
+			}
+			break;
+
+			case PARAM_TYPE_UINT: {
+				cl_uint val = 0;
+				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
+				value->lval = (long)val;
+			}
+			break;
+
+			case PARAM_TYPE_ULONG: {
+				cl_ulong val = 0;
+				err = clGetDeviceInfo(device, param->name, sizeof(val), &val, NULL);
+				value->lval = (long)val;
+			}
+			break;
+
+			case PARAM_TYPE_STRING: {
+				err = clGetDeviceInfo(device, param->name, sizeof(buf), buf, &len);
+				if (err == CL_SUCCESS) {
+					value->str = pemalloc(len + 1, 1);
+					memcpy(value->str, buf, len);
+					value->str[len] = '\0';
+					value->len = len;
+				}
+			}
+			break;
+
+			case PARAM_TYPE_PLATFORM: {
+				cl_platform_id platform;
+				err = clGetDeviceInfo(device, param->name, sizeof(platform), &platform, NULL);
+				if (err == CL_SUCCESS) {
+					clm_snapshot_platform(snapshot, platform);
+				}
+			}
+			break;
+
+			case PARAM_TYPE_MAX_WORK_ITEM_SIZES: {
+				size_t *sizes = ecalloc(max_work_item_dimensions, sizeof(size_t));
+				cl_uint i;
+
+				err = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+				                      sizeof(size_t) * max_work_item_dimensions, sizes, NULL);
+				if (err == CL_SUCCESS) {
+					value->sizes = pecalloc(max_work_item_dimensions, sizeof(long), 1);
+					for (i = 0; i < max_work_item_dimensions; i++) {
+						value->sizes[i] = (long)sizes[i];
+					}
+					value->len = max_work_item_dimensions;
+				}
+				efree(sizes);
+			}
+			break;
+		}
+
+		value->valid = (err == CL_SUCCESS);
+	}
+}
+/* }}} */
+
+/* {{{ clm_snapshot_platform() */
+static void clm_snapshot_platform(clm_device_snapshot_t *snapshot, cl_platform_id platform)
+{
+	const platform_info_param_t *param = platform_info_list;
+	clm_info_value_t *value;
+	char buf[1024] = { 0 };
+	size_t len = 0;
+
+	snapshot->platform = pecalloc(CLM_PLATFORM_INFO_COUNT, sizeof(clm_info_value_t), 1);
+	for (value = snapshot->platform; param->key != NULL; param++, value++) {
+		if (clGetPlatformInfo(platform, param->name, sizeof(buf), buf, &len) == CL_SUCCESS) {
+			value->str = pemalloc(len + 1, 1);
+			memcpy(value->str, buf, len);
+			value->str[len] = '\0';
+			value->len = len;
+			value->valid = 1;
+		}
+	}
+}
+/* }}} */
+
+/* {{{ clm_release_snapshots() */
+static void clm_release_snapshots(TSRMLS_D)
+{
+	cl_uint i;
+	size_t k;
+
+	for (i = 0; i < MAX_NUM_DEVICES; i++) {
+		clm_device_snapshot_t *snapshot = &CLMANDELBROT_G(snapshots)[i];
+
+		if (snapshot->device) {
+			for (k = 0; k < CLM_DEVICE_INFO_COUNT; k++) {
+				if (snapshot->device[k].str) {
+					pefree(snapshot->device[k].str, 1);
+				}
+				if (snapshot->device[k].sizes) {
+					pefree(snapshot->device[k].sizes, 1);
+				}
+			}
+			pefree(snapshot->device, 1);
+		}
+		if (snapshot->platform) {
+			for (k = 0; k < CLM_PLATFORM_INFO_COUNT; k++) {
+				if (snapshot->platform[k].str) {
+					pefree(snapshot->platform[k].str, 1);
+				}
+			}
+			pefree(snapshot->platform, 1);
+		}
+		memset(snapshot, 0, sizeof(clm_device_snapshot_t));
+	}
+	CLMANDELBROT_G(infoLoaded) = 0;
+}
+/* }}} */
+
+/* {{{ clm_refresh_devices()
+   drops the snapshot and the arrays built from it; the devices are
+   enumerated again and, if the list changed, the contexts of the old
+   devices are released, since their indexes no longer match */
+static void clm_refresh_devices(TSRMLS_D)
+{
+	cl_device_id list[MAX_NUM_DEVICES];
+	cl_uint count = 0;
+
+	if (clGetDeviceIDs(NULL, CL_DEVICE_TYPE_ALL, MAX_NUM_DEVICES, list, &count) != CL_SUCCESS) {
+		count = 0;
+	}
+	count = MIN(count, MAX_NUM_DEVICES);
+	if (!CLMANDELBROT_G(devicesLoaded) || count != CLMANDELBROT_G(deviceCount)
+		|| memcmp(list, CLMANDELBROT_G(deviceList), sizeof(cl_device_id) * count) != 0
+	) {
+		clm_release_cache(TSRMLS_C);
+	}
+
+	clm_release_snapshots(TSRMLS_C);
+	if (CLMANDELBROT_G(deviceInfo)) {
+		zval_ptr_dtor(&CLMANDELBROT_G(deviceInfo));
+		CLMANDELBROT_G(deviceInfo) = NULL;
+	}
+}
+/* }}} */
+
+/* {{{ clm_add_variants() */
+static void clm_add_variants(zval *list, long device, const clm_variants_t *cache TSRMLS_DC)
+{
+	int i;
+
+	for (i = 0; i < cache->count; i++) {
+		const clm_variant_t *variant = &cache->entries[i];
+		zval *zvariant;
+
+		MAKE_STD_ZVAL(zvariant);
+		array_init_size(zvariant, 8);
+		add_assoc_long(zvariant, "device", device);
+		add_assoc_string(zvariant, "kernel", (char *)variant->kernelName, 1);
+		add_assoc_string(zvariant, "options", (char *)variant->options, 1);
+		add_assoc_long(zvariant, "hits", variant->hits);
+		add_assoc_double(zvariant, "build_time", variant->buildTime);
+		add_assoc_bool(zvariant, "binary", variant->fromBinary);
+		add_assoc_zval(zvariant, "tuning", clm_tuning_zval(&variant->tuning[0]));
+		add_next_index_zval(list, zvariant);
+	}
+}
+/* }}} */
+
+/* {{{ clm_tuning_zval() */
+static zval *clm_tuning_zval(const clm_tuning_t *tuning)
+{
+	zval *ztuning, *zlocal;
+
+	MAKE_STD_ZVAL(zlocal);
+	array_init_size(zlocal, 2);
+	add_next_index_long(zlocal, (long)tuning->local[0]);
+	add_next_index_long(zlocal, (long)tuning->local[1]);
+
+	MAKE_STD_ZVAL(ztuning);
+	array_init_size(ztuning, 4);
+	add_assoc_zval(ztuning, "local", zlocal);
+	add_assoc_long(ztuning, "pixels_per_item", tuning->pixels);
+	add_assoc_bool(ztuning, "tuned", tuning->tuned);
+	add_assoc_double(ztuning, "time", tuning->time);
+	return ztuning;
+}
+/* }}} */
+
+/* {{{ clm_option_long() */
+static int clm_option_long(HashTable *options, const char *key, long *value)
+{
+	zval **entry, tmp;
+
+	if (!options || zend_hash_find(options, key, strlen(key) + 1, (void **)&entry) == FAILURE) {
+		return 0;
+	}
+
+	tmp = **entry;
+	zval_copy_ctor(&tmp);
+	convert_to_long(&tmp);
+	*value = Z_LVAL(tmp);
+	return 1;
+}
+/* }}} */
+
+/* {{{ clm_option_double() */
+static int clm_option_double(HashTable *options, const char *key, double *value)
+{
+	zval **entry, tmp;
+
+	if (!options || zend_hash_find(options, key, strlen(key) + 1, (void **)&entry) == FAILURE) {
+		return 0;
+	}
+
+	tmp = **entry;
+	zval_copy_ctor(&tmp);
+	convert_to_double(&tmp);
+	*value = Z_DVAL(tmp);
+	return 1;
+}
+/* }}} */
+
+/* {{{ clm_option_mp()
+   a coordinate given as a number or, for more than double precision, as a
+   numeric string */
+static int clm_option_mp(HashTable *options, const char *key, clm_mp_t *value TSRMLS_DC)
+{
+	zval **entry, tmp;
+
+	if (!options || zend_hash_find(options, key, strlen(key) + 1, (void **)&entry) == FAILURE) {
+		return SUCCESS;
+	}
+
+	if (Z_TYPE_PP(entry) == IS_STRING) {
+		if (clm_mp_parse(value, Z_STRVAL_PP(entry), Z_STRLEN_PP(entry)) == FAILURE) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s is not a valid number", key);
+			return FAILURE;
+		}
+	} else {
+		tmp = **entry;
+		zval_copy_ctor(&tmp);
+		convert_to_double(&tmp);
+		clm_mp_from_double(value, Z_DVAL(tmp));
+	}
+
+	if (value->d[0] >= 4) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s must be between -4 and 4", key);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_parse_options()
+   fills in the specialization parameters, using the defaults for anything
+   the options array does not set */
+static int clm_parse_options(clmandelbrot_t *ctx, HashTable *options TSRMLS_DC)
+{
+	long iterations = CLM_DEFAULT_ITERATIONS;
+	double bailout = CLM_DEFAULT_BAILOUT;
+	long vector = 0;
+	long samples = 1;
+	zval **entry;
+
+	if (clm_option_long(options, "iterations", &iterations)
+		&& (iterations < 1 || iterations > CLM_MAX_ITERATIONS)
+	) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "iterations must be between 1 and %d", CLM_MAX_ITERATIONS);
+		return FAILURE;
+	}
+	if (clm_option_double(options, "bailout", &bailout) && !(bailout > 0.0)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "bailout must be greater than 0");
+		return FAILURE;
+	}
+	if (clm_option_long(options, "vector_width", &vector)
+		&& vector != 0 && vector != 1 && vector != 4 && vector != 8 && vector != CLM_MAX_VECTOR
+	) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "vector_width must be 0, 1, 4, 8 or %d", CLM_MAX_VECTOR);
+		return FAILURE;
+	}
+	if (clm_option_long(options, "antialias", &samples)
+		&& (samples < 1 || samples > CLM_MAX_SAMPLES)
+	) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "antialias must be between 1 and %d", CLM_MAX_SAMPLES);
+		return FAILURE;
+	}
+
+	if (clm_option_mp(options, "center_x", &ctx->centerRe TSRMLS_CC) == FAILURE
+		|| clm_option_mp(options, "center_y", &ctx->centerIm TSRMLS_CC) == FAILURE
+	) {
+		return FAILURE;
+	}
+
+	ctx->precision = CLM_PRECISION_AUTO;
+	if (options && zend_hash_find(options, "precision", sizeof("precision"), (void **)&entry) == SUCCESS) {
+		const char *name = (Z_TYPE_PP(entry) == IS_STRING) ? Z_STRVAL_PP(entry) : "";
+
+		if (strcmp(name, "float") == 0) {
+			ctx->precision = CLM_PRECISION_FLOAT;
+		} else if (strcmp(name, "double") == 0) {
+			ctx->precision = CLM_PRECISION_DOUBLE;
+		} else if (strcmp(name, "perturbation") == 0) {
+			ctx->precision = CLM_PRECISION_PERTURB;
+		} else if (strcmp(name, "auto") != 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown precision '%s'", name);
+			return FAILURE;
+		}
+	}
+
+	ctx->series = 1;
+	if (options && zend_hash_find(options, "series", sizeof("series"), (void **)&entry) == SUCCESS) {
+		ctx->series = zend_is_true(*entry);
+	}
+
+	ctx->interiorCheck = 1;
+	if (options && zend_hash_find(options, "interior_check", sizeof("interior_check"), (void **)&entry) == SUCCESS) {
+		ctx->interiorCheck = zend_is_true(*entry);
+	}
+
+	ctx->periodicity = 1;
+	if (options && zend_hash_find(options, "periodicity", sizeof("periodicity"), (void **)&entry) == SUCCESS) {
+		ctx->periodicity = zend_is_true(*entry);
+	}
+
+	ctx->mode = CLM_MODE_DIRECT;
+	if (options && zend_hash_find(options, "mode", sizeof("mode"), (void **)&entry) == SUCCESS) {
+		const char *name = (Z_TYPE_PP(entry) == IS_STRING) ? Z_STRVAL_PP(entry) : "";
+
+		if (strcmp(name, "subdivide") == 0) {
+			ctx->mode = CLM_MODE_SUBDIVIDE;
+		} else if (strcmp(name, "direct") != 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown mode '%s'", name);
+			return FAILURE;
+		}
+	}
+
+	ctx->palette.count = 0;
+	if (options && zend_hash_find(options, "palette", sizeof("palette"), (void **)&entry) == SUCCESS
+		&& Z_TYPE_PP(entry) != IS_NULL
+		&& clm_palette_parse(&ctx->palette, *entry TSRMLS_CC) == FAILURE
+	) {
+		return FAILURE;
+	}
+
+	ctx->palette.smooth = 1;
+	if (options && zend_hash_find(options, "smooth", sizeof("smooth"), (void **)&entry) == SUCCESS) {
+		ctx->palette.smooth = zend_is_true(*entry);
+	}
+
+	ctx->equalize = 0;
+	if (options && zend_hash_find(options, "equalize", sizeof("equalize"), (void **)&entry) == SUCCESS) {
+		ctx->equalize = zend_is_true(*entry);
+	}
+
+	ctx->adaptive = 0;
+	if (options && zend_hash_find(options, "antialias_mode", sizeof("antialias_mode"), (void **)&entry) == SUCCESS) {
+		const char *name = (Z_TYPE_PP(entry) == IS_STRING) ? Z_STRVAL_PP(entry) : "";
+
+		if (strcmp(name, "adaptive") == 0) {
+			ctx->adaptive = 1;
+		} else if (strcmp(name, "grid") != 0) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "unknown antialias mode '%s'", name);
+			return FAILURE;
+		}
+	}
+
+	ctx->iterations = (int)iterations;
+	ctx->bailout = (float)(bailout * bailout);
+	ctx->vectorWidth = (int)vector;
+	ctx->samples = (int)samples;
+	ctx->adaptive = ctx->adaptive && samples > 1;
+	ctx->centerX = clm_mp_to_double(&ctx->centerRe);
+	ctx->centerY = clm_mp_to_double(&ctx->centerIm);
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_init_globals() */
+static void clm_init_globals(zend_clmandelbrot_globals *globals)
+{
+	memset(globals, 0, sizeof(zend_clmandelbrot_globals));
+}
+/* }}} */
+
+/* {{{ clm_release_device() */
+static void clm_release_device(clm_device_t *dev)
+{
+	int i;
+
+	for (i = 0; i < CLM_TILE_DEPTH; i++) {
+		if (dev->tiles[i]) {
+			clReleaseMemObject(dev->tiles[i]);
+		}
+	}
+	if (dev->ioQueue) {
+		clReleaseCommandQueue(dev->ioQueue);
+	}
+	if (dev->output) {
+		clReleaseMemObject(dev->output);
+	}
+	clm_variant_release_all(&dev->variants);
+	clm_palette_release_all(&dev->palettes);
+	if (dev->queue) {
+		clReleaseCommandQueue(dev->queue);
+	}
+	if (dev->context) {
+		clReleaseContext(dev->context);
+	}
+	memset(dev, 0, sizeof(clm_device_t));
+}
+/* }}} */
+
+/* {{{ clm_release_cache() */
+static void clm_release_cache(TSRMLS_D)
+{
+	cl_uint i;
+
+	for (i = 0; i < MAX_NUM_DEVICES; i++) {
+		clm_release_device(&CLMANDELBROT_G(devices)[i]);
+	}
+	clm_multi_release(&CLMANDELBROT_G(multi));
+	CLMANDELBROT_G(deviceCount) = 0;
+	CLMANDELBROT_G(devicesLoaded) = 0;
+}
+/* }}} */
+
+/* {{{ clm_create_image()
+   a truecolor image created through imagecreatetruecolor(), so that it is
+   an ordinary gd resource */
+static zval *clm_create_image(long width, long height, gdImagePtr *im TSRMLS_DC)
+{
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	zval *zim = NULL, *callable, *args, *zwidth, *zheight;
+	int err;
+
+	*im = NULL;
+
+	MAKE_STD_ZVAL(callable);
+	ZVAL_STRING(callable, "imagecreatetruecolor", 1);
+	err = zend_fcall_info_init(callable, 0, &fci, &fcc,
+	                           NULL, NULL TSRMLS_CC);
+
+	if (err != SUCCESS) {
+		zval_ptr_dtor(&callable);
+		return NULL;
+	}
+
+	MAKE_STD_ZVAL(args);
+	MAKE_STD_ZVAL(zwidth);
+	MAKE_STD_ZVAL(zheight);
+	ZVAL_LONG(zwidth, width);
+	ZVAL_LONG(zheight, height);
+	array_init(args);
+	add_next_index_zval(args, zwidth);
+	add_next_index_zval(args, zheight);
+
+	zend_fcall_info_call(&fci, &fcc, &zim, args TSRMLS_CC);
+	zval_ptr_dtor(&callable);
+	zval_ptr_dtor(&args);
+
+	if (!zim) {
+		return NULL;
+	}
+
+	ZEND_FETCH_RESOURCE_NO_RETURN(*im, gdImagePtr, &zim, -1,
+	                              "Image", phpi_get_le_gd());
+	return zim;
+}
+/* }}} */
+
+/* {{{ clm_init_context()
+   fills the render context from the arguments of clmandelbrot() */
+static int clm_init_context(clmandelbrot_t *ctx, int width, int height, double unit,
+                            long device, zval *zoptions TSRMLS_DC)
+{
+	if (device == CLM_DEVICE_CPU
+		|| (CLMANDELBROT_G(cpuFallback) && clm_load_devices(TSRMLS_C) == 0)
+	) {
+		ctx->useCpu = 1;
+	} else if (device == CLM_DEVICE_ALL) {
+		ctx->useAll = 1;
+	} else {
+		ctx->deviceId = (cl_uint)device;
+	}
+	ctx->width = width;
+	ctx->height = height;
+	if (unit > 0.0) {
+		if (unit < CLM_MIN_UNIT) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "unit must not be smaller than %g", CLM_MIN_UNIT);
+			return FAILURE;
+		}
+		ctx->unit = unit;
+	} else {
+		ctx->unit = 10.0f / (float)(ctx->width + ctx->height);
+	}
+
+	return clm_parse_options(ctx, zoptions ? Z_ARRVAL_P(zoptions) : NULL TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_prepare() */
+static int clm_prepare(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	char options[CLM_OPTIONS_SIZE];
+
+	if (clm_setup_device(TSRMLS_C) == FAILURE) {
+		return FAILURE;
+	}
+	if (ctx->deviceId >= CLMANDELBROT_G(deviceCount)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "device #%u does not exist", ctx->deviceId);
+		return FAILURE;
+	}
+
+	ctx->device = CLMANDELBROT_G(deviceList)[ctx->deviceId];
+	ctx->dev = &CLMANDELBROT_G(devices)[ctx->deviceId];
+
+	if (!ctx->dev->queue) {
+		if (clm_check_device(ctx TSRMLS_CC) == FAILURE) {
+			return FAILURE;
+		}
+		if (clm_setup_context(ctx TSRMLS_CC) == FAILURE) {
+			clm_release_device(ctx->dev);
+			return FAILURE;
+		}
+	}
+
+	if (clm_select_precision(ctx, ctx->dev->hasDouble TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+	clm_variant_sampling(ctx);
+	clm_variant_vector(ctx, ctx->dev->vectorFloat, ctx->dev->vectorDouble);
+
+	clm_variant_options(ctx, options, sizeof(options));
+	ctx->variant = clm_variant_get(&ctx->dev->variants, ctx->dev->context, 1, &ctx->device,
+	                               clm_variant_kernel(ctx), options TSRMLS_CC);
+	if (!ctx->variant
+		|| clm_palette_upload(&ctx->palette, &ctx->dev->palettes, ctx->dev->context TSRMLS_CC) == FAILURE
+	) {
+		return FAILURE;
+	}
+	/* a failed tuning leaves the default launch shape */
+	if (CLMANDELBROT_G(autotune) && !ctx->variant->tuning[0].tuned
+		&& clm_tune_dims(ctx->variant) == 2
+	) {
+		clm_autotune(ctx TSRMLS_CC);
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_cache_fetch()
+   looks the render up in the shared render cache; a hit fills the image
+   without touching OpenCL and is reported with the "cache" backend */
+static int clm_cache_fetch(clmandelbrot_t *ctx, unsigned char *key, double start TSRMLS_DC)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+
+	clm_shm_key(ctx, key);
+	if (clm_shm_fetch(key, ctx) == FAILURE) {
+		return FAILURE;
+	}
+
+	last->backend = "cache";
+	last->precision = clm_precision_name(ctx->precision);
+	last->mode = clm_mode_name(ctx->mode);
+	last->iterated = 0;
+	last->time = clm_now() - start;
+	clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+	clm_prof_commit(TSRMLS_C);
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_mode_name() */
+static const char *clm_mode_name(int mode)
+{
+	switch (mode) {
+		case CLM_MODE_SUBDIVIDE:
+			return "subdivide";
+		case CLM_MODE_PROGRESSIVE:
+			return "progressive";
+	}
+	return "direct";
+}
+/* }}} */
+
+/* {{{ clm_render_bitmap()
+   renders into ctx->bitmap without a gd image; the buffer ends with a NUL
+   byte, so that it can become a PHP string as it is */
+static int clm_render_bitmap(clmandelbrot_t *ctx, long width, long height, double unit,
+                             long device, zval *zoptions TSRMLS_DC)
+{
+	if (width <= 0 || height <= 0 || width > INT_MAX / height) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "invalid image dimensions");
+		return FAILURE;
+	}
+	if (clm_init_context(ctx, (int)width, (int)height, unit, device, zoptions TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+
+	ctx->bitmap = safe_emalloc(width, height, 1);
+	ctx->bitmap[width * height] = '\0';
+	return clm_process(NULL, ctx TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_process() */
+static int clm_process(gdImagePtr im, clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	unsigned char key[CLM_SHM_KEY_SIZE];
+	double start = clm_now();
+	double render = 0.0;
+	int result;
+
+	clm_prof_begin(TSRMLS_C);
+	last->width = ctx->width;
+	last->height = ctx->height;
+	ctx->iterated = (long)ctx->width * ctx->height;
+
+	/* all renderers write gd truecolor pixels straight into the image, or
+	   one shade per pixel into ctx->bitmap for renders without one */
+	ctx->pixels = im ? im->tpixels : NULL;
+
+	if (ctx->useCpu || ctx->useAll) {
+		ctx->mode = CLM_MODE_DIRECT;
+	}
+	clm_equalize_select(ctx);
+	if (clm_palette_select(ctx TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+
+	if (clm_cache_fetch(ctx, key, start TSRMLS_CC) == SUCCESS) {
+		return SUCCESS;
+	}
+
+	if (ctx->useCpu) {
+		last->backend = "cpu";
+		result = clm_select_precision(ctx, 1 TSRMLS_CC);
+		if (result == SUCCESS) {
+			result = clm_perturb_prepare(ctx TSRMLS_CC);
+		}
+		if (result == SUCCESS) {
+			render = clm_now();
+			result = clm_cpu_render(ctx TSRMLS_CC);
+		}
+	} else if (ctx->useAll) {
+		last->backend = "multi";
+		render = clm_now();
+		result = clm_multi_render(ctx TSRMLS_CC);
+	} else {
+		last->backend = "opencl";
+		result = clm_prepare(ctx TSRMLS_CC);
+		if (result == SUCCESS) {
+			result = clm_perturb_prepare(ctx TSRMLS_CC);
+		}
+		if (result == SUCCESS) {
+			result = clm_perturb_upload(ctx, ctx->dev->context TSRMLS_CC);
+		}
+		if (result == SUCCESS) {
+			result = clm_setup_queue(ctx TSRMLS_CC);
+		}
+		if (result == SUCCESS) {
+			render = clm_now();
+			result = clm_execute(ctx TSRMLS_CC);
+		}
+		last->numDevices = 1;
+		last->devices[0].deviceId = ctx->deviceId;
+		last->devices[0].chunks = ctx->tileRows
+			? (ctx->height + ctx->tileRows - 1) / ctx->tileRows : 1;
+		last->devices[0].rows = ctx->height;
+	}
+	/* renderers that do not equalize on the device leave escape counts */
+	if (result == SUCCESS && ctx->equalize && !last->equalized) {
+		result = clm_equalize_pixels(ctx TSRMLS_CC);
+	}
+
+	last->mode = clm_mode_name(ctx->mode);
+	last->iterated = ctx->iterated;
+	last->time = clm_now() - start;
+	if (last->numDevices == 1 && !ctx->useAll) {
+		last->devices[0].time = last->time;
+	}
+	if (render > 0.0) {
+		clm_prof_add(CLM_PROF_RENDER, clm_now() - render TSRMLS_CC);
+	}
+	clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+	clm_prof_commit(TSRMLS_C);
+	/* a progressive render stopped by its callback is incomplete */
+	if (result == SUCCESS && (ctx->mode != CLM_MODE_PROGRESSIVE || ctx->callback)) {
+		clm_shm_store(key, ctx);
+	}
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_submit()
+   enqueues the kernel and a non-blocking read of its output, then returns;
+   renders that cannot run that way are completed right away */
+static int clm_submit(gdImagePtr im, clm_job_t *job TSRMLS_DC)
+{
+	clmandelbrot_t *ctx = &job->ctx;
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	double start = clm_now();
+	size_t len;
+	cl_event kernel = NULL;
+	cl_int err;
+
+	if (ctx->useCpu || ctx->useAll) {
+		return job->result = clm_process(im, ctx TSRMLS_CC);
+	}
+
+	clm_prof_begin(TSRMLS_C);
+	last->backend = "opencl";
+	last->width = ctx->width;
+	last->height = ctx->height;
+	ctx->pixels = im->tpixels;
+	ctx->iterated = (long)ctx->width * ctx->height;
+	clm_equalize_select(ctx);
+	if (clm_palette_select(ctx TSRMLS_CC) == FAILURE) {
+		return job->result = FAILURE;
+	}
+
+	if (clm_cache_fetch(ctx, job->key, start TSRMLS_CC) == SUCCESS) {
+		return job->result = SUCCESS;
+	}
+
+	if (clm_prepare(ctx TSRMLS_CC) == FAILURE
+		|| clm_perturb_prepare(ctx TSRMLS_CC) == FAILURE
+		|| clm_perturb_upload(ctx, ctx->dev->context TSRMLS_CC) == FAILURE
+		|| clm_setup_queue(ctx TSRMLS_CC) == FAILURE
+		|| clm_setup_io_queue(ctx TSRMLS_CC) == FAILURE
+	) {
+		return job->result = FAILURE;
+	}
+
+	last->numDevices = 1;
+	last->devices[0].deviceId = ctx->deviceId;
+	last->devices[0].chunks = 1;
+	last->devices[0].rows = ctx->height;
+	last->mode = "direct";
+	last->iterated = ctx->iterated;
+
+	if (ctx->tileRows || ctx->mode == CLM_MODE_SUBDIVIDE || ctx->equalize) {
+		double render = clm_now();
+
+		job->result = clm_execute(ctx TSRMLS_CC);
+		if (job->result == SUCCESS && ctx->equalize && !last->equalized) {
+			job->result = clm_equalize_pixels(ctx TSRMLS_CC);
+		}
+		last->mode = clm_mode_name(ctx->mode);
+		last->iterated = ctx->iterated;
+		last->time = last->devices[0].time = clm_now() - start;
+		clm_prof_add(CLM_PROF_RENDER, clm_now() - render TSRMLS_CC);
+		clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+		clm_prof_commit(TSRMLS_C);
+		if (job->result == SUCCESS) {
+			clm_shm_store(job->key, ctx);
+		}
+		return job->result;
+	}
+
+	len = sizeof(cl_int) * ctx->width * ctx->height;
+	job->output = clCreateBuffer(ctx->dev->context, CL_MEM_WRITE_ONLY, len, NULL, NULL);
+	if (!job->output) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		return job->result = FAILURE;
+	}
+	job->host = safe_emalloc(ctx->height, sizeof(int) * ctx->width, 0);
+
+	if (clm_enqueue_rows(ctx, ctx->dev->queue, ctx->variant->kernels[0],
+	                     &ctx->variant->tuning[0], job->output,
+	                     0, ctx->height, 0, NULL, &kernel TSRMLS_CC) == FAILURE) {
+		return job->result = FAILURE;
+	}
+	/* on the transfer queue, so that the kernel of the next job runs while
+	   this output is read back */
+	err = clEnqueueReadBuffer(ctx->dev->ioQueue, job->output, CL_FALSE, 0, len, job->host,
+	                          1, &kernel, &job->event);
+	if (err != CL_SUCCESS) {
+		clReleaseEvent(kernel);
+		job->event = NULL;
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue read buffer");
+		return job->result = FAILURE;
+	}
+	clFlush(ctx->dev->queue);
+	clFlush(ctx->dev->ioQueue);
+	job->kernel = kernel;
+
+	/* only the time taken to submit; the device finishes later and its
+	   kernel and transfer times are profiled when the job is collected */
+	last->time = last->devices[0].time = clm_now() - start;
+	clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+	clm_prof_commit(TSRMLS_C);
+
+	return job->result = SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_collect()
+   waits for the read back of a submitted render and draws it, once */
+static int clm_collect(clm_job_t *job TSRMLS_DC)
+{
+	/* profiled as a call of its own */
+	CLMANDELBROT_G(last).stageMask = 0;
+
+	if (job->event) {
+		cl_int status = CL_COMPLETE;
+
+		if (clWaitForEvents(1, &job->event) != CL_SUCCESS
+			|| clGetEventInfo(job->event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+			                  sizeof(status), &status, NULL) != CL_SUCCESS
+			|| status != CL_COMPLETE
+		) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "render failed on device #%u",
+			                 job->ctx.deviceId);
+			job->result = FAILURE;
+		}
+		clm_prof_release(CLM_PROF_KERNEL, job->kernel TSRMLS_CC);
+		clm_prof_release(CLM_PROF_TRANSFER, job->event TSRMLS_CC);
+		job->kernel = NULL;
+		job->event = NULL;
+	}
+
+	if (job->result == SUCCESS && job->host && !job->fetched) {
+		gdImagePtr im;
+
+		ZEND_FETCH_RESOURCE_NO_RETURN(im, gdImagePtr, &job->image, -1,
+		                              "Image", phpi_get_le_gd());
+		if (!im) {
+			return FAILURE;
+		}
+		clm_draw(job->host, 0, job->ctx.height, &job->ctx TSRMLS_CC);
+		job->fetched = 1;
+		job->ctx.pixels = im->tpixels;
+		clm_shm_store(job->key, &job->ctx);
+	}
+	clm_prof_commit(TSRMLS_C);
+
+	return job->result;
+}
+/* }}} */
+
+/* {{{ clm_batch_submit()
+   submits one frame of clmandelbrot_batch() */
+static clm_job_t *clm_batch_submit(zval *zframe, long device, zval *zoptions TSRMLS_DC)
+{
+	zval *zmerged;
+	long width = 0, height = 0;
+	double unit = 0.0;
+	clm_job_t *job;
+	gdImagePtr im;
+
+	if (Z_TYPE_P(zframe) != IS_ARRAY) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "frames must be arrays");
+		return NULL;
 	}
+	if (!clm_option_long(Z_ARRVAL_P(zframe), "width", &width)
+		|| !clm_option_long(Z_ARRVAL_P(zframe), "height", &height)
+	) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "frames must have a width and a height");
+		return NULL;
+	}
+	clm_option_double(Z_ARRVAL_P(zframe), "unit", &unit);
+
+	/* the frame overrides the options common to all frames */
+	MAKE_STD_ZVAL(zmerged);
+	array_init(zmerged);
+	if (zoptions) {
+		zend_hash_copy(Z_ARRVAL_P(zmerged), Z_ARRVAL_P(zoptions),
+		               (copy_ctor_func_t)zval_add_ref, NULL, sizeof(zval *));
+	}
+	zend_hash_merge(Z_ARRVAL_P(zmerged), Z_ARRVAL_P(zframe),
+	                (copy_ctor_func_t)zval_add_ref, NULL, sizeof(zval *), 1);
+
+	job = ecalloc(1, sizeof(clm_job_t));
+	job->image = clm_create_image(width, height, &im TSRMLS_CC);
+	if (!job->image || !im
+		|| clm_init_context(&job->ctx, gdImageSX(im), gdImageSY(im), unit, device,
+		                    zmerged TSRMLS_CC) == FAILURE
+		|| clm_submit(im, job TSRMLS_CC) == FAILURE
+	) {
+		clm_job_dtor_ex(job TSRMLS_CC);
+		job = NULL;
+	}
+	zval_ptr_dtor(&zmerged);
 
-	return zinfo;
+	return job;
 }
 /* }}} */
 
-/* {{{ clm_process() */
-static int clm_process(gdImagePtr im, clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_tile_check() */
+static int clm_tile_check(long z, long x, long y TSRMLS_DC)
 {
-	if (clm_setup_device(ctx TSRMLS_CC) == FAILURE) {
+	if (z < 0 || z > CLM_MAP_MAX_ZOOM) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "zoom level must be between 0 and %d", CLM_MAP_MAX_ZOOM);
 		return FAILURE;
 	}
-	if (clm_check_device(ctx TSRMLS_CC) == FAILURE) {
+	if (x < 0 || y < 0 || (double)x >= ldexp(1.0, (int)z) || (double)y >= ldexp(1.0, (int)z)) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "tile %ld/%ld is outside of zoom level %ld", x, y, z);
 		return FAILURE;
 	}
-	if (clm_setup_kernel(ctx TSRMLS_CC) == FAILURE) {
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_tile_size() */
+static int clm_tile_size(zval *zoptions, long *size TSRMLS_DC)
+{
+	clm_option_long(zoptions ? Z_ARRVAL_P(zoptions) : NULL, "size", size);
+	if (*size < 1 || *size > CLM_MAP_MAX_SIZE) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "size must be between 1 and %d", CLM_MAP_MAX_SIZE);
 		return FAILURE;
 	}
-	if (clm_setup_queue(ctx TSRMLS_CC) == FAILURE) {
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_encode_level() */
+static int clm_encode_level(zval *zoptions, long *level TSRMLS_DC)
+{
+	clm_option_long(zoptions ? Z_ARRVAL_P(zoptions) : NULL, "compression", level);
+	if (*level < 0 || *level > 9) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "compression must be between 0 and 9");
 		return FAILURE;
 	}
-	if (clm_execute(ctx TSRMLS_CC) == FAILURE) {
-		return FAILURE;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_tile_view()
+   centers the context on tile x, y of zoom level z; the tiles of a level
+   are CLM_MAP_SPAN / 2^z wide, and their centers are dyadic fractions of
+   at most 53 bits, hence exact */
+static void clm_tile_view(clmandelbrot_t *ctx, long z, long x, long y)
+{
+	double span = ldexp(CLM_MAP_SPAN, -(int)z);
+
+	ctx->centerX = CLM_MAP_LEFT + ((double)x + 0.5) * span;
+	ctx->centerY = CLM_MAP_TOP - ((double)y + 0.5) * span;
+	ctx->unit = span / ctx->width;
+	clm_mp_from_double(&ctx->centerRe, ctx->centerX);
+	clm_mp_from_double(&ctx->centerIm, ctx->centerY);
+}
+/* }}} */
+
+/* {{{ clm_job_dtor_ex()
+   a pending read must finish before its host buffer is freed */
+static void clm_job_dtor_ex(clm_job_t *job TSRMLS_DC)
+{
+	if (job->event) {
+		clWaitForEvents(1, &job->event);
+		clReleaseEvent(job->event);
+	}
+	if (job->kernel) {
+		clReleaseEvent(job->kernel);
+	}
+	if (job->output) {
+		clReleaseMemObject(job->output);
+	}
+	if (job->host) {
+		efree(job->host);
+	}
+	if (job->image) {
+		zval_ptr_dtor(&job->image);
+	}
+	clm_release(&job->ctx TSRMLS_CC);
+	efree(job);
+}
+/* }}} */
+
+/* {{{ clm_job_dtor() */
+static void clm_job_dtor(zend_rsrc_list_entry *rsrc TSRMLS_DC)
+{
+	clm_job_dtor_ex((clm_job_t *)rsrc->ptr TSRMLS_CC);
+}
+/* }}} */
+
+/* {{{ clm_viewport_process()
+   renders the move of a viewport on the device and draws the frame into
+   the image, if one is given */
+static int clm_viewport_process(clm_viewport_t *vp, gdImagePtr im TSRMLS_DC)
+{
+	clmandelbrot_t *ctx = &vp->ctx;
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	double start = clm_now();
+	double render;
+	int result;
+
+	clm_prof_begin(TSRMLS_C);
+	last->backend = "opencl";
+	last->width = ctx->width;
+	last->height = ctx->height;
+	ctx->pixels = im ? im->tpixels : NULL;
+	ctx->iterated = 0;
+
+	/* the precision is chosen anew for every view */
+	ctx->precision = vp->precision;
+	ctx->centerX = vp->originX + vp->offX * ctx->unit;
+	ctx->centerY = vp->originY - vp->offY * ctx->unit;
+
+	result = clm_prepare(ctx TSRMLS_CC);
+	if (result == SUCCESS && ctx->precision == CLM_PRECISION_PERTURB) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING,
+		                 "unit %g needs perturbation, which viewports do not render", ctx->unit);
+		result = FAILURE;
+	}
+	last->precision = clm_precision_name(ctx->precision);
+	if (result == SUCCESS) {
+		render = clm_now();
+		result = clm_viewport_render(vp TSRMLS_CC);
+		clm_prof_add(CLM_PROF_RENDER, clm_now() - render TSRMLS_CC);
+	}
+	if (result == SUCCESS && im) {
+		result = clm_viewport_draw(vp TSRMLS_CC);
+	}
+	if (result == FAILURE) {
+		vp->valid = 0;
+	}
+
+	last->mode = (vp->move == CLM_VIEW_FULL) ? "direct" : "incremental";
+	last->iterated = ctx->iterated;
+	last->numDevices = 1;
+	last->devices[0].deviceId = ctx->deviceId;
+	last->devices[0].chunks = 1;
+	last->devices[0].rows = ctx->height;
+	last->time = last->devices[0].time = clm_now() - start;
+	clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+	clm_prof_commit(TSRMLS_C);
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_viewport_frame()
+   returns the image of the view in return_value, rendering the move first
+   if asked to. The move has already shifted the offsets, so a move that
+   is not rendered leaves no valid frame, and the next one renders afresh */
+static void clm_viewport_frame(clm_viewport_t *vp, int render, zval *return_value TSRMLS_DC)
+{
+	zval *zim;
+	gdImagePtr im = NULL;
+	int result = FAILURE;
+
+	zim = clm_create_image(vp->ctx.width, vp->ctx.height, &im TSRMLS_CC);
+	if (zim && im) {
+		if (render) {
+			result = clm_viewport_process(vp, im TSRMLS_CC);
+		} else {
+			vp->ctx.pixels = im->tpixels;
+			result = clm_viewport_draw(vp TSRMLS_CC);
+		}
+		if (result == SUCCESS) {
+			RETVAL_ZVAL(zim, 1, 0);
+		}
+	}
+	if (render && result == FAILURE) {
+		vp->valid = 0;
+	}
+	if (zim) {
+		zval_ptr_dtor(&zim);
+	}
+}
+/* }}} */
+
+/* {{{ clm_viewport_dtor() */
+static void clm_viewport_dtor(zend_rsrc_list_entry *rsrc TSRMLS_DC)
+{
+	clm_viewport_t *vp = (clm_viewport_t *)rsrc->ptr;
+
+	clm_viewport_release(vp);
+	clm_release(&vp->ctx TSRMLS_CC);
+	efree(vp);
+}
+/* }}} */
+
+/* {{{ clm_process_tiles()
+   renders map tiles of equal size; on a single OpenCL device all of them
+   share one launch when every tile resolves to the precision of the
+   first, as it would when rendered alone. Tiles of mixed precisions,
+   perturbation ones, which need a reference orbit each, and adaptively
+   antialiased ones, whose kernel needs a 2D range, are rendered one by
+   one, as are the CPU and multi-device ones */
+static int clm_process_tiles(clmandelbrot_t *ctxs, gdImagePtr *ims, int count TSRMLS_DC)
+{
+	clm_last_t *last = &CLMANDELBROT_G(last);
+	clmandelbrot_t base;
+	size_t len = sizeof(cl_int) * ctxs[0].width * ctxs[0].height * count;
+	double start = clm_now();
+	int i;
+
+	/* each tile would be ranked on its own, and the seams would show */
+	for (i = 0; i < count; i++) {
+		ctxs[i].equalize = 0;
+	}
+	base = ctxs[0];
+
+	if (!base.useCpu && !base.useAll && count > 1 && !base.adaptive) {
+		int shared;
+
+		base.tileCount = count;
+
+		clm_prof_begin(TSRMLS_C);
+		last->backend = "opencl";
+		if (clm_prepare(&base TSRMLS_CC) == FAILURE) {
+			return FAILURE;
+		}
+
+		shared = (base.precision != CLM_PRECISION_PERTURB && len <= base.dev->maxAlloc);
+		for (i = 0; i < count && shared; i++) {
+			if (clm_select_precision(&ctxs[i], base.dev->hasDouble TSRMLS_CC) == FAILURE) {
+				return FAILURE;
+			}
+			shared = (ctxs[i].precision == base.precision);
+		}
+
+		if (shared) {
+			double render = clm_now();
+			int result = clm_execute_tiles(&base, ctxs, ims, count TSRMLS_CC);
+
+			clm_prof_add(CLM_PROF_RENDER, clm_now() - render TSRMLS_CC);
+			last->width = base.width;
+			last->height = base.height * count;
+			last->mode = "direct";
+			last->iterated = (long)base.width * base.height * count;
+			last->numDevices = 1;
+			last->devices[0].deviceId = base.deviceId;
+			last->devices[0].chunks = 1;
+			last->devices[0].rows = last->height;
+			last->time = last->devices[0].time = clm_now() - start;
+			clm_prof_add(CLM_PROF_TOTAL, last->time TSRMLS_CC);
+			clm_prof_commit(TSRMLS_C);
+			return result;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (clm_process(ims[i], &ctxs[i] TSRMLS_CC) == FAILURE) {
+			return FAILURE;
+		}
 	}
-	clm_draw(im, ctx TSRMLS_CC);
+
 	return SUCCESS;
 }
 /* }}} */
 
-/* {{{ clm_release() */
-static void clm_release(clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_execute_tiles()
+   one MandelbrotTileSetRGB launch writes the tiles one after the other */
+static int clm_execute_tiles(clmandelbrot_t *base, clmandelbrot_t *ctxs, gdImagePtr *ims,
+                             int count TSRMLS_DC)
 {
-	if (ctx->context) {
-		clReleaseContext(ctx->context);
+	clm_device_t *dev = base->dev;
+	cl_kernel kernel = base->variant->kernels[0];
+	size_t local = base->variant->workGroupSize[0];
+	size_t tile = (size_t)base->width * base->height;
+	size_t global = tile * count;
+	size_t real_size = base->useDouble ? sizeof(cl_double) : sizeof(cl_float);
+	cl_mem centers = NULL, output = NULL;
+	cl_int err = CL_SUCCESS;
+	void *host_centers;
+	int *rgb = NULL;
+	int result = FAILURE;
+	int i;
+
+	/* the centers in the precision of the variant, cast as for one tile */
+	host_centers = safe_emalloc(count, 2 * real_size, 0);
+	for (i = 0; i < count; i++) {
+		if (base->useDouble) {
+			((cl_double *)host_centers)[2 * i] = ctxs[i].centerX;
+			((cl_double *)host_centers)[2 * i + 1] = ctxs[i].centerY;
+		} else {
+			((cl_float *)host_centers)[2 * i] = (cl_float)ctxs[i].centerX;
+			((cl_float *)host_centers)[2 * i + 1] = (cl_float)ctxs[i].centerY;
+		}
+	}
+	centers = clCreateBuffer(dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+	                         2 * real_size * count, host_centers, &err);
+	efree(host_centers);
+	if (!centers || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		goto cleanup;
+	}
+	output = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, sizeof(cl_int) * global, NULL, NULL);
+	if (!output) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+		goto cleanup;
+	}
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(base->width), &base->width);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &centers);
+	err |= clm_set_real_arg(base, kernel, 3, &base->unit, 1);
+	err |= clm_palette_args(base, kernel, 4);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
+		goto cleanup;
+	}
+
+	err = clm_enqueue_1d(dev->queue, kernel, global, local, 0, NULL, NULL);
+	if (err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
+		goto cleanup;
+	}
+
+	rgb = clEnqueueMapBuffer(dev->queue, output, CL_TRUE, CL_MAP_READ,
+	                         0, sizeof(cl_int) * global, 0, NULL, NULL, &err);
+	if (!rgb || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot map output buffer");
+		goto cleanup;
 	}
-	if (ctx->queue) {
-		clReleaseCommandQueue(ctx->queue);
+	for (i = 0; i < count; i++) {
+		ctxs[i].pixels = ims[i]->tpixels;
+		clm_draw(rgb + tile * i, 0, base->height, &ctxs[i] TSRMLS_CC);
 	}
-	if (ctx->program) {
-		clReleaseProgram(ctx->program);
+	clEnqueueUnmapMemObject(dev->queue, output, rgb, 0, NULL, NULL);
+	result = SUCCESS;
+
+cleanup:
+	if (output) {
+		clReleaseMemObject(output);
 	}
-	if (ctx->kernel) {
-		clReleaseKernel(ctx->kernel);
+	if (centers) {
+		clReleaseMemObject(centers);
 	}
-	if (ctx->output) {
-		clReleaseMemObject(ctx->output);
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_now()
+   monotonic time in seconds */
+double clm_now(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0) {
+		mach_timebase_info(&timebase);
 	}
+	return (double)mach_absolute_time() * timebase.numer / timebase.denom / 1e9;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+/* }}} */
+
+/* {{{ clm_release() */
+static void clm_release(clmandelbrot_t *ctx TSRMLS_DC)
+{
 	if (ctx->bitmap) {
 		efree(ctx->bitmap);
 	}
+	clm_perturb_release(&ctx->perturb);
 }
 /* }}} */
 
-/* {{{ clm_setup_device() */
-static int clm_setup_device(clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_load_devices()
+   enumerates the OpenCL devices once and returns how many there are */
+cl_uint clm_load_devices(TSRMLS_D)
 {
 	cl_int err = CL_SUCCESS;
+	double start;
+
+	if (CLMANDELBROT_G(devicesLoaded)) {
+		return CLMANDELBROT_G(deviceCount);
+	}
 
+	start = clm_now();
 	err = clGetDeviceIDs(NULL, CL_DEVICE_TYPE_ALL, MAX_NUM_DEVICES,
-	                     ctx->deviceList, &ctx->deviceCount);
+	                     CLMANDELBROT_G(deviceList), &CLMANDELBROT_G(deviceCount));
 	if (err != CL_SUCCESS) {
+		CLMANDELBROT_G(deviceCount) = 0;
+	}
+	if (CLMANDELBROT_G(deviceCount) > MAX_NUM_DEVICES) {
+		CLMANDELBROT_G(deviceCount) = MAX_NUM_DEVICES;
+	}
+
+	CLMANDELBROT_G(devicesLoaded) = 1;
+	clm_prof_add(CLM_PROF_DEVICES, clm_now() - start TSRMLS_CC);
+	return CLMANDELBROT_G(deviceCount);
+}
+/* }}} */
+
+/* {{{ clm_setup_device() */
+int clm_setup_device(TSRMLS_D)
+{
+	if (clm_load_devices(TSRMLS_C) == 0) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot get device IDs");
 		return FAILURE;
 	}
@@ -579,19 +2978,14 @@ static int clm_check_device(clmandelbrot_t *ctx TSRMLS_DC)
 	cl_int err = CL_SUCCESS;
 	cl_bool available = 0;
 
-	if (ctx->deviceId >= ctx->deviceCount) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "device #%u does not exist", ctx->deviceId);
-		return FAILURE;
-	}
-
-	err = clGetDeviceInfo(ctx->deviceList[ctx->deviceId], CL_DEVICE_AVAILABLE,
+	err = clGetDeviceInfo(ctx->device, CL_DEVICE_AVAILABLE,
 	                      sizeof(available), &available, NULL);
 	if (err != CL_SUCCESS || !available) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "device #%u is not available", ctx->deviceId);
 		return FAILURE;
 	}
 
-	err = clGetDeviceInfo(ctx->deviceList[ctx->deviceId], CL_DEVICE_COMPILER_AVAILABLE,
+	err = clGetDeviceInfo(ctx->device, CL_DEVICE_COMPILER_AVAILABLE,
 	                      sizeof(available), &available, NULL);
 	if (err != CL_SUCCESS || !available) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "compiler is not available on device #%u", ctx->deviceId);
@@ -602,42 +2996,81 @@ static int clm_check_device(clmandelbrot_t *ctx TSRMLS_DC)
 }
 /* }}} */
 
-/* {{{ clm_setup_kernel() */
-static int clm_setup_kernel(clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_vector_width()
+   the vector width of the direct kernel for a device: the widest of 4, 8
+   and 16 pixels within both its preferred and its native width, 1 for
+   devices that do not gain from explicit vectors, which is most GPUs */
+static int clm_vector_width(cl_device_id device, cl_device_info param)
 {
+	cl_uint preferred = 1;
+	int width;
+
+	if (clGetDeviceInfo(device, param, sizeof(preferred), &preferred, NULL) != CL_SUCCESS) {
+		return 1;
+	}
+#ifdef CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT /* OpenCL 1.1 */
+	{
+		cl_uint native = preferred;
+		cl_device_info native_param = (param == CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE)
+			? CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE : CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT;
+
+		if (clGetDeviceInfo(device, native_param, sizeof(native), &native, NULL) == CL_SUCCESS
+			&& native > 0 && native < preferred
+		) {
+			preferred = native;
+		}
+	}
+#endif
+	for (width = CLM_MAX_VECTOR; width >= 4; width /= 2) {
+		if (preferred >= (cl_uint)width) {
+			return width;
+		}
+	}
+	return 1;
+}
+/* }}} */
+
+/* {{{ clm_setup_context()
+   the context and queues outlive the kernel variants built in them */
+static int clm_setup_context(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	cl_device_fp_config fp_config = 0;
 	cl_int err = CL_SUCCESS;
+	double start = clm_now();
 
-	ctx->context = clCreateContext(0, 1, &ctx->deviceList[ctx->deviceId], NULL, NULL, &err);
-	if (!ctx->context) {
+	dev->context = clCreateContext(0, 1, &ctx->device, NULL, NULL, &err);
+	if (!dev->context) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create context");
 		return FAILURE;
 	}
 
-	ctx->program = clCreateProgramWithSource(ctx->context, 1, &Mandelbrot_cl, NULL, &err);
-	if (err != CL_SUCCESS) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create program with source");
-		return FAILURE;
+	err = clGetDeviceInfo(ctx->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+	                      sizeof(dev->maxAlloc), &dev->maxAlloc, NULL);
+	if (err != CL_SUCCESS || dev->maxAlloc == 0) {
+		dev->maxAlloc = (cl_ulong)-1;
 	}
 
-	// compile
-	err = clBuildProgram(ctx->program, 0, NULL, NULL, NULL, NULL);
-	if (err != CL_SUCCESS) {
-		size_t len;
-		char info[2048];
-
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "Error: Failed to build program executable");
-		clGetProgramBuildInfo(ctx->program, ctx->deviceList[ctx->deviceId],
-		                      CL_PROGRAM_BUILD_LOG, sizeof(info), info, &len);
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "%s", info);
-		return FAILURE;
+	err = clGetDeviceInfo(ctx->device, CL_DEVICE_DOUBLE_FP_CONFIG,
+	                      sizeof(fp_config), &fp_config, NULL);
+	dev->hasDouble = (err == CL_SUCCESS && fp_config != 0);
+	if (clGetDeviceInfo(ctx->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(dev->localMem),
+	                    &dev->localMem, NULL) != CL_SUCCESS) {
+		dev->localMem = 0;
 	}
-
-	ctx->kernel = clCreateKernel(ctx->program, "Mandelbrot", &err);
-	if (!ctx->kernel || err != CL_SUCCESS) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create kernel");
+	dev->vectorFloat = clm_vector_width(ctx->device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT);
+	dev->vectorDouble = dev->hasDouble
+		? clm_vector_width(ctx->device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE) : 1;
+
+	/* event timestamps feed clmandelbrot_stats() */
+	dev->queue = clCreateCommandQueue(dev->context, ctx->device,
+	                                  CL_QUEUE_PROFILING_ENABLE, &err);
+	if (!dev->queue) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create command queue");
 		return FAILURE;
 	}
 
+	clm_prof_add(CLM_PROF_CONTEXT, clm_now() - start TSRMLS_CC);
 	return SUCCESS;
 }
 /* }}} */
@@ -645,82 +3078,402 @@ static int clm_setup_kernel(clmandelbrot_t *ctx TSRMLS_DC)
 /* {{{ clm_setup_queue() */
 static int clm_setup_queue(clmandelbrot_t *ctx TSRMLS_DC)
 {
-	cl_int err = CL_SUCCESS;
+	clm_device_t *dev = ctx->dev;
+	size_t pixels = (size_t)ctx->width * ctx->height;
+	size_t len = sizeof(cl_int) * pixels;
+	size_t tile = 0;
+
+	if (CLMANDELBROT_G(tileSize) > 0) {
+		tile = (size_t)CLMANDELBROT_G(tileSize);
+	} else if (len > dev->maxAlloc) {
+		tile = CLM_DEFAULT_TILE_SIZE;
+	}
+	if (tile && tile < pixels) {
+		ctx->tileRows = (int)(tile / ctx->width);
+		if (sizeof(cl_int) * ctx->width * (size_t)ctx->tileRows > dev->maxAlloc) {
+			ctx->tileRows = (int)(dev->maxAlloc / (sizeof(cl_int) * ctx->width));
+		}
+		if (ctx->tileRows < 1) {
+			ctx->tileRows = 1;
+		}
+		return clm_setup_tiles(ctx TSRMLS_CC);
+	}
 
-	ctx->queue = clCreateCommandQueue(ctx->context, ctx->deviceList[ctx->deviceId], 0, &err);
-	if (!ctx->queue) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create command queue");
-		return FAILURE;
+	/* the output buffer is only reallocated when it has to grow */
+	if (dev->output && dev->outputSize >= len) {
+		return SUCCESS;
+	}
+	if (dev->output) {
+		clReleaseMemObject(dev->output);
+		dev->output = NULL;
+		dev->outputSize = 0;
 	}
 
-	size_t len = sizeof(unsigned char) * ctx->width * ctx->height;
-	ctx->output = clCreateBuffer(ctx->context, CL_MEM_WRITE_ONLY, len, NULL, NULL);
-	if (!ctx->output) {
+	/* host-allocated, so that mapping it costs no copy where the device can
+	   write to host memory; gd rows are not contiguous, so the image itself
+	   cannot back the buffer */
+	dev->output = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+	                             len, NULL, NULL);
+	if (!dev->output) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
 		return FAILURE;
 	}
+	dev->outputSize = len;
 
 	return SUCCESS;
 }
 /* }}} */
 
-/* {{{ clm_execute() */
-static int clm_execute(clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_setup_tiles()
+   tile buffers live on the device only; the transfer queue lets the read
+   of one tile run while the compute queue works on the next one */
+static int clm_setup_tiles(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	size_t len = sizeof(cl_int) * ctx->width * ctx->tileRows;
+	int i;
+
+	if (clm_setup_io_queue(ctx TSRMLS_CC) == FAILURE) {
+		return FAILURE;
+	}
+
+	if (dev->tiles[0] && dev->tileSize >= len) {
+		return SUCCESS;
+	}
+
+	for (i = 0; i < CLM_TILE_DEPTH; i++) {
+		if (dev->tiles[i]) {
+			clReleaseMemObject(dev->tiles[i]);
+			dev->tiles[i] = NULL;
+		}
+	}
+	dev->tileSize = 0;
+
+	for (i = 0; i < CLM_TILE_DEPTH; i++) {
+		dev->tiles[i] = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, len, NULL, NULL);
+		if (!dev->tiles[i]) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create buffer");
+			return FAILURE;
+		}
+	}
+	dev->tileSize = len;
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_setup_io_queue()
+   the second queue of the device, used for reading results back */
+static int clm_setup_io_queue(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	cl_int err = CL_SUCCESS;
+
+	if (!dev->ioQueue) {
+		dev->ioQueue = clCreateCommandQueue(dev->context, ctx->device,
+		                                    CL_QUEUE_PROFILING_ENABLE, &err);
+		if (!dev->ioQueue) {
+			php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot create command queue");
+			return FAILURE;
+		}
+	}
+
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_set_real_arg()
+   sets a real or real2 kernel argument in the precision of the variant */
+cl_int clm_set_real_arg(clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index,
+                        const double *value, int count)
+{
+	cl_float f[2];
+	int i;
+
+	if (ctx->useDouble) {
+		return clSetKernelArg(kernel, index, sizeof(cl_double) * count, value);
+	}
+	for (i = 0; i < count; i++) {
+		f[i] = (cl_float)value[i];
+	}
+	return clSetKernelArg(kernel, index, sizeof(cl_float) * count, f);
+}
+/* }}} */
+
+/* {{{ clm_enqueue_rows()
+   enqueues the MandelbrotRGB kernel, or the perturbation one, for the rows
+   y0 .. y0 + rows - 1 in the launch shape tuned for the device */
+int clm_enqueue_rows(clmandelbrot_t *ctx, cl_command_queue queue, cl_kernel kernel,
+                     const clm_tuning_t *tuning, cl_mem output, int y0, int rows,
+                     cl_uint num_events, const cl_event *wait_list, cl_event *event TSRMLS_DC)
 {
 	cl_int err = CL_SUCCESS;
 
-	err |= clSetKernelArg(ctx->kernel, 0, sizeof(cl_mem), &ctx->output);
-	err |= clSetKernelArg(ctx->kernel, 1, sizeof(ctx->width), &ctx->width);
-	err |= clSetKernelArg(ctx->kernel, 2, sizeof(ctx->height), &ctx->height);
-	err |= clSetKernelArg(ctx->kernel, 3, sizeof(ctx->centerX), &ctx->centerX);
-	err |= clSetKernelArg(ctx->kernel, 4, sizeof(ctx->centerY), &ctx->centerY);
-	err |= clSetKernelArg(ctx->kernel, 5, sizeof(ctx->unit), &ctx->unit);
+	err |= clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+	err |= clSetKernelArg(kernel, 1, sizeof(ctx->width), &ctx->width);
+	err |= clSetKernelArg(kernel, 2, sizeof(ctx->height), &ctx->height);
+	err |= clSetKernelArg(kernel, 3, sizeof(y0), &y0);
+	if (ctx->precision == CLM_PRECISION_PERTURB) {
+		clm_perturb_t *perturb = &ctx->perturb;
+		err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &perturb->buffer);
+		err |= clSetKernelArg(kernel, 5, sizeof(perturb->length), &perturb->length);
+		err |= clSetKernelArg(kernel, 6, sizeof(perturb->skip), &perturb->skip);
+		err |= clm_set_real_arg(ctx, kernel, 7, &ctx->unit, 1);
+		err |= clm_set_real_arg(ctx, kernel, 8, &perturb->scale, 1);
+		err |= clm_set_real_arg(ctx, kernel, 9, &perturb->coeffs[0], 2);
+		err |= clm_set_real_arg(ctx, kernel, 10, &perturb->coeffs[2], 2);
+		err |= clm_set_real_arg(ctx, kernel, 11, &perturb->coeffs[4], 2);
+	} else {
+		err |= clm_set_real_arg(ctx, kernel, 4, &ctx->centerX, 1);
+		err |= clm_set_real_arg(ctx, kernel, 5, &ctx->centerY, 1);
+		err |= clm_set_real_arg(ctx, kernel, 6, &ctx->unit, 1);
+		err |= clSetKernelArg(kernel, 7, sizeof(rows), &rows);
+		if (ctx->adaptive) {
+			/* the shades of a work group and of the pixels around it */
+			err |= clSetKernelArg(kernel, 8, sizeof(cl_int) * (tuning->local[0] + 2)
+			                      * (tuning->local[1] + 2), NULL);
+		}
+	}
+	err |= clm_palette_args(ctx, kernel, (ctx->precision == CLM_PRECISION_PERTURB)
+	                        ? 12 : (ctx->adaptive ? 9 : 8));
 	if (err != CL_SUCCESS) {
 		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot set kernel argument(s)");
 		return FAILURE;
 	}
 
-	size_t local;
-	err = clGetKernelWorkGroupInfo(ctx->kernel, ctx->deviceList[ctx->deviceId],
-	                               CL_KERNEL_WORK_GROUP_SIZE,
-	                               sizeof(local), &local, NULL);
+	if (ctx->precision == CLM_PRECISION_PERTURB) {
+		err = clm_enqueue_1d(queue, kernel, (size_t)ctx->width * rows, tuning->local[0],
+		                     num_events, wait_list, event);
+	} else {
+		/* columns and rows padded to whole work groups; the kernel skips
+		   the padding and loops over the row when it has fewer columns */
+		size_t step = (size_t)tuning->pixels * MAX(ctx->vectorWidth, 1);
+		size_t cols = (ctx->width + step - 1) / step;
+		size_t global[2];
+
+		global[0] = (cols + tuning->local[0] - 1) / tuning->local[0] * tuning->local[0];
+		global[1] = (rows + tuning->local[1] - 1) / tuning->local[1] * tuning->local[1];
+		err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, tuning->local,
+		                             num_events, wait_list, event);
+	}
 	if (err != CL_SUCCESS) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot get kernel work group info");
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
 		return FAILURE;
 	}
 
-	size_t global = ctx->width * ctx->height;
-	err = clEnqueueNDRangeKernel(ctx->queue, ctx->kernel, 1, NULL,
-	                             &global, &local, 0, NULL, NULL);
-	if (err) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue ND range kernel");
-		return FAILURE;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ clm_queue_has_offset()
+   global work offsets came with OpenCL 1.1 */
+static zend_bool clm_queue_has_offset(cl_command_queue queue)
+{
+	cl_device_id device;
+	char version[64] = "";
+	int major = 0, minor = 0;
+
+	if (clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL) != CL_SUCCESS
+		|| clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version) - 1, version, NULL) != CL_SUCCESS
+		|| sscanf(version, "OpenCL %d.%d", &major, &minor) != 2
+	) {
+		return 0;
 	}
+	return (major > 1 || (major == 1 && minor >= 1));
+}
+/* }}} */
 
-	clFinish(ctx->queue);
+/* {{{ clm_enqueue_1d()
+   launches the whole work groups of a 1D range, then the remainder with an
+   offset in a group of its own; the event is that of the last launch,
+   which the in-order queue completes after the first. OpenCL 1.0 devices
+   have no offsets and pick a group size that divides the range instead */
+cl_int clm_enqueue_1d(cl_command_queue queue, cl_kernel kernel, size_t global, size_t local,
+                      cl_uint num_events, const cl_event *wait_list, cl_event *event)
+{
+	size_t whole = global / local * local;
+	size_t rest = global - whole;
+	cl_int err;
+
+	if (whole == 0 || rest == 0) {
+		return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, whole ? &local : &rest,
+		                              num_events, wait_list, event);
+	}
+	if (!clm_queue_has_offset(queue)) {
+		return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL,
+		                              num_events, wait_list, event);
+	}
 
-	size_t len = sizeof(unsigned char) * ctx->width * ctx->height;
-	err = clEnqueueReadBuffer(ctx->queue, ctx->output, CL_TRUE, 0,
-	                          len, ctx->bitmap, 0, NULL, NULL);
+	err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &whole, &local,
+	                             num_events, wait_list, NULL);
 	if (err != CL_SUCCESS) {
-		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue read buffer");
+		return err;
+	}
+	return clEnqueueNDRangeKernel(queue, kernel, 1, &whole, &rest, &rest, 0, NULL, event);
+}
+/* }}} */
+
+/* {{{ clm_execute() */
+static int clm_execute(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	cl_event kernel = NULL, map = NULL;
+	cl_int err = CL_SUCCESS;
+	cl_int *rgb;
+
+	/* subdivision and progressive passes need the whole image in one
+	   buffer, and the perturbation kernel has no border or strided variant */
+	if (ctx->tileRows || ctx->precision == CLM_PRECISION_PERTURB) {
+		ctx->mode = CLM_MODE_DIRECT;
+	}
+
+	if (ctx->tileRows) {
+		return clm_execute_tiled(ctx TSRMLS_CC);
+	}
+	if (ctx->mode == CLM_MODE_PROGRESSIVE) {
+		return clm_progressive(ctx TSRMLS_CC);
+	}
+
+	if (ctx->mode == CLM_MODE_SUBDIVIDE) {
+		if (clm_subdivide(ctx TSRMLS_CC) == FAILURE) {
+			return FAILURE;
+		}
+	} else if (clm_enqueue_rows(ctx, dev->queue, ctx->variant->kernels[0],
+	                            &ctx->variant->tuning[0], dev->output,
+	                            0, ctx->height, 0, NULL, &kernel TSRMLS_CC) == FAILURE) {
 		return FAILURE;
 	}
+	if (ctx->equalize && clm_equalize(ctx, dev->output TSRMLS_CC) == FAILURE) {
+		clm_prof_release(CLM_PROF_KERNEL, kernel TSRMLS_CC);
+		return FAILURE;
+	}
+
+	size_t len = sizeof(cl_int) * ctx->width * ctx->height;
+	rgb = clEnqueueMapBuffer(dev->queue, dev->output, CL_TRUE, CL_MAP_READ,
+	                         0, len, 0, NULL, &map, &err);
+	clm_prof_release(CLM_PROF_KERNEL, kernel TSRMLS_CC);
+	if (!rgb || err != CL_SUCCESS) {
+		php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot map output buffer");
+		return FAILURE;
+	}
+	clm_prof_release(CLM_PROF_TRANSFER, map TSRMLS_CC);
+
+	clm_draw(rgb, 0, ctx->height, ctx TSRMLS_CC);
+
+	clEnqueueUnmapMemObject(dev->queue, dev->output, rgb, 0, NULL, NULL);
 
 	return SUCCESS;
 }
 /* }}} */
 
-/* {{{ clm_draw() */
-static void clm_draw(gdImagePtr im, clmandelbrot_t *ctx TSRMLS_DC)
+/* {{{ clm_execute_tiled()
+   tile t is computed into buffer t % CLM_TILE_DEPTH and read back without
+   blocking; the host draws tile t - 2 meanwhile, so compute, transfer and
+   drawing of three consecutive tiles overlap */
+static int clm_execute_tiled(clmandelbrot_t *ctx TSRMLS_DC)
+{
+	clm_device_t *dev = ctx->dev;
+	const int lag = CLM_TILE_DEPTH - 1;
+	int tiles = (ctx->height + ctx->tileRows - 1) / ctx->tileRows;
+	cl_event kernels[CLM_TILE_DEPTH] = { NULL };
+	cl_event reads[CLM_TILE_DEPTH] = { NULL };
+	int *host[CLM_TILE_DEPTH] = { NULL };
+	int result = SUCCESS;
+	int t, i;
+
+	for (i = 0; i < CLM_TILE_DEPTH; i++) {
+		host[i] = safe_emalloc(ctx->tileRows, sizeof(int) * ctx->width, 0);
+	}
+
+	for (t = 0; t < tiles + lag; t++) {
+		if (t < tiles) {
+			int slot = t % CLM_TILE_DEPTH;
+			int y0 = t * ctx->tileRows;
+			int rows = MIN(ctx->tileRows, ctx->height - y0);
+			cl_event previous = reads[slot];
+			cl_int err;
+
+			/* the buffer must have been read out before it is overwritten */
+			if (kernels[slot]) {
+				clm_prof_release(CLM_PROF_KERNEL, kernels[slot] TSRMLS_CC);
+				kernels[slot] = NULL;
+			}
+			if (clm_enqueue_rows(ctx, dev->queue, ctx->variant->kernels[0],
+			                     &ctx->variant->tuning[0],
+			                     dev->tiles[slot], y0, rows,
+			                     previous ? 1 : 0, previous ? &previous : NULL,
+			                     &kernels[slot] TSRMLS_CC) == FAILURE) {
+				result = FAILURE;
+				break;
+			}
+			if (previous) {
+				clm_prof_release(CLM_PROF_TRANSFER, previous TSRMLS_CC);
+				reads[slot] = NULL;
+			}
+
+			err = clEnqueueReadBuffer(dev->ioQueue, dev->tiles[slot], CL_FALSE, 0,
+			                          sizeof(cl_int) * ctx->width * rows, host[slot],
+			                          1, &kernels[slot], &reads[slot]);
+			if (err != CL_SUCCESS) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot enqueue read buffer");
+				result = FAILURE;
+				break;
+			}
+			clFlush(dev->queue);
+			clFlush(dev->ioQueue);
+		}
+
+		if (t >= lag) {
+			int done = t - lag;
+			int slot = done % CLM_TILE_DEPTH;
+			int y0 = done * ctx->tileRows;
+
+			if (clWaitForEvents(1, &reads[slot]) != CL_SUCCESS) {
+				php_error_docref(NULL TSRMLS_CC, E_WARNING, "cannot read tile #%d", done);
+				result = FAILURE;
+				break;
+			}
+			clm_draw(host[slot], y0, MIN(ctx->tileRows, ctx->height - y0), ctx TSRMLS_CC);
+		}
+	}
+
+	/* nothing may still write into the host buffers once they are freed */
+	clFinish(dev->queue);
+	clFinish(dev->ioQueue);
+
+	for (i = 0; i < CLM_TILE_DEPTH; i++) {
+		clm_prof_release(CLM_PROF_KERNEL, kernels[i] TSRMLS_CC);
+		clm_prof_release(CLM_PROF_TRANSFER, reads[i] TSRMLS_CC);
+		efree(host[i]);
+	}
+
+	return result;
+}
+/* }}} */
+
+/* {{{ clm_draw()
+   copies packed truecolor rows into the image starting at row y0, or
+   their shades into ctx->bitmap when the render has no image */
+void clm_draw(const int *rgb, int y0, int rows, clmandelbrot_t *ctx TSRMLS_DC)
 {
-	int x, y;
-	for (y = 0; y < ctx->height; y++) {
-		for (x = 0; x < ctx->width; x++) {
-			int c = (int)ctx->bitmap[x + y * ctx->height];
-			im->tpixels[y][x] = gdTrueColor(c, c, c);
+	size_t pitch = sizeof(int) * ctx->width;
+	double start = clm_now();
+	int y;
+
+	if (!ctx->pixels) {
+		unsigned char *out = ctx->bitmap + (size_t)y0 * ctx->width;
+		size_t i, len = (size_t)rows * ctx->width;
+
+		for (i = 0; i < len; i++) {
+			out[i] = (unsigned char)(rgb[i] & 0xff);
+		}
+	} else {
+		for (y = 0; y < rows; y++) {
+			memcpy(ctx->pixels[y0 + y], rgb + (size_t)y * ctx->width, pitch);
 		}
 	}
+
+	clm_prof_add(CLM_PROF_DRAW, clm_now() - start TSRMLS_CC);
 }
 /* }}} */
 
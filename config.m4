@@ -17,8 +17,11 @@ if test "$PHP_CLMANDELBROT" != "no"; then
   export CPPFLAGS="$OLD_CPPFLAGS"
 
   PHP_EVAL_LIBLINE([-L. -lOpenCL], CLMANDELBROT_SHARED_LIBADD)
+  PHP_ADD_LIBRARY(pthread, 1, CLMANDELBROT_SHARED_LIBADD)
+  PHP_ADD_LIBRARY(z, 1, CLMANDELBROT_SHARED_LIBADD)
   PHP_SUBST(CLMANDELBROT_SHARED_LIBADD)
   AC_DEFINE(HAVE_CLMANDELBROT, 1, [ ])
 
-  PHP_NEW_EXTENSION(clmandelbrot, clmandelbrot.c , $ext_shared)
+  PHP_NEW_EXTENSION(clmandelbrot, clmandelbrot.c clm_binary_cache.c clm_cpu.c clm_multi.c clm_variant.c clm_perturb.c clm_subdivide.c clm_shm_cache.c clm_progressive.c clm_encode.c clm_prof.c clm_autotune.c clm_palette.c clm_equalize.c clm_viewport.c, $ext_shared)
+  PHP_ADD_MAKEFILE_FRAGMENT
 fi
@@ -1,11 +1,277 @@
-static const char *Mandelbrot_cl = "__kernel\n"
+static const char *Mandelbrot_cl = "#pragma OPENCL FP_CONTRACT OFF\n"
+"\n"
+"/* specialization parameters, set with -D when the program is built */\n"
+"#ifndef CLM_ITERATIONS\n"
+"#define CLM_ITERATIONS 200\n"
+"#endif\n"
+"#ifndef CLM_BAILOUT\n"
+"#define CLM_BAILOUT 4.0f\n"
+"#endif\n"
+"\n"
+"#ifdef CLM_DOUBLE\n"
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+"typedef double real;\n"
+"typedef double2 real2;\n"
+"#else\n"
+"typedef float real;\n"
+"typedef float2 real2;\n"
+"#endif\n"
+"\n"
+"/* with CLM_PALETTE the kernels writing packed pixels take the palette, an\n"
+"   array of colors packed gd truecolor values in constant memory, as their\n"
+"   last two arguments */\n"
+"#ifdef CLM_PALETTE\n"
+"#define CLM_PALETTE_PARAMS , __constant int *palette, const int colors\n"
+"#define CLM_PALETTE_ARGS , palette, colors\n"
+"#else\n"
+"#define CLM_PALETTE_PARAMS\n"
+"#define CLM_PALETTE_ARGS\n"
+"#endif\n"
+"\n"
+"/* analytic test for the main cardioid and the period-2 bulb */\n"
+"int MandelbrotInterior(const real fx, const real fy)\n"
+"{\n"
+"  real xq = fx - (real)0.25;\n"
+"  real q = xq * xq + fy * fy;\n"
+"  if ( q * (q + xq) <= (real)0.25 * fy * fy ) { return 1; }\n"
+"  real xb = fx + 1;\n"
+"  if ( xb * xb + fy * fy <= (real)0.0625 ) { return 1; }\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* the number of iterations before the point fx + fy i escapes, with\n"
+"   |z|^2 at that moment in mag; CLM_ITERATIONS for points that do not */\n"
+"int MandelbrotEscape(const real fx, const real fy, real *mag)\n"
+"{\n"
+"  real r = fx;\n"
+"  real i = fy;\n"
+"  int n;\n"
+"  int m = CLM_ITERATIONS;\n"
+"#ifdef CLM_PERIODICITY\n"
+"  /* Brent: an orbit that returns exactly to a saved point is periodic and\n"
+"     never escapes; the saved point moves at doubling intervals */\n"
+"  real sr = r;\n"
+"  real si = i;\n"
+"  int step = 0;\n"
+"  int period = 16;\n"
+"#endif\n"
+"#ifdef CLM_INTERIOR_CHECK\n"
+"  if ( MandelbrotInterior(fx, fy) ) { n = m; } else\n"
+"#endif\n"
+"  for (n = 0; n < m; n++) {\n"
+"    real rr = r * r;\n"
+"    real ii = i * i;\n"
+"    real ri = r * i;\n"
+"    r = fx + rr - ii;\n"
+"    i = fy + 2 * ri;\n"
+"    if ( rr + ii > CLM_BAILOUT ) { *mag = rr + ii; break; }\n"
+"#ifdef CLM_PERIODICITY\n"
+"    if ( r == sr && i == si ) { n = m; break; }\n"
+"    if ( ++step == period ) {\n"
+"      step = 0;\n"
+"      period *= 2;\n"
+"      sr = r;\n"
+"      si = i;\n"
+"    }\n"
+"#endif\n"
+"  }\n"
+"  return n;\n"
+"}\n"
+"\n"
+"/* the gray shade of n iterations */\n"
+"int MandelbrotGray(const int n)\n"
+"{\n"
+"  int m = CLM_ITERATIONS;\n"
+"  float fval = (float)n / (float)m;\n"
+"  int ival = 256 * fval;\n"
+"  if (ival < 0) { ival = 0; }\n"
+"  if (ival > 255) { ival = 255; }\n"
+"  return ival;\n"
+"}\n"
+"\n"
+"/* the shade of the point fx + fy i */\n"
+"int MandelbrotPoint(const real fx, const real fy)\n"
+"{\n"
+"  real mag = 0;\n"
+"  return MandelbrotGray(MandelbrotEscape(fx, fy, &mag));\n"
+"}\n"
+"\n"
+"/* the shade of the center of pixel ix, iy */\n"
+"int MandelbrotShade(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
+"{\n"
+"  real fx = (real)(ix - w / 2) * unit + cx;\n"
+"  real fy = (real)(iy - h / 2) * unit + cy;\n"
+"\n"
+"  return MandelbrotPoint(fx, fy);\n"
+"}\n"
+"\n"
+"#ifdef CLM_SAMPLES\n"
+"/* antialiasing: the rounded mean shade of CLM_SAMPLES x CLM_SAMPLES points\n"
+"   spread evenly over the pixel */\n"
+"int MandelbrotSupersample(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
+"{\n"
+"  const real step = (real)1 / (2 * CLM_SAMPLES);\n"
+"  int sum = 0;\n"
+"\n"
+"  for (int sy = 0; sy < CLM_SAMPLES; sy++) {\n"
+"    real fy = ((real)(iy - h / 2) + (real)(2 * sy + 1 - CLM_SAMPLES) * step) * unit + cy;\n"
+"    for (int sx = 0; sx < CLM_SAMPLES; sx++) {\n"
+"      real fx = ((real)(ix - w / 2) + (real)(2 * sx + 1 - CLM_SAMPLES) * step) * unit + cx;\n"
+"      sum += MandelbrotPoint(fx, fy);\n"
+"    }\n"
+"  }\n"
+"  return (sum + CLM_SAMPLES * CLM_SAMPLES / 2) / (CLM_SAMPLES * CLM_SAMPLES);\n"
+"}\n"
+"#endif\n"
+"\n"
+"/* the shade of pixel ix, iy as rendered: supersampled unless antialiasing\n"
+"   is off or left to MandelbrotAdaptiveRGB */\n"
+"int MandelbrotPixel(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
+"{\n"
+"#if defined(CLM_SAMPLES) && !defined(CLM_ADAPTIVE)\n"
+"  return MandelbrotSupersample(ix, iy, w, h, cx, cy, unit);\n"
+"#else\n"
+"  return MandelbrotShade(ix, iy, w, h, cx, cy, unit);\n"
+"#endif\n"
+"}\n"
+"\n"
+"/* the packed gd truecolor of n iterations escaping with |z|^2 = mag: the\n"
+"   gray shade, or the palette interpolated at n / CLM_ITERATIONS; with\n"
+"   CLM_SMOOTH n is the normalized count n + 1 - log2(log |z|), which is\n"
+"   continuous across the escape count bands */\n"
+"int MandelbrotRGBOf(const int n, const real mag CLM_PALETTE_PARAMS)\n"
+"{\n"
+"#if defined(CLM_EQUALIZE)\n"
+"  /* left for MandelbrotEqualize */\n"
+"  return n;\n"
+"#elif defined(CLM_PALETTE)\n"
+"  float mu = (float)n;\n"
+"#ifdef CLM_SMOOTH\n"
+"  if ( n < CLM_ITERATIONS && mag > 1 ) { mu += 1.0f - log2(0.5f * log((float)mag)); }\n"
+"#endif\n"
+"  float p = clamp(mu / (float)CLM_ITERATIONS, 0.0f, 1.0f) * (float)(colors - 1);\n"
+"  int k = min((int)p, colors - 2);\n"
+"  float f = p - (float)k;\n"
+"  int a = palette[k];\n"
+"  int b = palette[k + 1];\n"
+"  int rgb = 0;\n"
+"  for (int s = 0; s <= 16; s += 8) {\n"
+"    float ca = (float)((a >> s) & 0xff);\n"
+"    float cb = (float)((b >> s) & 0xff);\n"
+"    rgb |= (int)(ca + (cb - ca) * f + 0.5f) << s;\n"
+"  }\n"
+"  return rgb;\n"
+"#else\n"
+"  int c = MandelbrotGray(n);\n"
+"  return (c << 16) | (c << 8) | c;\n"
+"#endif\n"
+"}\n"
+"\n"
+"/* the packed colour of the point fx + fy i */\n"
+"int MandelbrotPointRGB(const real fx, const real fy CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  real mag = 0;\n"
+"  int n = MandelbrotEscape(fx, fy, &mag);\n"
+"  return MandelbrotRGBOf(n, mag CLM_PALETTE_ARGS);\n"
+"}\n"
+"\n"
+"/* the packed colour of the center of pixel ix, iy */\n"
+"int MandelbrotShadeRGB(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  real fx = (real)(ix - w / 2) * unit + cx;\n"
+"  real fy = (real)(iy - h / 2) * unit + cy;\n"
+"\n"
+"  return MandelbrotPointRGB(fx, fy CLM_PALETTE_ARGS);\n"
+"}\n"
+"\n"
+"#ifdef CLM_SAMPLES\n"
+"/* MandelbrotSupersample for packed colours, channel by channel */\n"
+"int MandelbrotSupersampleRGB(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  const real step = (real)1 / (2 * CLM_SAMPLES);\n"
+"  const int count = CLM_SAMPLES * CLM_SAMPLES;\n"
+"  int r = 0, g = 0, b = 0;\n"
+"\n"
+"  for (int sy = 0; sy < CLM_SAMPLES; sy++) {\n"
+"    real fy = ((real)(iy - h / 2) + (real)(2 * sy + 1 - CLM_SAMPLES) * step) * unit + cy;\n"
+"    for (int sx = 0; sx < CLM_SAMPLES; sx++) {\n"
+"      real fx = ((real)(ix - w / 2) + (real)(2 * sx + 1 - CLM_SAMPLES) * step) * unit + cx;\n"
+"      int c = MandelbrotPointRGB(fx, fy CLM_PALETTE_ARGS);\n"
+"      r += (c >> 16) & 0xff;\n"
+"      g += (c >> 8) & 0xff;\n"
+"      b += c & 0xff;\n"
+"    }\n"
+"  }\n"
+"  r = (r + count / 2) / count;\n"
+"  g = (g + count / 2) / count;\n"
+"  b = (b + count / 2) / count;\n"
+"  return (r << 16) | (g << 8) | b;\n"
+"}\n"
+"#endif\n"
+"\n"
+"/* MandelbrotPixel for packed colours */\n"
+"int MandelbrotPixelRGB(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"#if defined(CLM_SAMPLES) && !defined(CLM_ADAPTIVE)\n"
+"  return MandelbrotSupersampleRGB(ix, iy, w, h, cx, cy, unit CLM_PALETTE_ARGS);\n"
+"#else\n"
+"  return MandelbrotShadeRGB(ix, iy, w, h, cx, cy, unit CLM_PALETTE_ARGS);\n"
+"#endif\n"
+"}\n"
+"\n"
+"__kernel\n"
 "void Mandelbrot(\n"
 "  __global unsigned char *output,\n"
 "  const int w,\n"
 "  const int h,\n"
-"  const float cx,\n"
-"  const float cy,\n"
-"  const float unit)\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
 "{\n"
 "  int globalID = get_global_id(0);\n"
 "  int ox = globalID % w;\n"
@@ -13,26 +279,739 @@ static const char *Mandelbrot_cl = "__kernel\n"
 "  int ix = ox;\n"
 "  int iy = h - 1 - oy;\n"
 "\n"
-"  if ( ix >= w || iy >= h ) { return; }\n"
-"  float fx = (float)(ix - w / 2) * unit + cx;\n"
-"  float fy = (float)(iy - h / 2) * unit + cy;\n"
+"  if ( ix >= w || iy < 0 ) { return; }\n"
+"  output[ox + oy * w] = (unsigned char)MandelbrotPixel(ix, iy, w, h, cx, cy, unit);\n"
+"}\n"
 "\n"
-"  float r = fx;\n"
-"  float i = fy;\n"
-"  int n;\n"
-"  int m = 200;\n"
-"  for (n = 0; n < m; n++) {\n"
-"    float rr = r * r;\n"
-"    float ii = i * i;\n"
-"    float ri = r * i;\n"
+"/* writes packed gd truecolor pixels for the rows y0 .. y0 + rows - 1 on a\n"
+"   2D range of one work item per rows * columns; the range may be padded\n"
+"   to whole work groups, and may be narrower than a row, in which case a\n"
+"   work item computes every get_global_size(0)-th pixel of its row */\n"
+"__kernel\n"
+"void MandelbrotRGB(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int y0,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  const int rows\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  int oy = get_global_id(1);\n"
+"  int iy = h - 1 - (y0 + oy);\n"
+"\n"
+"  if ( oy >= rows || iy < 0 ) { return; }\n"
+"  for (int ox = get_global_id(0); ox < w; ox += get_global_size(0)) {\n"
+"    output[ox + oy * w] = MandelbrotPixelRGB(ox, iy, w, h, cx, cy, unit CLM_PALETTE_ARGS);\n"
+"  }\n"
+"}\n"
+"\n"
+"#ifdef CLM_VECTOR\n"
+"/* explicit vectors of CLM_VECTOR (4, 8 or 16) horizontally adjacent\n"
+"   pixels; a comparison yields -1 in every lane where it holds */\n"
+"#define CLM_PASTE(a, b) a ## b\n"
+"#define CLM_VEC(t, n) CLM_PASTE(t, n)\n"
+"#define CLM_V(t) CLM_VEC(t, CLM_VECTOR)\n"
+"#ifdef CLM_DOUBLE\n"
+"typedef CLM_V(double) realv;\n"
+"typedef CLM_V(long) maskv;\n"
+"#define convert_realv CLM_V(convert_double)\n"
+"#else\n"
+"typedef CLM_V(float) realv;\n"
+"typedef CLM_V(int) maskv;\n"
+"#define convert_realv CLM_V(convert_float)\n"
+"#endif\n"
+"typedef CLM_V(int) intv;\n"
+"typedef CLM_V(float) floatv;\n"
+"#define convert_intv CLM_V(convert_int)\n"
+"#define convert_floatv CLM_V(convert_float)\n"
+"#define vstorev CLM_V(vstore)\n"
+"#if CLM_VECTOR == 4\n"
+"#define CLM_LANES (intv)(0, 1, 2, 3)\n"
+"#elif CLM_VECTOR == 8\n"
+"#define CLM_LANES (intv)(0, 1, 2, 3, 4, 5, 6, 7)\n"
+"#elif CLM_VECTOR == 16\n"
+"#define CLM_LANES (intv)(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)\n"
+"#else\n"
+"#error CLM_VECTOR must be 4, 8 or 16\n"
+"#endif\n"
+"\n"
+"/* MandelbrotShade for the pixels ix .. ix + CLM_VECTOR - 1 of one row: a\n"
+"   lane drops out of the active mask when its orbit escapes or cycles and\n"
+"   keeps its count from then on, so every lane performs exactly the\n"
+"   arithmetic of the scalar loop; the loop ends once no lane is active */\n"
+"intv MandelbrotShadeVec(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
+"{\n"
+"  realv fx = convert_realv((intv)(ix - w / 2) + CLM_LANES) * unit + cx;\n"
+"  real fy = (real)(iy - h / 2) * unit + cy;\n"
+"\n"
+"  realv r = fx;\n"
+"  realv i = (realv)(fy);\n"
+"  int m = CLM_ITERATIONS;\n"
+"  intv n = (intv)(m);\n"
+"  maskv active = (maskv)(-1);\n"
+"#ifdef CLM_PERIODICITY\n"
+"  realv sr = r;\n"
+"  realv si = i;\n"
+"  int step = 0;\n"
+"  int period = 16;\n"
+"#endif\n"
+"#ifdef CLM_INTERIOR_CHECK\n"
+"  realv xq = fx - (real)0.25;\n"
+"  realv q = xq * xq + fy * fy;\n"
+"  realv xb = fx + 1;\n"
+"  active = ~((q * (q + xq) <= (real)0.25 * fy * fy) | (xb * xb + fy * fy <= (real)0.0625));\n"
+"#endif\n"
+"  for (int k = 0; k < m && any(active); k++) {\n"
+"    realv rr = r * r;\n"
+"    realv ii = i * i;\n"
+"    realv ri = r * i;\n"
 "    r = fx + rr - ii;\n"
 "    i = fy + 2 * ri;\n"
-"    if ( rr + ii > 4 ) { break; }\n"
+"    maskv escaped = active & (rr + ii > CLM_BAILOUT);\n"
+"    n = select(n, (intv)(k), convert_intv(escaped));\n"
+"    active &= ~escaped;\n"
+"#ifdef CLM_PERIODICITY\n"
+"    /* cycling lanes keep n = m */\n"
+"    active &= ~((r == sr) & (i == si));\n"
+"    if ( ++step == period ) {\n"
+"      step = 0;\n"
+"      period *= 2;\n"
+"      sr = r;\n"
+"      si = i;\n"
+"    }\n"
+"#endif\n"
 "  }\n"
-"  float fval = (float)n / (float)m;\n"
-"  int ival = 256 * fval;\n"
-"  if (ival < 0) { ival = 0; }\n"
-"  if (ival > 255) { ival = 255; }\n"
+"  floatv fval = convert_floatv(n) / (float)m;\n"
+"  intv ival = convert_intv(256 * fval);\n"
+"  return clamp(ival, 0, 255);\n"
+"}\n"
+"\n"
+"/* MandelbrotRGB with CLM_VECTOR pixels per work item and step; the lanes\n"
+"   past the end of a row are computed but not stored */\n"
+"__kernel\n"
+"void MandelbrotRGBVec(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int y0,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  const int rows)\n"
+"{\n"
+"  int oy = get_global_id(1);\n"
+"  int iy = h - 1 - (y0 + oy);\n"
+"\n"
+"  if ( oy >= rows || iy < 0 ) { return; }\n"
+"  for (int ox = get_global_id(0) * CLM_VECTOR; ox < w; ox += get_global_size(0) * CLM_VECTOR) {\n"
+"    intv c = MandelbrotShadeVec(ox, iy, w, h, cx, cy, unit);\n"
+"    c = (c << 16) | (c << 8) | c;\n"
+"    if ( ox + CLM_VECTOR <= w ) {\n"
+"      vstorev(c, 0, output + ox + oy * w);\n"
+"    } else {\n"
+"      int tail[CLM_VECTOR];\n"
+"      vstorev(c, 0, tail);\n"
+"      for (int l = 0; ox + l < w; l++) { output[ox + l + oy * w] = tail[l]; }\n"
+"    }\n"
+"  }\n"
+"}\n"
+"#endif\n"
+"\n"
+"#ifdef CLM_ADAPTIVE\n"
+"/* adaptive antialiasing: a work group computes the plain colours of its\n"
+"   pixels and of a one pixel border around them into shades, which holds\n"
+"   (local size + 2) squared entries, and supersamples only the pixels with\n"
+"   a neighbour of another colour. The neighbours are those of the image, not\n"
+"   of the rows y0 .. y0 + rows - 1, so the image does not depend on how it\n"
+"   is split. Every work item of a group runs the loop over the row the\n"
+"   same number of times, as the barriers require */\n"
+"__kernel\n"
+"void MandelbrotAdaptiveRGB(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int y0,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  const int rows,\n"
+"  __local int *shades\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  const int lw = get_local_size(0) + 2;\n"
+"  const int cells = lw * (get_local_size(1) + 2);\n"
+"  const int items = get_local_size(0) * get_local_size(1);\n"
+"  const int id = get_local_id(1) * get_local_size(0) + get_local_id(0);\n"
+"  const int top = y0 + (int)(get_group_id(1) * get_local_size(1)) - 1;\n"
+"  const int at = (get_local_id(1) + 1) * lw + get_local_id(0) + 1;\n"
+"  const int oy = get_global_id(1);\n"
+"\n"
+"  for (int left = (int)(get_group_id(0) * get_local_size(0)) - 1; left + 1 < w;\n"
+"       left += get_global_size(0)) {\n"
+"    for (int k = id; k < cells; k += items) {\n"
+"      int px = left + k % lw;\n"
+"      int py = top + k / lw;\n"
+"      shades[k] = (px >= 0 && px < w && py >= 0 && py < h)\n"
+"        ? MandelbrotShadeRGB(px, h - 1 - py, w, h, cx, cy, unit CLM_PALETTE_ARGS) : -1;\n"
+"    }\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"\n"
+"    int ox = left + 1 + get_local_id(0);\n"
+"    if ( ox < w && oy < rows && y0 + oy < h ) {\n"
+"      int c = shades[at];\n"
+"      int l = shades[at - 1], r = shades[at + 1], u = shades[at - lw], d = shades[at + lw];\n"
+"      if ( (l >= 0 && l != c) || (r >= 0 && r != c) || (u >= 0 && u != c) || (d >= 0 && d != c) ) {\n"
+"        c = MandelbrotSupersampleRGB(ox, h - 1 - (y0 + oy), w, h, cx, cy, unit CLM_PALETTE_ARGS);\n"
+"      }\n"
+"      output[ox + oy * w] = c;\n"
+"    }\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  }\n"
+"}\n"
+"#endif\n"
+"\n"
+"/* progressive rendering: one pass computes the shades of every stride-th\n"
+"   pixel of every stride-th row into a bitmap kept across the passes. A\n"
+"   refining pass skips the pixels of the pass with twice the stride, so\n"
+"   rows of its lattice come in pairs: the odd columns of the even row,\n"
+"   then all columns of the odd row */\n"
+"__kernel\n"
+"void MandelbrotStride(\n"
+"  __global unsigned char *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int stride,\n"
+"  const int refine,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int cols = (w + stride - 1) / stride;\n"
+"  int gx = globalID % cols;\n"
+"  int gy = globalID / cols;\n"
+"\n"
+"  if ( refine ) {\n"
+"    int odd = cols / 2;\n"
+"    int pair = globalID / (odd + cols);\n"
+"    int r = globalID % (odd + cols);\n"
+"    if ( r < odd ) {\n"
+"      gx = 2 * r + 1;\n"
+"      gy = 2 * pair;\n"
+"    } else {\n"
+"      gx = r - odd;\n"
+"      gy = 2 * pair + 1;\n"
+"    }\n"
+"  }\n"
+"\n"
+"  int ox = gx * stride;\n"
+"  int oy = gy * stride;\n"
+"  if ( oy >= h ) { return; }\n"
+"  output[ox + oy * w] = (unsigned char)MandelbrotPixel(ox, h - 1 - oy, w, h, cx, cy, unit);\n"
+"}\n"
+"\n"
+"/* renders map tiles of size x size pixels in one launch: tile t is\n"
+"   centered at centers[t] and written to output + t * size * size, with\n"
+"   the same arithmetic as a single MandelbrotRGB render of the tile */\n"
+"__kernel\n"
+"void MandelbrotTileSetRGB(\n"
+"  __global int *output,\n"
+"  const int size,\n"
+"  __global const real2 *centers,\n"
+"  const real unit\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int t = globalID / (size * size);\n"
+"  int p = globalID % (size * size);\n"
+"  int ox = p % size;\n"
+"  int oy = p / size;\n"
+"  real2 center = centers[t];\n"
+"\n"
+"  output[globalID] = MandelbrotPixelRGB(ox, size - 1 - oy, size, size,\n"
+"                                        center.x, center.y, unit CLM_PALETTE_ARGS);\n"
+"}\n"
+"\n"
+"/* perturbation against a reference orbit computed on the host: each pixel\n"
+"   iterates its offset from the orbit, starting from the series\n"
+"   approximation a u + b u^2 + c u^3 after skip iterations, and moves back\n"
+"   to the start of the orbit whenever that keeps the offset smaller */\n"
+"__kernel\n"
+"void MandelbrotPerturbRGB(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int y0,\n"
+"  __global const real2 *orbit,\n"
+"  const int length,\n"
+"  const int skip,\n"
+"  const real unit,\n"
+"  const real scale,\n"
+"  const real2 a,\n"
+"  const real2 b,\n"
+"  const real2 c\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int ox = globalID % w;\n"
+"  int oy = y0 + globalID / w;\n"
+"  int ix = ox;\n"
+"  int iy = h - 1 - oy;\n"
+"\n"
+"  if ( ix >= w || iy < 0 ) { return; }\n"
+"\n"
+"  real dcr = (real)(ix - w / 2) * unit;\n"
+"  real dci = (real)(iy - h / 2) * unit;\n"
+"  real ur = (real)(ix - w / 2) * scale;\n"
+"  real ui = (real)(iy - h / 2) * scale;\n"
+"  real u2r = ur * ur - ui * ui;\n"
+"  real u2i = 2 * ur * ui;\n"
+"  real u3r = u2r * ur - u2i * ui;\n"
+"  real u3i = u2r * ui + u2i * ur;\n"
+"  real dr = a.x * ur - a.y * ui + b.x * u2r - b.y * u2i + c.x * u3r - c.y * u3i;\n"
+"  real di = a.x * ui + a.y * ur + b.x * u2i + b.y * u2r + c.x * u3i + c.y * u3r;\n"
+"\n"
+"  int n = skip;\n"
+"  int k = skip + 1;\n"
+"  int m = CLM_ITERATIONS;\n"
+"  real mag = 0;\n"
+"  for (; n < m; n++) {\n"
+"    real zr = orbit[k].x + dr;\n"
+"    real zi = orbit[k].y + di;\n"
+"    real zz = zr * zr + zi * zi;\n"
+"    if ( zz > CLM_BAILOUT ) { mag = zz; break; }\n"
+"    if ( k + 1 >= length || zz < dr * dr + di * di ) {\n"
+"      dr = zr;\n"
+"      di = zi;\n"
+"      k = 0;\n"
+"    }\n"
+"    real tr = 2 * orbit[k].x + dr;\n"
+"    real ti = 2 * orbit[k].y + di;\n"
+"    real nr = tr * dr - ti * di + dcr;\n"
+"    di = tr * di + ti * dr + dci;\n"
+"    dr = nr;\n"
+"    k++;\n"
+"  }\n"
+"  output[globalID] = MandelbrotRGBOf(n, mag CLM_PALETTE_ARGS);\n"
+"}\n"
+"\n"
+"#ifdef CLM_EQUALIZE\n"
+"/* histogram equalization: the render kernels leave escape counts in the\n"
+"   output buffer, MandelbrotHistogram counts them into CLM_ITERATIONS + 1\n"
+"   bins, the last for points that never escape, MandelbrotCdf accumulates\n"
+"   the bins of the escaping points and MandelbrotEqualize replaces every\n"
+"   count by the colour of its rank among them */\n"
+"\n"
+"/* the colour of an escaping point with rank points at or below its count\n"
+"   out of total, in steps of 1/256 of a palette interval so that the CPU\n"
+"   renderer gets the same colour with integers */\n"
+"int MandelbrotRank(const int n, const uint rank, const uint total CLM_PALETTE_PARAMS)\n"
+"{\n"
+"#ifdef CLM_PALETTE\n"
+"  if ( n >= CLM_ITERATIONS || total == 0 ) { return palette[colors - 1]; }\n"
+"  ulong q = (ulong)rank * (ulong)(colors - 1) * 256 / total;\n"
+"  int k = min((int)(q >> 8), colors - 2);\n"
+"  int f = (int)q - (k << 8);\n"
+"  int a = palette[k];\n"
+"  int b = palette[k + 1];\n"
+"  int rgb = 0;\n"
+"  for (int s = 0; s <= 16; s += 8) {\n"
+"    rgb |= ((((a >> s) & 0xff) * (256 - f) + ((b >> s) & 0xff) * f + 128) >> 8) << s;\n"
+"  }\n"
+"  return rgb;\n"
+"#else\n"
+"  if ( n >= CLM_ITERATIONS || total == 0 ) { return 0xffffff; }\n"
+"  int c = (int)(((ulong)rank * 255 + total / 2) / total);\n"
+"  return (c << 16) | (c << 8) | c;\n"
+"#endif\n"
+"}\n"
+"\n"
+"__kernel\n"
+"void MandelbrotClear(__global uint *buffer, const int len)\n"
+"{\n"
+"  int i = get_global_id(0);\n"
+"  if ( i < len ) { buffer[i] = 0; }\n"
+"}\n"
+"\n"
+"/* a work group counts into its own bins in local memory and adds them to\n"
+"   the global histogram at the end; without room for the bins it counts\n"
+"   into the global histogram directly */\n"
+"__kernel\n"
+"void MandelbrotHistogram(\n"
+"  __global const int *counts,\n"
+"  const int len,\n"
+"  __global uint *histogram,\n"
+"  __local uint *bins,\n"
+"  const int useLocal)\n"
+"{\n"
+"  const int lid = get_local_id(0);\n"
+"  const int lsize = get_local_size(0);\n"
+"\n"
+"  if ( useLocal ) {\n"
+"    for (int b = lid; b <= CLM_ITERATIONS; b += lsize) { bins[b] = 0; }\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  }\n"
+"  for (int i = get_global_id(0); i < len; i += get_global_size(0)) {\n"
+"    int n = clamp(counts[i], 0, CLM_ITERATIONS);\n"
+"    if ( useLocal ) { atomic_inc(&bins[n]); } else { atomic_inc(&histogram[n]); }\n"
+"  }\n"
+"  if ( useLocal ) {\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"    for (int b = lid; b <= CLM_ITERATIONS; b += lsize) {\n"
+"      if ( bins[b] ) { atomic_add(&histogram[b], bins[b]); }\n"
+"    }\n"
+"  }\n"
+"}\n"
+"\n"
+"/* one work group: every work item sums a run of bins, the sums are\n"
+"   scanned in local memory and each run is then accumulated from the sum\n"
+"   before it; cdf[CLM_ITERATIONS] is the number of escaping points */\n"
+"__kernel\n"
+"void MandelbrotCdf(\n"
+"  __global const uint *histogram,\n"
+"  __global uint *cdf,\n"
+"  __local uint *sums)\n"
+"{\n"
+"  const int lid = get_local_id(0);\n"
+"  const int lsize = get_local_size(0);\n"
+"  const int run = (CLM_ITERATIONS + lsize - 1) / lsize;\n"
+"  const int first = min(lid * run, CLM_ITERATIONS);\n"
+"  const int last = min(first + run, CLM_ITERATIONS);\n"
+"  uint own = 0;\n"
+"\n"
+"  for (int b = first; b < last; b++) { own += histogram[b]; }\n"
+"  sums[lid] = own;\n"
+"  barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  for (int d = 1; d < lsize; d *= 2) {\n"
+"    uint t = (lid >= d) ? sums[lid - d] : 0;\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"    sums[lid] += t;\n"
+"    barrier(CLK_LOCAL_MEM_FENCE);\n"
+"  }\n"
+"\n"
+"  uint sum = sums[lid] - own;\n"
+"  for (int b = first; b < last; b++) {\n"
+"    sum += histogram[b];\n"
+"    cdf[b] = sum;\n"
+"  }\n"
+"  if ( lid == lsize - 1 ) { cdf[CLM_ITERATIONS] = sums[lid]; }\n"
+"}\n"
+"\n"
+"__kernel\n"
+"void MandelbrotEqualize(\n"
+"  __global int *output,\n"
+"  const int len,\n"
+"  __global const uint *cdf\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  int i = get_global_id(0);\n"
+"  if ( i >= len ) { return; }\n"
+"\n"
+"  int n = clamp(output[i], 0, CLM_ITERATIONS);\n"
+"  output[i] = MandelbrotRank(n, cdf[n], cdf[CLM_ITERATIONS] CLM_PALETTE_ARGS);\n"
+"}\n"
+"#endif\n"
+"\n"
+"/* Mariani-Silver subdivision. A tile is a size x size square whose top\n"
+"   left corner is stored as an x, y pair of output coordinates; tiles at\n"
+"   the right and bottom edges are clipped to the image */\n"
+"int MandelbrotBorderLength(const int x0, const int y0, const int x1, const int y1)\n"
+"{\n"
+"  int tw = x1 - x0 + 1;\n"
+"  int th = y1 - y0 + 1;\n"
+"  int len = tw;\n"
+"  if ( th > 1 ) { len += tw; }\n"
+"  if ( th > 2 ) { len += (tw > 1 ? 2 : 1) * (th - 2); }\n"
+"  return len;\n"
+"}\n"
+"\n"
+"/* the j-th border pixel: top row, bottom row, left column, right column */\n"
+"void MandelbrotBorderPixel(\n"
+"  int j,\n"
+"  const int x0,\n"
+"  const int y0,\n"
+"  const int x1,\n"
+"  const int y1,\n"
+"  int *px,\n"
+"  int *py)\n"
+"{\n"
+"  int tw = x1 - x0 + 1;\n"
+"  int rows = y1 - y0 - 1;\n"
+"  if ( j < tw ) { *px = x0 + j; *py = y0; return; }\n"
+"  j -= tw;\n"
+"  if ( j < tw ) { *px = x0 + j; *py = y1; return; }\n"
+"  j -= tw;\n"
+"  if ( j < rows ) { *px = x0; *py = y0 + 1 + j; return; }\n"
+"  *px = x1;\n"
+"  *py = y0 + 1 + j - rows;\n"
+"}\n"
+"\n"
+"/* whether a pixel lies on the border of the enclosing tile of twice the\n"
+"   size, which the previous level has computed already */\n"
+"int MandelbrotOnParentBorder(const int px, const int py, const int size, const int w, const int h)\n"
+"{\n"
+"  int ps = 2 * size;\n"
+"  int x0 = px / ps * ps;\n"
+"  int y0 = py / ps * ps;\n"
+"  int x1 = min(x0 + ps, w) - 1;\n"
+"  int y1 = min(y0 + ps, h) - 1;\n"
+"  return px == x0 || px == x1 || py == y0 || py == y1;\n"
+"}\n"
+"\n"
+"/* the escape count of pixel ix, iy with its shade in *shade; -1 when the\n"
+"   samples of an antialiased pixel escape at different counts, so that the\n"
+"   pixel never makes a tile uniform */\n"
+"int MandelbrotPixelCount(\n"
+"  const int ix,\n"
+"  const int iy,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  int *shade)\n"
+"{\n"
+"  real mag = 0;\n"
+"#if defined(CLM_SAMPLES) && !defined(CLM_ADAPTIVE)\n"
+"  const real step = (real)1 / (2 * CLM_SAMPLES);\n"
+"  int sum = 0;\n"
+"  int count = -2;\n"
+"\n"
+"  for (int sy = 0; sy < CLM_SAMPLES; sy++) {\n"
+"    real fy = ((real)(iy - h / 2) + (real)(2 * sy + 1 - CLM_SAMPLES) * step) * unit + cy;\n"
+"    for (int sx = 0; sx < CLM_SAMPLES; sx++) {\n"
+"      real fx = ((real)(ix - w / 2) + (real)(2 * sx + 1 - CLM_SAMPLES) * step) * unit + cx;\n"
+"      int n = MandelbrotEscape(fx, fy, &mag);\n"
+"      sum += MandelbrotGray(n);\n"
+"      count = (count == -2 || count == n) ? n : -1;\n"
+"    }\n"
+"  }\n"
+"  *shade = (sum + CLM_SAMPLES * CLM_SAMPLES / 2) / (CLM_SAMPLES * CLM_SAMPLES);\n"
+"  return count;\n"
+"#else\n"
+"  real fx = (real)(ix - w / 2) * unit + cx;\n"
+"  real fy = (real)(iy - h / 2) * unit + cy;\n"
+"  int n = MandelbrotEscape(fx, fy, &mag);\n"
+"  *shade = MandelbrotGray(n);\n"
+"  return n;\n"
+"#endif\n"
+"}\n"
+"\n"
+"/* computes the border pixels of the tiles, 4 * size work items per tile,\n"
+"   and keeps their escape counts for MandelbrotClassify */\n"
+"__kernel\n"
+"void MandelbrotBorderRGB(\n"
+"  __global int *output,\n"
+"  __global int *counts,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  __global const int *tiles,\n"
+"  const int size,\n"
+"  const int parent)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int t = globalID / (4 * size);\n"
+"  int j = globalID % (4 * size);\n"
+"  int x0 = tiles[2 * t];\n"
+"  int y0 = tiles[2 * t + 1];\n"
+"  int x1 = min(x0 + size, w) - 1;\n"
+"  int y1 = min(y0 + size, h) - 1;\n"
+"  int px, py;\n"
+"\n"
+"  if ( j >= MandelbrotBorderLength(x0, y0, x1, y1) ) { return; }\n"
+"  MandelbrotBorderPixel(j, x0, y0, x1, y1, &px, &py);\n"
+"  if ( parent && MandelbrotOnParentBorder(px, py, size, w, h) ) { return; }\n"
+"\n"
+"  int c;\n"
+"  counts[px + py * w] = MandelbrotPixelCount(px, h - 1 - py, w, h, cx, cy, unit, &c);\n"
+"  output[px + py * w] = (c << 16) | (c << 8) | c;\n"
+"}\n"
+"\n"
+"/* one work item per tile: a tile whose border escapes at a single count is\n"
+"   filled, any other one is split into quarters or, at the smallest size,\n"
+"   iterated pixel by pixel. The lists are compacted with atomic counters:\n"
+"   counters[0] quarters, [1] uniform tiles, [2] tiles to iterate and [3]\n"
+"   the number of pixels iterated */\n"
+"__kernel\n"
+"void MandelbrotClassify(\n"
+"  __global const int *counts,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  __global const int *tiles,\n"
+"  const int count,\n"
+"  const int size,\n"
+"  const int parent,\n"
+"  const int smallest,\n"
+"  __global int *next,\n"
+"  __global int *uniform,\n"
+"  __global int *iterate,\n"
+"  __global int *counters)\n"
+"{\n"
+"  int t = get_global_id(0);\n"
+"  if ( t >= count ) { return; }\n"
+"\n"
+"  int x0 = tiles[2 * t];\n"
+"  int y0 = tiles[2 * t + 1];\n"
+"  int x1 = min(x0 + size, w) - 1;\n"
+"  int y1 = min(y0 + size, h) - 1;\n"
+"  int len = MandelbrotBorderLength(x0, y0, x1, y1);\n"
+"  int n0 = counts[x0 + y0 * w];\n"
+"  int same = (n0 >= 0);\n"
+"  int computed = 0;\n"
+"  int j, k, px, py;\n"
+"\n"
+"  for (j = 0; j < len; j++) {\n"
+"    MandelbrotBorderPixel(j, x0, y0, x1, y1, &px, &py);\n"
+"    if ( counts[px + py * w] != n0 ) { same = 0; }\n"
+"    if ( !parent || !MandelbrotOnParentBorder(px, py, size, w, h) ) { computed++; }\n"
+"  }\n"
+"  atomic_add(&counters[3], computed);\n"
+"\n"
+"  if ( x1 - x0 < 2 || y1 - y0 < 2 ) { return; }\n"
+"  if ( same ) {\n"
+"    k = atomic_inc(&counters[1]);\n"
+"    uniform[2 * k] = x0;\n"
+"    uniform[2 * k + 1] = y0;\n"
+"  } else if ( size > smallest ) {\n"
+"    int half = size / 2;\n"
+"    for (j = 0; j < 4; j++) {\n"
+"      px = x0 + (j & 1) * half;\n"
+"      py = y0 + (j >> 1) * half;\n"
+"      if ( px >= w || py >= h ) { continue; }\n"
+"      k = atomic_inc(&counters[0]);\n"
+"      next[2 * k] = px;\n"
+"      next[2 * k + 1] = py;\n"
+"    }\n"
+"  } else {\n"
+"    k = atomic_inc(&counters[2]);\n"
+"    iterate[2 * k] = x0;\n"
+"    iterate[2 * k + 1] = y0;\n"
+"    atomic_add(&counters[3], (x1 - x0 - 1) * (y1 - y0 - 1));\n"
+"  }\n"
+"}\n"
+"\n"
+"/* copies the colour of the border into the inside of uniform tiles */\n"
+"__kernel\n"
+"void MandelbrotFill(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  __global const int *tiles,\n"
+"  const int size)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int t = globalID / (size * size);\n"
+"  int p = globalID % (size * size);\n"
+"  int x0 = tiles[2 * t];\n"
+"  int y0 = tiles[2 * t + 1];\n"
+"  int x = x0 + p % size;\n"
+"  int y = y0 + p / size;\n"
+"\n"
+"  if ( x == x0 || y == y0 || x >= min(x0 + size, w) - 1 || y >= min(y0 + size, h) - 1 ) { return; }\n"
+"  output[x + y * w] = output[x0 + y0 * w];\n"
+"}\n"
+"\n"
+"/* iterates the inside of tiles whose border is not uniform */\n"
+"__kernel\n"
+"void MandelbrotTileRGB(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  __global const int *tiles,\n"
+"  const int size)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  int t = globalID / (size * size);\n"
+"  int p = globalID % (size * size);\n"
+"  int x0 = tiles[2 * t];\n"
+"  int y0 = tiles[2 * t + 1];\n"
+"  int x = x0 + p % size;\n"
+"  int y = y0 + p / size;\n"
+"\n"
+"  if ( x == x0 || y == y0 || x >= min(x0 + size, w) - 1 || y >= min(y0 + size, h) - 1 ) { return; }\n"
+"  int c = MandelbrotPixel(x, h - 1 - y, w, h, cx, cy, unit);\n"
+"  output[x + y * w] = (c << 16) | (c << 8) | c;\n"
+"}\n"
+"\n"
+"/* viewports: a frame is a window of a pixel grid anchored at cx + cy i,\n"
+"   shifted by px columns and py rows of the grid, so a pixel keeps its\n"
+"   value while the frame pans by whole pixels. Position j along an axis\n"
+"   is first + j * step or, with skip, the j-th position that is not */\n"
+"int MandelbrotViewportAxis(const int j, const int first, const int step, const int skip)\n"
+"{\n"
+"  if ( !skip ) { return first + j * step; }\n"
+"  if ( j < first ) { return j; }\n"
+"  return first + 1 + (j - first) / (step - 1) * step + (j - first) % (step - 1);\n"
+"}\n"
+"\n"
+"/* computes cols x rows pixels of a viewport frame, placed along each axis\n"
+"   by MandelbrotViewportAxis */\n"
+"__kernel\n"
+"void MandelbrotViewportRGB(\n"
+"  __global int *output,\n"
+"  const int w,\n"
+"  const int h,\n"
+"  const int px,\n"
+"  const int py,\n"
+"  const real cx,\n"
+"  const real cy,\n"
+"  const real unit,\n"
+"  const int cols,\n"
+"  const int rows,\n"
+"  const int x0,\n"
+"  const int xStep,\n"
+"  const int xSkip,\n"
+"  const int y0,\n"
+"  const int yStep,\n"
+"  const int ySkip\n"
+"  CLM_PALETTE_PARAMS)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  if ( globalID >= cols * rows ) { return; }\n"
+"\n"
+"  int ox = MandelbrotViewportAxis(globalID % cols, x0, xStep, xSkip);\n"
+"  int oy = MandelbrotViewportAxis(globalID / cols, y0, yStep, ySkip);\n"
+"  output[ox + oy * w] = MandelbrotPixelRGB(ox + px, h - 1 - oy + py, w, h, cx, cy, unit\n"
+"                                           CLM_PALETTE_ARGS);\n"
+"}\n"
+"\n"
+"/* moves the pixels a viewport keeps from the previous frame into the\n"
+"   next one: pixel i, j goes from sx0 + i * from, sy0 + j * from to\n"
+"   x0 + i * to, y0 + j * to */\n"
+"__kernel\n"
+"void MandelbrotViewportCopy(\n"
+"  __global int *output,\n"
+"  __global const int *input,\n"
+"  const int w,\n"
+"  const int cols,\n"
+"  const int rows,\n"
+"  const int x0,\n"
+"  const int y0,\n"
+"  const int to,\n"
+"  const int sx0,\n"
+"  const int sy0,\n"
+"  const int from)\n"
+"{\n"
+"  int globalID = get_global_id(0);\n"
+"  if ( globalID >= cols * rows ) { return; }\n"
 "\n"
-"  output[ox + oy * w] = (unsigned char)ival;\n"
+"  int i = globalID % cols;\n"
+"  int j = globalID / cols;\n"
+"  output[(x0 + i * to) + (y0 + j * to) * w] = input[(sx0 + i * from) + (sy0 + j * from) * w];\n"
 "}\n";
@@ -42,11 +42,556 @@
 #include <php_ini.h>
 #include <SAPI.h>
 #include <ext/standard/info.h>
+#include <ext/standard/php_smart_str_public.h>
 #include <Zend/zend_extensions.h>
 #include <ext/gd/php_gd.h>
+#ifdef HAVE_GD_BUNDLED
+#include <ext/gd/libgd/gd.h>
+#else
+#include <gd.h>
+#endif
+#include <OpenCL/opencl.h>
 
 #define PHP_CLMANDELBROT_VERSION "0.0.1"
 
+#define MAX_NUM_DEVICES 10
+
+/* pseudo device indexes selecting the built-in CPU renderer and
+   cooperative rendering on every available OpenCL device */
+#define CLM_DEVICE_CPU -1
+#define CLM_DEVICE_ALL -2
+
+#define CLM_DEFAULT_ITERATIONS 200
+#define CLM_MAX_ITERATIONS 1000000
+/* escape radius; the kernels compare against its square */
+#define CLM_DEFAULT_BAILOUT 2.0
+
+/* precision of a render; automatic selection picks the cheapest one that
+   still resolves the pixel size at the given center */
+#define CLM_PRECISION_AUTO    0
+#define CLM_PRECISION_FLOAT   1
+#define CLM_PRECISION_DOUBLE  2
+#define CLM_PRECISION_PERTURB 3
+
+/* frames of a batch in flight at once */
+#define CLM_BATCH_DEPTH 3
+
+/* render modes: every pixel iterated, Mariani-Silver subdivision that
+   fills tiles whose border has a single escape count, or passes of decreasing
+   stride shown as they complete */
+#define CLM_MODE_DIRECT      0
+#define CLM_MODE_SUBDIVIDE   1
+#define CLM_MODE_PROGRESSIVE 2
+
+/* smallest pixel size; below it the per-pixel offsets become denormal */
+#define CLM_MIN_UNIT 1e-300
+/* smallest pixel size perturbation can handle with float offsets */
+#define CLM_FLOAT_MIN_UNIT 1e-30
+
+/* 32-bit limbs of the fixed-point numbers the reference orbit is computed
+   with: one integer limb and enough fraction limbs for CLM_MIN_UNIT */
+#define CLM_MP_LIMBS 40
+
+/* autotuning of the 2D range: pixels computed per work item along a row
+   are tried up to CLM_TUNE_MAX_PIXELS, and the probe render is made
+   smaller for high iteration limits so that it stays under about
+   CLM_TUNE_BUDGET iterations */
+#define CLM_TUNE_MAX_PIXELS 4
+#define CLM_TUNE_PROBE_SIZE 256
+#define CLM_TUNE_MIN_PROBE  64
+#define CLM_TUNE_BUDGET     (1 << 24)
+
+/* widest vector of pixels a work item of the direct kernel computes */
+#define CLM_MAX_VECTOR 16
+
+/* antialiasing takes up to CLM_MAX_SAMPLES squared samples per pixel */
+#define CLM_MAX_SAMPLES 4
+
+/* colours of a palette, and palettes kept on a device at once */
+#define CLM_MAX_PALETTE  256
+#define CLM_MAX_PALETTES 4
+
+/* kernel variants kept per device before the least recently used is dropped */
+#define CLM_MAX_VARIANTS 8
+#define CLM_OPTIONS_SIZE 256
+
+/* slippy map: the tiles of zoom level 0 to CLM_MAP_MAX_ZOOM split the
+   square from CLM_MAP_LEFT + CLM_MAP_TOP i, CLM_MAP_SPAN wide; their
+   centers are then exact in double precision */
+#define CLM_MAP_LEFT      -2.5
+#define CLM_MAP_TOP       2.0
+#define CLM_MAP_SPAN      4.0
+#define CLM_MAP_MAX_ZOOM  50
+#define CLM_MAP_TILE_SIZE 256
+#define CLM_MAP_MAX_SIZE  4096
+/* tiles rendered by one clmandelbrot_tiles() launch at most */
+#define CLM_MAP_MAX_TILES 256
+
+/* moves of a viewport: a full render, a pan, and zooms in and out by an
+   integer ratio; a viewport shifted further than CLM_VIEWPORT_MAX_OFFSET
+   pixels from the origin of its grid is rendered afresh around its center */
+#define CLM_VIEW_FULL     0
+#define CLM_VIEW_PAN      1
+#define CLM_VIEW_ZOOM_IN  2
+#define CLM_VIEW_ZOOM_OUT 3
+#define CLM_VIEWPORT_MAX_OFFSET (1 << 20)
+
+/* encodings written by clmandelbrot_encode() */
+#define CLM_FORMAT_PNG 0
+#define CLM_FORMAT_PGM 1
+#define CLM_FORMAT_PPM 2
+/* zlib level used for PNG unless the "compression" option is given */
+#define CLM_DEFAULT_COMPRESSION 1
+
+/* stages timed by the profiler: the kernel and transfer times are taken
+   from OpenCL event timestamps, the others from the host clock */
+#define CLM_PROF_DEVICES   0
+#define CLM_PROF_CONTEXT   1
+#define CLM_PROF_BUILD     2
+#define CLM_PROF_REFERENCE 3
+#define CLM_PROF_RENDER    4
+#define CLM_PROF_KERNEL    5
+#define CLM_PROF_TRANSFER  6
+#define CLM_PROF_DRAW      7
+#define CLM_PROF_TOTAL     8
+#define CLM_PROF_STAGES    9
+/* power of two microsecond buckets of the stage histograms; the last one
+   also counts everything longer */
+#define CLM_PROF_BUCKETS   24
+
+/* size of the digest that keys the shared render cache */
+#define CLM_SHM_KEY_SIZE 16
+
+/* number of tile buffers in flight when rendering in tiles */
+#define CLM_TILE_DEPTH 3
+/* tile size in pixels used when an image does not fit in one buffer */
+#define CLM_DEFAULT_TILE_SIZE (1024 * 1024)
+
+extern zend_module_entry clmandelbrot_module_entry;
+#define phpext_clmandelbrot_ptr &clmandelbrot_module_entry
+
+/* {{{ launch shape of a kernel on one device; 1D kernels use local[0] */
+typedef struct {
+	size_t    local[2];
+	int       pixels;  /* pixels per work item along a row */
+	zend_bool tuned;   /* measured, now or on an earlier run */
+	double    time;    /* kernel time of the probe with this shape */
+} clm_tuning_t;
+/* }}} */
+
+/* {{{ a program built with one set of specialization options */
+typedef struct {
+	char          kernelName[32];
+	char          options[CLM_OPTIONS_SIZE];
+	cl_program    program;
+	cl_uint       numDevices;
+	cl_kernel     kernels[MAX_NUM_DEVICES];
+	size_t        workGroupSize[MAX_NUM_DEVICES];
+	clm_tuning_t  tuning[MAX_NUM_DEVICES];
+	long          hits;
+	unsigned long lastUsed;
+	double        buildTime;
+	zend_bool     fromBinary;
+} clm_variant_t;
+
+typedef struct {
+	clm_variant_t entries[CLM_MAX_VARIANTS];
+	int           count;
+	unsigned long clock;
+} clm_variants_t;
+/* }}} */
+
+/* {{{ colour palette of a render, and the palettes uploaded to a context */
+typedef struct {
+	int           count;  /* 0 for gray shades */
+	zend_bool     smooth;
+	int           colors[CLM_MAX_PALETTE];
+	unsigned char key[16];
+	cl_mem        buffer;  /* the upload used by the render, owned by the cache */
+} clm_palette_t;
+
+typedef struct {
+	unsigned char key[16];
+	cl_mem        buffer;
+	unsigned long lastUsed;
+} clm_palette_entry_t;
+
+typedef struct {
+	clm_palette_entry_t entries[CLM_MAX_PALETTES];
+	unsigned long       clock;
+} clm_palettes_t;
+/* }}} */
+
+/* {{{ sign and magnitude fixed-point number, most significant limb first */
+typedef struct {
+	int    neg;
+	cl_uint d[CLM_MP_LIMBS];
+} clm_mp_t;
+/* }}} */
+
+/* {{{ reference orbit and series approximation of a perturbation render */
+typedef struct {
+	double *orbit;     /* reference orbit as re/im pairs, starting at 0 */
+	int    length;     /* number of points in orbit */
+	int    skip;       /* iterations covered by the series approximation */
+	double coeffs[6];  /* series coefficients a, b, c scaled by the radius */
+	double scale;      /* pixel size divided by the series radius */
+	cl_mem buffer;     /* orbit on the device */
+} clm_perturb_t;
+/* }}} */
+
+/* {{{ per-device OpenCL objects kept across calls */
+typedef struct {
+	cl_context       context;
+	cl_command_queue queue;
+	clm_variants_t   variants;
+	clm_palettes_t   palettes;
+	cl_mem           output;
+	size_t           outputSize;
+	cl_ulong         maxAlloc;
+	zend_bool        hasDouble;
+	cl_ulong         localMem;
+	int              vectorFloat;   /* pixels per vector, 1 for scalar */
+	int              vectorDouble;
+	cl_command_queue ioQueue;
+	cl_mem           tiles[CLM_TILE_DEPTH];
+	size_t           tileSize;
+} clm_device_t;
+/* }}} */
+
+/* {{{ the devices of one platform in cooperative mode, which share a context */
+typedef struct {
+	cl_platform_id   platform;
+	cl_context       context;
+	cl_uint          first;   /* its first device in clm_multi_t */
+	cl_uint          count;
+	clm_variants_t   variants;
+	clm_palettes_t   palettes;
+} clm_multi_platform_t;
+/* }}} */
+
+/* {{{ OpenCL objects shared by every device in cooperative mode */
+typedef struct {
+	cl_uint          count;
+	cl_uint          ids[MAX_NUM_DEVICES];
+	cl_device_id     devices[MAX_NUM_DEVICES];
+	cl_command_queue queues[MAX_NUM_DEVICES];
+	cl_uint          platformOf[MAX_NUM_DEVICES];
+	cl_uint          numPlatforms;
+	clm_multi_platform_t platforms[MAX_NUM_DEVICES];
+	zend_bool        hasDouble;
+	cl_mem           buffers[MAX_NUM_DEVICES][2];
+	size_t           bufferSize;
+} clm_multi_t;
+/* }}} */
+
+/* {{{ statistics of the last render */
+typedef struct {
+	cl_uint deviceId;
+	long    chunks;
+	long    rows;
+	double  time;
+} clm_device_stat_t;
+
+typedef struct {
+	const char        *backend;
+	const char        *precision;
+	int               width;
+	int               height;
+	int               reference;
+	int               skipped;
+	const char        *mode;
+	long              iterated;
+	double            time;
+	cl_uint           numDevices;
+	clm_device_stat_t devices[MAX_NUM_DEVICES];
+	double            stages[CLM_PROF_STAGES];
+	unsigned int      stageMask;  /* stages timed since the last commit */
+	zend_bool         equalized;  /* the histogram is that of this render */
+} clm_last_t;
+/* }}} */
+
+/* {{{ device info read once per process for cl_get_devices(); the
+   values follow device_info_list and platform_info_list */
+typedef struct {
+	zend_bool valid;
+	long      lval;
+	char      *str;    /* strings */
+	long      *sizes;  /* max_work_item_sizes */
+	size_t    len;     /* length of str or number of sizes */
+} clm_info_value_t;
+
+typedef struct {
+	clm_info_value_t *device;
+	clm_info_value_t *platform;
+} clm_device_snapshot_t;
+/* }}} */
+
+/* {{{ escape counts of the last equalized render; the bins are kept
+   across calls and only grow */
+typedef struct {
+	cl_uint *bins;     /* iterations + 1, the last for points that never escape */
+	int     capacity;
+	int     count;
+	long    escaped;
+	int     min;       /* escape counts of the escaping points */
+	int     max;
+	double  mean;
+} clm_histogram_t;
+/* }}} */
+
+/* {{{ cumulative timings of one stage */
+typedef struct {
+	long   count;
+	double total;
+	double min;
+	double max;
+	long   buckets[CLM_PROF_BUCKETS];
+} clm_prof_stage_t;
+/* }}} */
+
+/* {{{ per-call render context */
+typedef struct {
+	cl_uint          deviceId;
+	cl_device_id     device;
+	clm_device_t     *dev;
+	clm_variant_t    *variant;
+	zend_bool        useCpu;
+	zend_bool        useAll;
+	int width;
+	int height;
+	double centerX;
+	double centerY;
+	double unit;
+	clm_mp_t centerRe;
+	clm_mp_t centerIm;
+	int iterations;
+	float bailout;
+	int precision;
+	zend_bool useDouble;
+	zend_bool series;
+	zend_bool interiorCheck;
+	zend_bool periodicity;
+	int vectorWidth;  /* 0 picks the width the device prefers */
+	int samples;      /* samples per pixel along each axis */
+	zend_bool adaptive;
+	clm_palette_t palette;
+	zend_bool equalize;
+	int mode;
+	long iterated;
+	int tileCount;
+	clm_perturb_t perturb;
+	int tileRows;
+	unsigned char *bitmap;
+	int **pixels;
+	zval *image;     /* the image resource, for progressive callbacks */
+	zval *callback;  /* progressive callback, NULL once it returned false */
+} clmandelbrot_t;
+/* }}} */
+
+/* {{{ render submitted with clmandelbrot_submit(); the kernel writes into
+   a buffer of its own, so several jobs can be in flight on one queue */
+typedef struct {
+	clmandelbrot_t ctx;
+	zval           *image;
+	cl_mem         output;
+	int            *host;
+	cl_event       kernel; /* kept for its timestamps until collected */
+	cl_event       event;  /* read back into host, NULL once collected */
+	int            result;
+	zend_bool      fetched;
+	unsigned char  key[CLM_SHM_KEY_SIZE];
+} clm_job_t;
+/* }}} */
+
+/* {{{ view created by clmandelbrot_viewport(); its frames are windows of
+   a pixel grid anchored at originX + originY i, shifted by offX columns
+   right and offY rows down, and the last one stays on the device, so a
+   move computes only the pixels it brings into view */
+typedef struct {
+	clmandelbrot_t ctx;
+	int            precision;  /* as requested; ctx->precision is resolved */
+	double         originX;
+	double         originY;
+	int            offX;
+	int            offY;
+	int            move;       /* CLM_VIEW_* leading from the frame to the view */
+	int            ratio;      /* of a zoom */
+	cl_context     context;    /* of the frames */
+	cl_mem         frames[2];
+	int            front;
+	zend_bool      valid;      /* frames[front] holds the last frame */
+	zend_bool      useDouble;  /* precision of the last frame */
+	int            frameX;     /* offsets of the last frame */
+	int            frameY;
+} clm_viewport_t;
+/* }}} */
+
+/* {{{ counters of the shared render cache */
+typedef struct {
+	long size;
+	long entries;
+	long usedBytes;
+	long freeBytes;
+	long hits;
+	long misses;
+	long stores;
+	long evictions;
+} clm_shm_stats_t;
+/* }}} */
+
+/* {{{ module globals */
+ZEND_BEGIN_MODULE_GLOBALS(clmandelbrot)
+	zend_bool    devicesLoaded;
+	cl_uint      deviceCount;
+	cl_device_id deviceList[MAX_NUM_DEVICES];
+	clm_device_t devices[MAX_NUM_DEVICES];
+	zend_bool    infoLoaded;
+	clm_device_snapshot_t snapshots[MAX_NUM_DEVICES];
+	zval         *deviceInfo;  /* cl_get_devices() of this request */
+	long         cacheHits;
+	long         cacheMisses;
+	char         *cacheDir;
+	long         binaryHits;
+	long         binaryWrites;
+	long         cpuThreads;
+	zend_bool    cpuFallback;
+	long         tileSize;
+	long         shmCacheSize;
+	zend_bool    autotune;
+	clm_multi_t  multi;
+	clm_last_t   last;
+	clm_histogram_t histogram;
+	clm_prof_stage_t prof[CLM_PROF_STAGES];
+ZEND_END_MODULE_GLOBALS(clmandelbrot)
+
+ZEND_EXTERN_MODULE_GLOBALS(clmandelbrot)
+
+#ifdef ZTS
+#define CLMANDELBROT_G(v) TSRMG(clmandelbrot_globals_id, zend_clmandelbrot_globals *, v)
+#else
+#define CLMANDELBROT_G(v) (clmandelbrot_globals.v)
+#endif
+/* }}} */
+
+/* {{{ shared helpers (clmandelbrot.c) */
+double clm_now(void);
+cl_uint clm_load_devices(TSRMLS_D);
+int clm_setup_device(TSRMLS_D);
+int clm_enqueue_rows(clmandelbrot_t *ctx, cl_command_queue queue, cl_kernel kernel,
+                     const clm_tuning_t *tuning, cl_mem output, int y0, int rows,
+                     cl_uint num_events, const cl_event *wait_list, cl_event *event TSRMLS_DC);
+cl_int clm_enqueue_1d(cl_command_queue queue, cl_kernel kernel, size_t global, size_t local,
+                      cl_uint num_events, const cl_event *wait_list, cl_event *event);
+void clm_draw(const int *rgb, int y0, int rows, clmandelbrot_t *ctx TSRMLS_DC);
+cl_int clm_set_real_arg(clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index,
+                        const double *value, int count);
+/* }}} */
+
+/* {{{ on-disk program binary cache (clm_binary_cache.c) */
+cl_program clm_load_program_binary(cl_context context, cl_device_id device,
+                                   const char *source, const char *options TSRMLS_DC);
+int clm_save_program_binary(cl_program program, cl_device_id device,
+                            const char *source, const char *options TSRMLS_DC);
+/* }}} */
+
+/* {{{ specialized kernel variants (clm_variant.c) */
+void clm_variant_options(const clmandelbrot_t *ctx, char *buf, size_t size);
+const char *clm_variant_kernel(const clmandelbrot_t *ctx);
+void clm_variant_sampling(clmandelbrot_t *ctx);
+void clm_variant_vector(clmandelbrot_t *ctx, int float_width, int double_width);
+clm_variant_t *clm_variant_get(clm_variants_t *cache, cl_context context,
+                               cl_uint num_devices, const cl_device_id *devices,
+                               const char *kernel, const char *options TSRMLS_DC);
+void clm_variant_release_all(clm_variants_t *cache);
+/* }}} */
+
+/* {{{ colour palettes (clm_palette.c) */
+int clm_palette_parse(clm_palette_t *palette, zval *zpalette TSRMLS_DC);
+int clm_palette_select(clmandelbrot_t *ctx TSRMLS_DC);
+int clm_palette_upload(clm_palette_t *palette, clm_palettes_t *cache, cl_context context TSRMLS_DC);
+cl_int clm_palette_args(const clmandelbrot_t *ctx, cl_kernel kernel, cl_uint index);
+int clm_palette_color(const clm_palette_t *palette, int n, int m, double mag);
+void clm_palette_release_all(clm_palettes_t *cache);
+/* }}} */
+
+/* {{{ histogram equalization (clm_equalize.c) */
+void clm_equalize_select(clmandelbrot_t *ctx);
+int clm_equalize(clmandelbrot_t *ctx, cl_mem output TSRMLS_DC);
+int clm_equalize_pixels(clmandelbrot_t *ctx TSRMLS_DC);
+void clm_equalize_shutdown(TSRMLS_D);
+/* }}} */
+
+/* {{{ work group autotuner (clm_autotune.c) */
+int clm_tune_dims(const clm_variant_t *variant);
+void clm_tune_load(clm_variant_t *variant, cl_uint index, cl_device_id device TSRMLS_DC);
+int clm_autotune(clmandelbrot_t *ctx TSRMLS_DC);
+/* }}} */
+
+/* {{{ precision selection and perturbation (clm_perturb.c) */
+void clm_mp_from_double(clm_mp_t *x, double v);
+int clm_mp_parse(clm_mp_t *x, const char *str, int len);
+double clm_mp_to_double(const clm_mp_t *x);
+int clm_select_precision(clmandelbrot_t *ctx, zend_bool has_double TSRMLS_DC);
+const char *clm_precision_name(int precision);
+int clm_perturb_prepare(clmandelbrot_t *ctx TSRMLS_DC);
+int clm_perturb_upload(clmandelbrot_t *ctx, cl_context context TSRMLS_DC);
+void clm_perturb_release(clm_perturb_t *perturb);
+/* }}} */
+
+/* {{{ cooperative multi-device renderer (clm_multi.c) */
+int clm_multi_render(clmandelbrot_t *ctx TSRMLS_DC);
+void clm_multi_release(clm_multi_t *multi);
+/* }}} */
+
+/* {{{ Mariani-Silver subdivision renderer (clm_subdivide.c) */
+int clm_subdivide(clmandelbrot_t *ctx TSRMLS_DC);
+/* }}} */
+
+/* {{{ progressive renderer (clm_progressive.c) */
+int clm_progressive(clmandelbrot_t *ctx TSRMLS_DC);
+int clm_progressive_notify(clmandelbrot_t *ctx, int stride TSRMLS_DC);
+/* }}} */
+
+/* {{{ incremental viewports (clm_viewport.c) */
+void clm_viewport_pan(clm_viewport_t *vp, long dx, long dy);
+void clm_viewport_zoom(clm_viewport_t *vp, double ratio);
+int clm_viewport_render(clm_viewport_t *vp TSRMLS_DC);
+int clm_viewport_draw(clm_viewport_t *vp TSRMLS_DC);
+void clm_viewport_release(clm_viewport_t *vp);
+/* }}} */
+
+/* {{{ PNG, PGM and PPM encoders (clm_encode.c) */
+int clm_encode_format(const char *name);
+long clm_encode(int format, int level, const unsigned char *bitmap, int width, int height,
+                php_stream *stream, smart_str *out TSRMLS_DC);
+/* }}} */
+
+/* {{{ rendered image cache shared between processes (clm_shm_cache.c) */
+int clm_shm_startup(long size);
+void clm_shm_shutdown(void);
+void clm_shm_key(const clmandelbrot_t *ctx, unsigned char *key);
+int clm_shm_fetch(const unsigned char *key, clmandelbrot_t *ctx);
+void clm_shm_store(const unsigned char *key, const clmandelbrot_t *ctx);
+int clm_shm_stats(clm_shm_stats_t *stats);
+/* }}} */
+
+/* {{{ stage profiler (clm_prof.c) */
+void clm_prof_add(int stage, double seconds TSRMLS_DC);
+void clm_prof_event(int stage, cl_event event TSRMLS_DC);
+void clm_prof_release(int stage, cl_event event TSRMLS_DC);
+void clm_prof_begin(TSRMLS_D);
+void clm_prof_commit(TSRMLS_D);
+void clm_prof_reset(TSRMLS_D);
+const char *clm_prof_name(int stage);
+/* }}} */
+
+/* {{{ native CPU renderer (clm_cpu.c) */
+int clm_cpu_render(clmandelbrot_t *ctx TSRMLS_DC);
+const char *clm_cpu_isa(void);
+void clm_cpu_shutdown(void);
+/* }}} */
+
 #endif /* PHP_CLMANDELBROT_H */
 
 
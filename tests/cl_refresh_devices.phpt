@@ -0,0 +1,27 @@
+--TEST--
+cl_get_devices() snapshot and cl_refresh_devices()
+--FILE--
+<?php
+$a = cl_get_devices();
+$b = cl_get_devices();
+var_dump($a === $b);
+
+$b[0]['name'] = 'changed';
+$c = cl_get_devices();
+var_dump($c === $a);
+
+$d = cl_refresh_devices();
+var_dump(count($d) === count($a));
+var_dump($d[0]['name'] === $a[0]['name']);
+var_dump(cl_get_devices() === $d);
+
+/* the contexts survive a refresh of an unchanged device list */
+var_dump(strlen(clmandelbrot_raw(32, 24)));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(768)
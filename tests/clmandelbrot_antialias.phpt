@@ -0,0 +1,53 @@
+--TEST--
+clmandelbrot() antialiasing on the device matches the CPU renderer
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$plain = clmandelbrot_raw(97, 61, 0, 0, array('iterations' => 300));
+foreach (array(array(2, 'grid'), array(3, 'grid'), array(3, 'adaptive'), array(4, 'adaptive')) as $case) {
+    $options = array('iterations' => 300, 'antialias' => $case[0], 'antialias_mode' => $case[1]);
+    $gpu = clmandelbrot_raw(97, 61, 0, 0, $options);
+    $cpu = clmandelbrot_raw(97, 61, 0, CLMANDELBROT_DEVICE_CPU, $options);
+    printf("%d %s: %s, %s, %s\n", $case[0], $case[1],
+           $gpu === $cpu ? 'identical' : 'different',
+           $gpu === clm_gray(clmandelbrot(97, 61, 0, 0, $options)) ? 'same image' : 'other image',
+           $gpu === $plain ? 'not antialiased' : 'antialiased');
+}
+
+/* adaptive sampling compares with the neighbours of the image, so the
+   image does not depend on the rows rendered at once */
+$options = array('iterations' => 300, 'antialias' => 3, 'antialias_mode' => 'adaptive');
+ini_set('clmandelbrot.tile_size', 1000);
+$tiled = clm_gray(clmandelbrot(97, 61, 0, 0, $options));
+ini_set('clmandelbrot.tile_size', 0);
+echo $tiled === clmandelbrot_raw(97, 61, 0, 0, $options) ? 'identical' : 'different', "\n";
+
+/* a batch of map tiles samples them as clmandelbrot_tile() does */
+foreach (array('grid', 'adaptive') as $mode) {
+    $options = array('size' => 64, 'antialias' => 3, 'antialias_mode' => $mode);
+    $tiles = clmandelbrot_tiles(2, 0, 1, 1, 1, $options);
+    $diff = array();
+    foreach ($tiles[1] as $x => $im) {
+        $diff[] = clm_diff($im, clmandelbrot_tile(2, $x, 1, $options));
+    }
+    echo $mode, ' tiles: ', implode(', ', $diff), "\n";
+}
+
+var_dump(clmandelbrot_raw(32, 32, 0, 0, array('antialias' => 5)));
+var_dump(clmandelbrot_raw(32, 32, 0, 0, array('antialias' => 2, 'antialias_mode' => 'jitter')));
+?>
+--EXPECTF--
+2 grid: identical, same image, antialiased
+3 grid: identical, same image, antialiased
+3 adaptive: identical, same image, antialiased
+4 adaptive: identical, same image, antialiased
+identical
+grid tiles: identical, identical
+adaptive tiles: identical, identical
+
+Warning: clmandelbrot_raw(): antialias must be between 1 and 4 in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_raw(): unknown antialias mode 'jitter' in %s on line %d
+bool(false)
@@ -0,0 +1,34 @@
+--TEST--
+clmandelbrot_submit() renders in the background
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$jobs = array();
+foreach (array(1.0, 0.5, 0.25) as $scale) {
+    $jobs[] = clmandelbrot_submit(160, 120, 0.04 * $scale);
+}
+var_dump(is_resource($jobs[0]), is_bool(clmandelbrot_poll($jobs[0])));
+
+var_dump(clmandelbrot_wait($jobs[1]));
+var_dump(clmandelbrot_poll($jobs[1]));
+
+foreach (array(1.0, 0.5, 0.25) as $i => $scale) {
+    $async = clmandelbrot_fetch($jobs[$i]);
+    $sync = clmandelbrot(160, 120, 0.04 * $scale);
+    echo clm_diff($async, $sync), "\n";
+}
+
+$cpu = clmandelbrot_submit(32, 32, 0, CLMANDELBROT_DEVICE_CPU);
+var_dump(clmandelbrot_poll($cpu), imagesx(clmandelbrot_fetch($cpu)));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+identical
+identical
+identical
+bool(true)
+int(32)
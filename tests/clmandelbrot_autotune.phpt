@@ -0,0 +1,51 @@
+--TEST--
+clmandelbrot_autotune() picks a launch shape that renders the same image
+--INI--
+clmandelbrot.cache_dir={PWD}
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$options = array('iterations' => 300);
+$tuning = clmandelbrot_autotune(0, $options);
+var_dump(count($tuning['local']), $tuning['tuned']);
+var_dump($tuning['local'][0] * $tuning['local'][1] <= 256);
+var_dump(in_array($tuning['pixels_per_item'], array(1, 2, 4)));
+var_dump(count(glob(dirname(__FILE__) . '/*.tune')));
+
+foreach (clmandelbrot_variants() as $variant) {
+    if ($variant['device'] == 0 && strpos($variant['options'], 'CLM_ITERATIONS=300 ') !== false) {
+        var_dump($variant['tuning']['local'] === $tuning['local']);
+    }
+}
+
+/* images of sizes that are no multiple of any work group, rendered with
+   the tuned launch shape */
+foreach (array(array(251, 97), array(33, 257)) as $size) {
+    echo clm_compare($size[0], $size[1], $options), "\n";
+}
+
+var_dump(clmandelbrot_autotune(CLMANDELBROT_DEVICE_CPU));
+var_dump(clmandelbrot_autotune(0, array('precision' => 'perturbation')));
+?>
+--CLEAN--
+<?php
+foreach (glob(dirname(__FILE__) . '/*.{tune,clbin}', GLOB_BRACE) as $file) {
+    unlink($file);
+}
+?>
+--EXPECTF--
+int(2)
+bool(true)
+bool(true)
+bool(true)
+int(1)
+bool(true)
+identical
+identical
+
+Warning: clmandelbrot_autotune(): autotuning needs an OpenCL device in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_autotune(): only the direct kernel can be tuned in %s on line %d
+bool(false)
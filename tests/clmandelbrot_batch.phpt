@@ -0,0 +1,34 @@
+--TEST--
+clmandelbrot_batch() renders a sequence of frames
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$frames = array();
+for ($i = 0; $i < 8; $i++) {
+    $frames[] = array('width' => 96, 'height' => 64, 'unit' => 0.05 / ($i + 1),
+                      'center_x' => -0.75, 'center_y' => 0.1);
+}
+
+$images = clmandelbrot_batch($frames, null, 0, array('iterations' => 300));
+echo count($images), "\n";
+
+$single = clmandelbrot(96, 64, 0.05 / 6, 0, array('iterations' => 300, 'center_x' => -0.75, 'center_y' => 0.1));
+echo clm_diff($images[5], $single), "\n";
+
+$seen = array();
+$n = clmandelbrot_batch($frames, function ($im, $index) use (&$seen) {
+    $seen[] = $index . ':' . imagesx($im);
+    return $index < 4;
+});
+echo $n, ' ', implode(' ', $seen), "\n";
+
+var_dump(clmandelbrot_batch(array(array('width' => 10))));
+?>
+--EXPECTF--
+8
+identical
+5 0:96 1:96 2:96 3:96 4:96
+
+Warning: clmandelbrot_batch(): frames must have a width and a height in %s on line %d
+bool(false)
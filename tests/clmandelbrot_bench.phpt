@@ -0,0 +1,52 @@
+--TEST--
+benchmark harness sweeps cases and summarizes them
+--INI--
+clmandelbrot.shm_cache_size=0
+--FILE--
+<?php
+require dirname(__FILE__) . '/../bench/bench.inc';
+
+$config = clm_bench_defaults();
+$config['sizes'] = array(64);
+$config['views'] = array('overview', 'interior');
+$config['iterations'] = array(50);
+$config['devices'] = array('cpu', '0');
+$cases = clm_bench_cases($config);
+var_dump(count($cases));
+$both = $config;
+$both['outputs'] = array('image', 'raw');
+var_dump(count(clm_bench_cases($both)));
+
+$result = clm_bench_run($cases[0], 1, 5);
+var_dump($result['backend'], count($result['samples']));
+$time = $result['time'];
+var_dump($time['min'] <= $time['median'] && $time['median'] <= $time['p95']);
+var_dump($result['mpixel_iter_per_s'] > 0);
+
+$decoded = json_decode(json_encode(array('results' => array($result))), true);
+var_dump($decoded['results'][0]['view']);
+
+var_dump(clm_bench_percentile(array(1, 2, 3, 4, 5, 6, 7, 8, 9, 10), 50));
+var_dump(clm_bench_percentile(array(1, 2, 3, 4, 5, 6, 7, 8, 9, 10), 95));
+
+$slower = $result;
+$slower['time']['median'] *= 2;
+var_dump(array_keys(clm_bench_regressions(array($slower), $decoded, 10)));
+var_dump(clm_bench_regressions(array($result), $decoded, 10));
+?>
+--EXPECT--
+int(6)
+int(12)
+string(3) "cpu"
+int(5)
+bool(true)
+bool(true)
+string(8) "overview"
+int(5)
+int(10)
+array(1) {
+  [0]=>
+  string(33) "64/overview/1/50/cpu/direct/image"
+}
+array(0) {
+}
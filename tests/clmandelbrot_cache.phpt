@@ -0,0 +1,17 @@
+--TEST--
+clmandelbrot() reuses device resources across calls
+--FILE--
+<?php
+foreach (array(array(100, 100), array(64, 64), array(200, 150)) as $size) {
+    $im = clmandelbrot($size[0], $size[1]);
+    if (!is_resource($im)) {
+        echo 'didn\'t return resource', "\n";
+    } else {
+        printf("%dx%d\n", imagesx($im), imagesy($im));
+    }
+}
+?>
+--EXPECT--
+100x100
+64x64
+200x150
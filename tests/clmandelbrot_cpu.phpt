@@ -0,0 +1,16 @@
+--TEST--
+clmandelbrot() CPU renderer matches the OpenCL kernel
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$cpu = clmandelbrot(96, 96, 0, CLMANDELBROT_DEVICE_CPU);
+$cl = clmandelbrot(96, 96);
+if (!is_resource($cpu) || !is_resource($cl)) {
+    echo 'didn\'t return resource';
+} else {
+    echo clm_diff($cpu, $cl);
+}
+?>
+--EXPECT--
+identical
@@ -0,0 +1,34 @@
+--TEST--
+clmandelbrot() selects double precision and perturbation for deep zooms
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+// c = i lies on the boundary of the set at every depth
+$views = array(
+    array(1e-3, '0', '1'),
+    array(1e-9, '0', '1'),
+    array(1e-200, '0', '1.00000000000000000000000000000000000000000000000000000000000000000000000000000000'),
+);
+foreach ($views as $view) {
+    $options = array('center_x' => $view[1], 'center_y' => $view[2], 'iterations' => 3000);
+    $im = clmandelbrot(64, 48, $view[0], CLMANDELBROT_DEVICE_CPU, $options);
+    $info = clmandelbrot_last_info();
+    printf("%s %s %s\n", $info['precision'],
+           $info['skipped_iterations'] > 0 ? 'skipped' : 'none',
+           count(array_unique(clm_colors($im))) > 1 ? 'detail' : 'flat');
+}
+
+var_dump(clmandelbrot(64, 48, 1e-320, CLMANDELBROT_DEVICE_CPU));
+var_dump(clmandelbrot(64, 48, 0, CLMANDELBROT_DEVICE_CPU, array('center_x' => '0.5x')));
+?>
+--EXPECTF--
+float none detail
+double none detail
+perturbation skipped detail
+
+Warning: clmandelbrot(): unit must not be smaller than 1e-300 in %s on line %d
+bool(false)
+
+Warning: clmandelbrot(): center_x is not a valid number in %s on line %d
+bool(false)
@@ -0,0 +1,56 @@
+--TEST--
+clmandelbrot() histogram equalization on the device matches the CPU renderer
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$palette = array(0x000764, 0x206bcb, 0xedffff, 0xffaa00, 0x000000);
+foreach (array(array(), array('palette' => $palette), array('precision' => 'double')) as $extra) {
+    $options = array('iterations' => 300, 'equalize' => true) + $extra;
+    $gpu = clm_colors(clmandelbrot(97, 61, 0, 0, $options));
+    $gpuHistogram = clmandelbrot_last_histogram();
+    $cpu = clm_colors(clmandelbrot(97, 61, 0, CLMANDELBROT_DEVICE_CPU, $options));
+    $cpuHistogram = clmandelbrot_last_histogram();
+    printf("%s: %s, %s\n", key($extra) ? key($extra) : 'gray',
+           $gpu === $cpu ? 'identical' : 'different',
+           $gpuHistogram === $cpuHistogram ? 'same histogram' : 'other histogram');
+}
+
+/* the bins cover every pixel, the last one those that never escape */
+$h = $gpuHistogram;
+var_dump(count($h['bins']), array_sum($h['bins']) == 97 * 61,
+         $h['escaped'] + $h['interior'] == 97 * 61, $h['interior'] == $h['bins'][300]);
+$sum = 0;
+foreach (array_slice($h['bins'], 0, 300) as $n => $count) {
+    $sum += $n * $count;
+}
+var_dump($h['bins'][$h['min']] > 0, $h['bins'][$h['max']] > 0,
+         abs($h['mean'] - $sum / $h['escaped']) < 1e-9,
+         array_sum(array_slice($h['bins'], 0, $h['min'])) == 0,
+         array_sum(array_slice($h['bins'], $h['max'] + 1, 300 - $h['max'] - 1)) == 0);
+
+/* ranks spread the few escape counts of a shallow view over many shades */
+$shades = array_count_values(array_map(function ($c) { return $c & 0xff; },
+                                       clm_colors(clmandelbrot(97, 61, 0, 0, array('iterations' => 300, 'equalize' => true)))));
+echo count($shades) > 10 ? 'spread' : 'flat', "\n";
+
+/* a render without equalization has no histogram */
+clmandelbrot(32, 32, 0, 0);
+var_dump(clmandelbrot_last_histogram());
+?>
+--EXPECT--
+gray: identical, same histogram
+palette: identical, same histogram
+precision: identical, same histogram
+int(301)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+spread
+NULL
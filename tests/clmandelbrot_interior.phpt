@@ -0,0 +1,27 @@
+--TEST--
+clmandelbrot() interior checks do not change the image
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$off = array('iterations' => 2000, 'interior_check' => false, 'periodicity' => false);
+$on = array('iterations' => 2000);
+foreach (array(0, CLMANDELBROT_DEVICE_CPU) as $device) {
+    $plain = clmandelbrot(96, 64, 0, $device, $off);
+    $checked = clmandelbrot(96, 64, 0, $device, $on);
+    echo clm_diff($plain, $checked), "\n";
+}
+echo clm_diff(clmandelbrot(96, 64, 0, 0, $on), clmandelbrot(96, 64, 0, CLMANDELBROT_DEVICE_CPU, $on)), "\n";
+
+foreach (clmandelbrot_variants() as $variant) {
+    if ($variant['device'] == 0 && strpos($variant['options'], 'CLM_ITERATIONS=2000') !== false) {
+        echo strpos($variant['options'], 'CLM_PERIODICITY') !== false ? 'periodicity' : 'plain', "\n";
+    }
+}
+?>
+--EXPECT--
+identical
+identical
+identical
+plain
+periodicity
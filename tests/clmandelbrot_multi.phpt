@@ -0,0 +1,26 @@
+--TEST--
+clmandelbrot() on all devices and clmandelbrot_last_info()
+--SKIPIF--
+<?php if (!cl_get_devices()) die('skip no OpenCL device'); ?>
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$all = clmandelbrot(200, 300, 0, CLMANDELBROT_DEVICE_ALL);
+$info = clmandelbrot_last_info();
+echo $info['backend'], "\n";
+$rows = 0;
+foreach ($info['devices'] as $stat) {
+    $rows += $stat['rows'];
+}
+echo $rows, "\n";
+$one = clmandelbrot(200, 300);
+$info = clmandelbrot_last_info();
+echo $info['backend'], "\n";
+echo clm_diff($all, $one);
+?>
+--EXPECT--
+multi
+300
+opencl
+identical
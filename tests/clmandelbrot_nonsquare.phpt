@@ -0,0 +1,22 @@
+--TEST--
+clmandelbrot() with a non-square image
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$w = 120;
+$h = 60;
+$im = clmandelbrot($w, $h);
+printf("%dx%d\n", imagesx($im), imagesy($im));
+// the set is symmetric about the real axis: row y mirrors row (h - 2 - y)
+$colors = clm_colors($im);
+$asym = 0;
+for ($y = 0; $y <= $h - 2; $y++) {
+    $asym += count(array_diff_assoc(array_slice($colors, $y * $w, $w),
+                                    array_slice($colors, ($h - 2 - $y) * $w, $w)));
+}
+echo $asym ? "$asym pixels asymmetric" : 'symmetric', "\n";
+?>
+--EXPECT--
+120x60
+symmetric
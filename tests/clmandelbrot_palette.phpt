@@ -0,0 +1,45 @@
+--TEST--
+clmandelbrot() colours the image with a palette on the device
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$palette = array(0x000764, 0x206bcb, 0xedffff, 0xffaa00, 0x000000);
+foreach (array(false, true) as $smooth) {
+    foreach (array('float', 'double') as $precision) {
+        $options = array('iterations' => 300, 'palette' => $palette, 'smooth' => $smooth,
+                         'precision' => $precision);
+        $gpu = clm_colors(clmandelbrot(97, 61, 0, 0, $options));
+        $cpu = clm_colors(clmandelbrot(97, 61, 0, CLMANDELBROT_DEVICE_CPU, $options));
+        /* smooth colouring takes logarithms, which may round differently */
+        printf("%s %s: %s\n", $smooth ? 'smooth' : 'banded', $precision,
+               $smooth ? (clm_distance($gpu, $cpu) <= 2 ? 'close' : 'far')
+                       : ($gpu === $cpu ? 'identical' : 'different'));
+    }
+}
+
+$options = array('iterations' => 300, 'palette' => $palette, 'smooth' => false);
+echo clm_compare(97, 61, $options + array('antialias' => 3, 'antialias_mode' => 'adaptive')), "\n";
+
+/* the interior takes the last colour, and subdivision falls back to direct */
+$colors = clm_colors(clmandelbrot(97, 61, 0, 0, $options));
+printf("%06x\n", $colors[30 * 97 + 48]);
+echo $colors === clm_colors(clmandelbrot(97, 61, 0, 0, $options + array('mode' => 'subdivide'))) ? 'identical' : 'different', "\n";
+
+var_dump(clmandelbrot(32, 32, 0, 0, array('palette' => 0xff0000)));
+var_dump(clmandelbrot(32, 32, 0, 0, array('palette' => array(0xff0000))));
+?>
+--EXPECTF--
+banded float: identical
+banded double: identical
+smooth float: close
+smooth double: close
+identical
+000000
+identical
+
+Warning: clmandelbrot(): palette must be an array of colors in %s on line %d
+bool(false)
+
+Warning: clmandelbrot(): palette must have between 2 and 256 colors in %s on line %d
+bool(false)
@@ -0,0 +1,59 @@
+--TEST--
+clmandelbrot_progressive() refines in passes and ends with the direct image
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$strides = array();
+$image = clmandelbrot_progressive(203, 150, function ($im, $stride) use (&$strides) {
+    $strides[] = $stride;
+});
+echo implode(' ', $strides), "\n";
+$info = clmandelbrot_last_info();
+echo $info['mode'], ' ', $info['iterated_pixels'], "\n";
+
+$direct = clmandelbrot(203, 150);
+echo clm_diff($direct, $image), "\n";
+
+/* renders on the same device from the callback leave the passes alone */
+$image = clmandelbrot_progressive(203, 150, function ($im, $stride) {
+    clmandelbrot(400, 300, 0.001);
+});
+echo clm_diff($direct, $image), "\n";
+
+/* the coarse pass spreads each computed pixel over its block */
+$strides = array();
+$image = clmandelbrot_progressive(64, 64, function ($im, $stride) use (&$strides) {
+    $strides[] = $stride;
+    return false;
+});
+echo implode(' ', $strides), "\n";
+var_dump(imagecolorat($image, 7, 7) == imagecolorat($image, 0, 0));
+$info = clmandelbrot_last_info();
+echo $info['iterated_pixels'], "\n";
+
+$strides = array();
+clmandelbrot_progressive(64, 48, function ($im, $stride) use (&$strides) {
+    $strides[] = $stride;
+}, 0, CLMANDELBROT_DEVICE_CPU);
+echo implode(' ', $strides), "\n";
+
+var_dump(clmandelbrot_progressive(64, 48, 'no_such_function'));
+var_dump(clmandelbrot_progressive(64, 48, function ($im, $stride) {}, 0, 0,
+                                  array('palette' => array(0x000764, 0xedffff, 0x000000))));
+?>
+--EXPECTF--
+8 4 2 1
+progressive 30450
+identical
+identical
+8
+bool(true)
+256
+1
+
+Warning: clmandelbrot_progressive(): callback is not callable in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_progressive(): progressive passes cannot be coloured with a palette in %s on line %d
+bool(false)
@@ -0,0 +1,68 @@
+--TEST--
+clmandelbrot_raw() and clmandelbrot_encode() return the shades without a gd image
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$image = clmandelbrot(120, 90);
+$raw = clmandelbrot_raw(120, 90);
+var_dump(strlen($raw));
+
+echo clm_gray($image) === $raw ? 'identical' : 'different', "\n";
+
+var_dump(clmandelbrot_raw(64, 48, 0, CLMANDELBROT_DEVICE_CPU) === clmandelbrot_raw(64, 48));
+
+$pgm = clmandelbrot_encode('pgm', 120, 90);
+var_dump($pgm === "P5\n120 90\n255\n" . $raw);
+$ppm = clmandelbrot_encode('ppm', 120, 90);
+var_dump(strlen($ppm) == strlen("P6\n120 90\n255\n") + 3 * 120 * 90);
+
+foreach (array(0, 1, 9) as $level) {
+    $png = clmandelbrot_encode('png', 120, 90, 0, 0, array('compression' => $level));
+    /* the grayscale PNG decodes to a palette image */
+    $decoded = imagecreatetruecolor(120, 90);
+    imagecopy($decoded, imagecreatefromstring($png), 0, 0, 0, 0, 120, 90);
+    echo $level, ': ', clm_gray($decoded) === $raw ? 'identical' : 'different', "\n";
+}
+
+$stream = fopen('php://memory', 'w+');
+$written = clmandelbrot_encode('png', 120, 90, 0, 0, null, $stream);
+rewind($stream);
+var_dump($written === strlen(stream_get_contents($stream)));
+var_dump($written === strlen(clmandelbrot_encode('png', 120, 90)));
+
+var_dump(clmandelbrot_encode('gif', 120, 90));
+var_dump(clmandelbrot_encode('png', 120, 90, 0, 0, array('compression' => 10)));
+var_dump(clmandelbrot_raw(0, 90));
+
+/* shades have no colours */
+$options = array('palette' => array(0x000764, 0xedffff, 0x000000));
+var_dump(clmandelbrot_raw(120, 90, 0, 0, $options));
+var_dump(clmandelbrot_encode('pgm', 120, 90, 0, 0, $options));
+?>
+--EXPECTF--
+int(10800)
+identical
+bool(true)
+bool(true)
+bool(true)
+0: identical
+1: identical
+9: identical
+bool(true)
+bool(true)
+
+Warning: clmandelbrot_encode(): unknown format 'gif' in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_encode(): compression must be between 0 and 9 in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_raw(): invalid image dimensions in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_raw(): palettes need an image to colour in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_encode(): palettes need an image to colour in %s on line %d
+bool(false)
@@ -0,0 +1,25 @@
+--TEST--
+clmandelbrot_raw() on the CPU renders double precision and perturbation views
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+// c = i lies on the boundary of the set at every depth
+$views = array(
+    array(1e-9, 'double'),
+    array(1e-9, 'perturbation'),
+    array(1e-200, 'auto'),
+);
+foreach ($views as $view) {
+    $options = array('center_x' => '0', 'center_y' => '1', 'iterations' => 3000,
+                     'precision' => $view[1]);
+    $image = clmandelbrot(64, 48, $view[0], CLMANDELBROT_DEVICE_CPU, $options);
+    $raw = clmandelbrot_raw(64, 48, $view[0], CLMANDELBROT_DEVICE_CPU, $options);
+    $info = clmandelbrot_last_info();
+    echo $info['precision'], ': ', clm_gray($image) === $raw ? 'identical' : 'different', "\n";
+}
+?>
+--EXPECT--
+double: identical
+perturbation: identical
+perturbation: identical
@@ -0,0 +1,42 @@
+--TEST--
+clmandelbrot() serves repeated renders from the shared render cache
+--INI--
+clmandelbrot.shm_cache_size=4194304
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$first = clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU);
+$info = clmandelbrot_last_info();
+echo $info['backend'], "\n";
+
+$second = clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU);
+$info = clmandelbrot_last_info();
+echo $info['backend'], ' ', $info['iterated_pixels'], "\n";
+
+echo clm_diff($first, $second), "\n";
+
+/* any parameter that changes the pixels is part of the key */
+clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU, array('iterations' => 50));
+$info = clmandelbrot_last_info();
+echo $info['backend'], "\n";
+
+/* the interior and periodicity checks do not */
+clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU, array('periodicity' => false));
+$info = clmandelbrot_last_info();
+echo $info['backend'], "\n";
+
+/* palette renders keep their colours */
+$options = array('palette' => array(0x000764, 0x206bcb, 0xedffff, 0xffaa00, 0x000000));
+$first = clm_colors(clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU, $options));
+$second = clm_colors(clmandelbrot(160, 120, 0, CLMANDELBROT_DEVICE_CPU, $options));
+$info = clmandelbrot_last_info();
+echo $info['backend'], ' ', $first === $second ? 'identical' : 'different', "\n";
+?>
+--EXPECT--
+cpu
+cache 0
+identical
+cpu
+cache
+cache identical
@@ -0,0 +1,62 @@
+--TEST--
+clmandelbrot_stats() reports stage timings and their histograms
+--FILE--
+<?php
+clmandelbrot_stats(true);
+for ($i = 0; $i < 3; $i++) {
+    clmandelbrot(200, 150, 0, 0, array('iterations' => 100 + $i));
+}
+$stats = clmandelbrot_stats();
+
+var_dump(array_keys($stats['stages']));
+var_dump($stats['stages']['total']['count']);
+/* the devices are enumerated once per process, by the first render */
+var_dump($stats['stages']['devices']['count']);
+var_dump(isset($stats['last']['total'], $stats['last']['draw']));
+
+foreach (array('render', 'kernel', 'draw', 'total') as $name) {
+    $stage = $stats['stages'][$name];
+    $ok = $stage['count'] == 3
+        && $stage['min'] <= $stage['mean'] && $stage['mean'] <= $stage['max']
+        && abs($stage['total'] - $stage['mean'] * 3) < 1e-9
+        && array_sum($stage['histogram']) == 3;
+    echo $name, ': ', $ok ? 'ok' : 'inconsistent', "\n";
+}
+var_dump($stats['stages']['kernel']['total'] <= $stats['stages']['total']['total']);
+
+clmandelbrot_stats(true);
+clmandelbrot(64, 48, 0, CLMANDELBROT_DEVICE_CPU);
+$stats = clmandelbrot_stats();
+var_dump($stats['stages']['total']['count'], $stats['stages']['kernel']['count']);
+?>
+--EXPECT--
+array(9) {
+  [0]=>
+  string(7) "devices"
+  [1]=>
+  string(7) "context"
+  [2]=>
+  string(5) "build"
+  [3]=>
+  string(9) "reference"
+  [4]=>
+  string(6) "render"
+  [5]=>
+  string(6) "kernel"
+  [6]=>
+  string(8) "transfer"
+  [7]=>
+  string(4) "draw"
+  [8]=>
+  string(5) "total"
+}
+int(3)
+int(1)
+bool(true)
+render: ok
+kernel: ok
+draw: ok
+total: ok
+bool(true)
+int(1)
+int(0)
@@ -0,0 +1,38 @@
+--TEST--
+clmandelbrot() subdivide mode fills uniform tiles without iterating them
+--SKIPIF--
+<?php if (!cl_get_devices()) die('skip no OpenCL device'); ?>
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+function compare($options) {
+    $direct = clmandelbrot(256, 192, 0, 0, $options);
+    $subdivided = clmandelbrot(256, 192, 0, 0, $options + array('mode' => 'subdivide'));
+    $info = clmandelbrot_last_info();
+    echo $info['mode'], "\n";
+    var_dump($info['iterated_pixels'] > 0 && $info['iterated_pixels'] < 256 * 192);
+    echo clm_diff($direct, $subdivided), "\n";
+}
+
+compare(array());
+// several escape counts share each of the 256 shades
+compare(array('iterations' => 2000));
+
+clmandelbrot(64, 48, 0, CLMANDELBROT_DEVICE_CPU, array('mode' => 'subdivide'));
+$info = clmandelbrot_last_info();
+echo $info['mode'], ' ', $info['iterated_pixels'], "\n";
+
+var_dump(clmandelbrot(64, 48, 0, 0, array('mode' => 'boundary')));
+?>
+--EXPECTF--
+subdivide
+bool(true)
+identical
+subdivide
+bool(true)
+identical
+direct 3072
+
+Warning: clmandelbrot(): unknown mode 'boundary' in %s on line %d
+bool(false)
@@ -0,0 +1,66 @@
+--TEST--
+clmandelbrot_tile() and clmandelbrot_tiles() render slippy map tiles
+--SKIPIF--
+<?php if (PHP_INT_SIZE < 8) die('skip 64-bit integers are needed for zoom level 50'); ?>
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$options = array('size' => 64);
+$tile = clmandelbrot_tile(0, 0, 0, $options);
+echo imagesx($tile), 'x', imagesy($tile), "\n";
+
+/* the whole-map tile is the default view of the same size at unit 4/64,
+   centered at -0.5 */
+$view = clmandelbrot(64, 64, 4 / 64, 0, array('center_x' => -0.5));
+echo clm_diff($tile, $view), "\n";
+
+$tiles = clmandelbrot_tiles(3, 2, 3, 4, 4, $options);
+echo implode(',', array_keys($tiles)), ' ', implode(',', array_keys($tiles[3])), "\n";
+foreach ($tiles as $y => $row) {
+    foreach ($row as $x => $im) {
+        echo clm_diff($im, clmandelbrot_tile(3, $x, $y, $options)), "\n";
+    }
+}
+
+/* at this unit the tiles left of re = -2 need double precision and those
+   right of it float; a batch across both renders each tile as alone */
+$options = array('size' => 64);
+foreach (array(255, 256) as $x) {
+    clmandelbrot_tile(11, $x, 1023, $options);
+    $info = clmandelbrot_last_info();
+    echo $info['precision'], "\n";
+}
+$tiles = clmandelbrot_tiles(11, 255, 1023, 256, 1023, $options);
+foreach ($tiles[1023] as $x => $im) {
+    echo clm_diff($im, clmandelbrot_tile(11, $x, 1023, $options)), "\n";
+}
+
+var_dump(clmandelbrot_tile(2, 4, 0));
+var_dump(clmandelbrot_tile(51, 0, 0));
+// the tile count of this range wraps to 0 in a signed 64-bit long
+var_dump(clmandelbrot_tiles(50, 0, 0, (1 << 50) - 1, (1 << 50) - 1));
+?>
+--EXPECTF--
+64x64
+identical
+3,4 2,3,4
+identical
+identical
+identical
+identical
+identical
+identical
+double
+float
+identical
+identical
+
+Warning: clmandelbrot_tile(): tile 4/0 is outside of zoom level 2 in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_tile(): zoom level must be between 0 and 50 in %s on line %d
+bool(false)
+
+Warning: clmandelbrot_tiles(): the range must have between 1 and %d tiles in %s on line %d
+bool(false)
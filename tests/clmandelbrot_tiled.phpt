@@ -0,0 +1,15 @@
+--TEST--
+clmandelbrot() renders in tiles when clmandelbrot.tile_size is set
+--INI--
+clmandelbrot.tile_size=1000
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$tiled = clmandelbrot(150, 100);
+ini_set('clmandelbrot.tile_size', 0);
+$whole = clmandelbrot(150, 100);
+echo clm_diff($tiled, $whole);
+?>
+--EXPECT--
+identical
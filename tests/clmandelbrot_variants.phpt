@@ -0,0 +1,31 @@
+--TEST--
+clmandelbrot() compiles each set of kernel options once
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+$options = array('iterations' => 5000, 'bailout' => 3.0);
+$first = clmandelbrot(64, 64, 0, 0, $options);
+$second = clmandelbrot(64, 64, 0, 0, $options);
+$default = clmandelbrot(64, 64);
+if (!is_resource($first) || !is_resource($second) || !is_resource($default)) {
+    echo 'didn\'t return resource', "\n";
+}
+
+foreach (clmandelbrot_variants() as $variant) {
+    if ($variant['device'] == 0 && strpos($variant['options'], 'CLM_ITERATIONS=5000') !== false) {
+        printf("%s %d\n", $variant['kernel'], $variant['hits']);
+    }
+}
+
+$cpu = clmandelbrot(64, 64, 0, CLMANDELBROT_DEVICE_CPU, $options);
+echo clm_diff($cpu, $first), "\n";
+
+var_dump(clmandelbrot(64, 64, 0, 0, array('iterations' => 0)));
+?>
+--EXPECTF--
+MandelbrotRGB 1
+identical
+
+Warning: clmandelbrot(): iterations must be between 1 and 1000000 in %s on line %d
+bool(false)
@@ -0,0 +1,47 @@
+--TEST--
+clmandelbrot() vector kernels render the same image as the CPU renderer
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+/* widths that are no multiple of any vector, with and without the checks */
+$sizes = array(array(97, 61), array(250, 3));
+$flags = array(
+    array(),
+    array('interior_check' => false, 'periodicity' => false),
+    array('bailout' => 3.5),
+);
+foreach (array(1, 4, 8, 16) as $width) {
+    $same = true;
+    foreach ($sizes as $size) {
+        foreach ($flags as $options) {
+            $options += array('iterations' => 500, 'vector_width' => $width);
+            $same = $same && clm_compare($size[0], $size[1], $options) == 'identical';
+        }
+    }
+    echo $width, ': ', $same ? 'identical' : 'different', "\n";
+}
+
+$kernels = array();
+foreach (clmandelbrot_variants() as $variant) {
+    if ($variant['device'] == 0 && strpos($variant['options'], 'CLM_ITERATIONS=500 ') !== false) {
+        $kernels[$variant['kernel']] = true;
+    }
+}
+ksort($kernels);
+echo implode(' ', array_keys($kernels)), "\n";
+
+/* the width the device prefers is picked by default */
+var_dump(is_string(clmandelbrot_raw(64, 64, 0, 0, array('iterations' => 500))));
+var_dump(clmandelbrot_raw(64, 64, 0, 0, array('vector_width' => 3)));
+?>
+--EXPECTF--
+1: identical
+4: identical
+8: identical
+16: identical
+MandelbrotRGB MandelbrotRGBVec
+bool(true)
+
+Warning: clmandelbrot_raw(): vector_width must be 0, 1, 4, 8 or 16 in %s on line %d
+bool(false)
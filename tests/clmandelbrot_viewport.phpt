@@ -0,0 +1,93 @@
+--TEST--
+clmandelbrot_viewport() computes only the pixels a pan or an integer zoom brings into view
+--FILE--
+<?php
+require dirname(__FILE__) . '/clmandelbrot.inc';
+
+function clm_moved($name)
+{
+    $info = clmandelbrot_last_info();
+    printf("%s: %s, %d pixels\n", $name, $info['mode'], $info['iterated_pixels']);
+}
+
+$palette = array(0x000764, 0x206bcb, 0xedffff, 0xffaa00, 0x000000);
+foreach (array(array(), array('palette' => $palette)) as $options) {
+    $options += array('iterations' => 300, 'center_x' => -0.5);
+    $vp = clmandelbrot_viewport(64, 48, 0, 0, $options);
+    clm_moved('first');
+    $first = clm_colors(clmandelbrot_viewport_image($vp));
+    var_dump($first === clm_colors(clmandelbrot(64, 48, 0, 0, $options)));
+
+    /* the strips exposed on the right and at the top */
+    $moved = clm_colors(clmandelbrot_viewport_pan($vp, 5, -3));
+    clm_moved('pan');
+    $same = true;
+    for ($y = 3; $y < 48; $y++) {
+        for ($x = 0; $x < 59; $x++) {
+            $same = $same && $moved[$y * 64 + $x] === $first[($y - 3) * 64 + $x + 5];
+        }
+    }
+    var_dump($same);
+    var_dump(clm_colors(clmandelbrot_viewport_pan($vp, -5, 3)) === $first);
+    clm_moved('back');
+
+    /* every other pixel of every other row is kept, and comes back */
+    clmandelbrot_viewport_zoom($vp, 2);
+    clm_moved('zoom in');
+    var_dump(clm_colors(clmandelbrot_viewport_zoom($vp, 0.5)) === $first);
+    clm_moved('zoom out');
+
+    clmandelbrot_viewport_zoom($vp, 1.5);
+    clm_moved('zoom 1.5');
+}
+
+/* the samples of an antialiased view do not scale, so zooming out renders
+   the whole frame */
+$options = array('iterations' => 300, 'center_x' => -0.5, 'antialias' => 2);
+$vp = clmandelbrot_viewport(64, 48, 0, 0, $options);
+$zoomed = clm_colors(clmandelbrot_viewport_zoom($vp, 0.5));
+clm_moved('antialiased zoom out');
+$view = clmandelbrot_viewport_view($vp);
+var_dump($zoomed === clm_colors(clmandelbrot(64, 48, $view['unit'], 0, $view + $options)));
+
+$vp = clmandelbrot_viewport(64, 48, 0.125, 0, array('center_x' => -0.5));
+clmandelbrot_viewport_pan($vp, 4, 8);
+clmandelbrot_viewport_zoom($vp, 4);
+var_dump(clmandelbrot_viewport_view($vp));
+
+var_dump(@clmandelbrot_viewport(64, 48, 0, CLMANDELBROT_DEVICE_CPU));
+var_dump(@clmandelbrot_viewport(64, 48, 0, 0, array('equalize' => true)));
+?>
+--EXPECT--
+first: direct, 3072 pixels
+bool(true)
+pan: incremental, 417 pixels
+bool(true)
+bool(true)
+back: incremental, 417 pixels
+zoom in: incremental, 2304 pixels
+bool(true)
+zoom out: incremental, 2304 pixels
+zoom 1.5: direct, 3072 pixels
+first: direct, 3072 pixels
+bool(true)
+pan: incremental, 417 pixels
+bool(true)
+bool(true)
+back: incremental, 417 pixels
+zoom in: incremental, 2304 pixels
+bool(true)
+zoom out: incremental, 2304 pixels
+zoom 1.5: direct, 3072 pixels
+antialiased zoom out: direct, 3072 pixels
+bool(true)
+array(3) {
+  ["center_x"]=>
+  float(0)
+  ["center_y"]=>
+  float(-1)
+  ["unit"]=>
+  float(0.03125)
+}
+bool(false)
+bool(false)
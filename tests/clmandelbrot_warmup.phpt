@@ -0,0 +1,13 @@
+--TEST--
+clmandelbrot_warmup() function
+--FILE--
+<?php
+$result = clmandelbrot_warmup();
+if (is_array($result) && count($result) == count(cl_get_devices())) {
+    echo 'OK';
+} else {
+    echo 'NG';
+}
+?>
+--EXPECT--
+OK